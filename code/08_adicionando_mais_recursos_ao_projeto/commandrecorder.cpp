@@ -0,0 +1,178 @@
+#include "commandrecorder.h"
+
+#include <QElapsedTimer>
+#include <QRunnable>
+
+#include "features.h"
+#include "vulkanwindow.h"
+
+static const int MIN_ITEMS_PER_CHUNK = 64;
+static const int STATS_INTERVAL_FRAMES = 600;
+
+class RecordTask : public QRunnable
+{
+public:
+    explicit RecordTask(const std::function<void()> &function)
+        : m_function(function) {}
+
+    void run() override {
+        m_function();
+    }
+
+private:
+    std::function<void()> m_function;
+};
+
+void CommandRecorder::init(VulkanWindow *window,
+                           QVulkanDeviceFunctions *deviceFunctions,
+                           int threadCount) {
+    m_window = window;
+    m_deviceFunctions = deviceFunctions;
+    m_threadCount = qMax(1, threadCount);
+
+    m_threadPool.setMaxThreadCount(qMax(1, m_threadCount - 1));
+
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = m_window->graphicsQueueFamilyIndex();
+
+    VkDevice device = m_window->device();
+
+    m_frames.resize(m_window->concurrentFrameCount());
+    for (Frame &frame : m_frames) {
+        frame.contexts.resize(m_threadCount);
+        for (ThreadContext &context : frame.contexts) {
+            VkResult result = m_deviceFunctions->vkCreateCommandPool(
+                device,
+                &poolInfo,
+                nullptr,
+                &context.commandPool
+            );
+            if (result != VK_SUCCESS) {
+                qFatal("Failed to create secondary command pool: %d", result);
+            }
+
+            VkCommandBufferAllocateInfo allocInfo = {};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = context.commandPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocInfo.commandBufferCount = 1;
+
+            result = m_deviceFunctions->vkAllocateCommandBuffers(device, &allocInfo, &context.commandBuffer);
+            if (result != VK_SUCCESS) {
+                qFatal("Failed to allocate secondary command buffer: %d", result);
+            }
+        }
+    }
+}
+
+void CommandRecorder::release() {
+    m_threadPool.waitForDone();
+
+    VkDevice device = m_window->device();
+    for (const Frame &frame : m_frames) {
+        for (const ThreadContext &context : frame.contexts)
+            m_deviceFunctions->vkDestroyCommandPool(device, context.commandPool, nullptr);
+    }
+    m_frames.clear();
+}
+
+void CommandRecorder::invalidate() {
+    for (Frame &frame : m_frames)
+        frame.valid = false;
+}
+
+QVector<VkCommandBuffer> CommandRecorder::record(VkRenderPass renderPass,
+                                                 VkFramebuffer framebuffer,
+                                                 int itemCount,
+                                                 const RecordFunction &recordChunk,
+                                                 bool reuse) {
+    QElapsedTimer timer;
+    timer.start();
+
+    Frame &frame = m_frames[m_window->currentFrame()];
+    if (reuse && frame.valid) {
+        ++m_reuseCount;
+        updateStats(itemCount, frame.commandBuffers.size(), timer.nsecsElapsed() / 1000);
+        return frame.commandBuffers;
+    }
+
+    VkDevice device = m_window->device();
+    const QVector<ThreadContext> &contexts = frame.contexts;
+
+    const int chunkCount = qBound(
+        1,
+        (itemCount + MIN_ITEMS_PER_CHUNK - 1) / MIN_ITEMS_PER_CHUNK,
+        m_threadCount
+    );
+    const int chunkSize = (itemCount + chunkCount - 1) / chunkCount;
+
+    VkCommandBufferInheritanceInfo inheritanceInfo = {};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = renderPass;
+    inheritanceInfo.subpass = 0;
+    // Buffers kept for reuse are executed with every swapchain image, so
+    // they cannot name a framebuffer.
+    inheritanceInfo.framebuffer = reuse ? VK_NULL_HANDLE : framebuffer;
+    inheritanceInfo.pipelineStatistics = m_pipelineStatistics;
+
+    auto recordCommands = [=](const ThreadContext &context, int first, int last) {
+        m_deviceFunctions->vkResetCommandPool(device, context.commandPool, 0);
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        if (!reuse)
+            beginInfo.flags |= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+        VkResult result = m_deviceFunctions->vkBeginCommandBuffer(context.commandBuffer, &beginInfo);
+        if (result != VK_SUCCESS) {
+            qFatal("Failed to begin secondary command buffer: %d", result);
+        }
+
+        recordChunk(context.commandBuffer, first, last);
+
+        result = m_deviceFunctions->vkEndCommandBuffer(context.commandBuffer);
+        if (result != VK_SUCCESS) {
+            qFatal("Failed to end secondary command buffer: %d", result);
+        }
+    };
+
+    for (int chunk = 1; chunk < chunkCount; ++chunk) {
+        const ThreadContext &context = contexts[chunk];
+        const int first = chunk * chunkSize;
+        const int last = qMin(itemCount, first + chunkSize);
+        m_threadPool.start(new RecordTask([=]() { recordCommands(context, first, last); }));
+    }
+
+    recordCommands(contexts[0], 0, qMin(itemCount, chunkSize));
+    m_threadPool.waitForDone();
+
+    frame.commandBuffers.clear();
+    for (int chunk = 0; chunk < chunkCount; ++chunk)
+        frame.commandBuffers.append(contexts[chunk].commandBuffer);
+    frame.valid = reuse;
+
+    updateStats(itemCount, chunkCount, timer.nsecsElapsed() / 1000);
+
+    return frame.commandBuffers;
+}
+
+void CommandRecorder::updateStats(int itemCount, int chunkCount, qint64 recordTime) {
+    m_lastRecordTime = recordTime;
+    m_totalRecordTime += recordTime;
+    if (++m_recordCount == STATS_INTERVAL_FRAMES) {
+        qCDebug(lcStats, "Recorded %d items into %d secondary command buffers: %lld us per frame on average,"
+                " %d of %d frames reused",
+                itemCount,
+                chunkCount,
+                static_cast<long long>(m_totalRecordTime / m_recordCount),
+                m_reuseCount,
+                m_recordCount);
+        m_totalRecordTime = 0;
+        m_recordCount = 0;
+        m_reuseCount = 0;
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef COMMANDRECORDER_H
+#define COMMANDRECORDER_H
+
+#include <QThreadPool>
+#include <QVulkanDeviceFunctions>
+#include <QVector>
+#include <functional>
+
+class VulkanWindow;
+
+class CommandRecorder
+{
+public:
+    typedef std::function<void(VkCommandBuffer commandBuffer, int first, int last)> RecordFunction;
+
+    void init(VulkanWindow *window, QVulkanDeviceFunctions *deviceFunctions, int threadCount);
+    void release();
+
+    QVector<VkCommandBuffer> record(VkRenderPass renderPass,
+                                    VkFramebuffer framebuffer,
+                                    int itemCount,
+                                    const RecordFunction &recordChunk,
+                                    bool reuse);
+    void invalidate();
+
+    // Statistics of the query the primary buffer has active around
+    // vkCmdExecuteCommands; needs the inheritedQueries feature.
+    void setPipelineStatistics(VkQueryPipelineStatisticFlags statistics) {
+        m_pipelineStatistics = statistics;
+    }
+
+    int threadCount() const {
+        return m_threadCount;
+    }
+
+    qint64 lastRecordTime() const {
+        return m_lastRecordTime;
+    }
+
+private:
+    struct ThreadContext {
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    };
+
+    struct Frame {
+        QVector<ThreadContext> contexts;
+        QVector<VkCommandBuffer> commandBuffers;
+        bool valid = false;
+    };
+
+    VulkanWindow *m_window = nullptr;
+    QVulkanDeviceFunctions *m_deviceFunctions = nullptr;
+
+    int m_threadCount = 1;
+    QThreadPool m_threadPool;
+    QVector<Frame> m_frames;
+    VkQueryPipelineStatisticFlags m_pipelineStatistics = 0;
+    qint64 m_lastRecordTime = 0;
+    qint64 m_totalRecordTime = 0;
+    int m_recordCount = 0;
+    int m_reuseCount = 0;
+
+private:
+    void updateStats(int itemCount, int chunkCount, qint64 recordTime);
+};
+
+#endif // COMMANDRECORDER_H
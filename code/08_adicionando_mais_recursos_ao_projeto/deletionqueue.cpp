@@ -0,0 +1,87 @@
+#include "deletionqueue.h"
+
+#include "vulkanwindow.h"
+
+void DeletionQueue::init(VulkanWindow *window,
+                         QVulkanDeviceFunctions *deviceFunctions,
+                         MemoryAllocator *memoryAllocator) {
+    m_window = window;
+    m_deviceFunctions = deviceFunctions;
+    m_memoryAllocator = memoryAllocator;
+}
+
+void DeletionQueue::enqueue(Entry &entry) {
+    entry.frame = m_frameCounter;
+    m_entries.append(entry);
+}
+
+void DeletionQueue::destroyBuffer(VkBuffer buffer, MemoryAllocation &memory) {
+    Entry entry;
+    entry.buffer = buffer;
+    entry.memory = memory;
+    enqueue(entry);
+
+    memory = MemoryAllocation();
+}
+
+void DeletionQueue::destroyImage(VkImage image, VkImageView view, MemoryAllocation &memory) {
+    Entry entry;
+    entry.image = image;
+    entry.view = view;
+    entry.memory = memory;
+    enqueue(entry);
+
+    memory = MemoryAllocation();
+}
+
+void DeletionQueue::destroyDescriptorPool(VkDescriptorPool pool) {
+    Entry entry;
+    entry.pool = pool;
+    enqueue(entry);
+}
+
+void DeletionQueue::destroyLater(const std::function<void()> &destroy) {
+    Entry entry;
+    entry.destroy = destroy;
+    enqueue(entry);
+}
+
+void DeletionQueue::destroy(Entry &entry) {
+    VkDevice device = m_window->device();
+
+    if (entry.view)
+        m_deviceFunctions->vkDestroyImageView(device, entry.view, nullptr);
+    if (entry.image)
+        m_deviceFunctions->vkDestroyImage(device, entry.image, nullptr);
+    if (entry.buffer)
+        m_deviceFunctions->vkDestroyBuffer(device, entry.buffer, nullptr);
+    if (entry.pool)
+        m_deviceFunctions->vkDestroyDescriptorPool(device, entry.pool, nullptr);
+
+    m_memoryAllocator->free(entry.memory);
+
+    if (entry.destroy)
+        entry.destroy();
+}
+
+void DeletionQueue::collect() {
+    ++m_frameCounter;
+
+    const quint64 framesInFlight = quint64(m_window->concurrentFrameCount());
+
+    int retired = 0;
+    while (retired < m_entries.size()
+           && m_frameCounter - m_entries[retired].frame > framesInFlight) {
+        destroy(m_entries[retired]);
+        ++retired;
+    }
+
+    m_entries.remove(0, retired);
+}
+
+void DeletionQueue::release() {
+    for (Entry &entry : m_entries)
+        destroy(entry);
+
+    m_entries.clear();
+}
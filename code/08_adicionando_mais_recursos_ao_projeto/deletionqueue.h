@@ -0,0 +1,54 @@
+#ifndef DELETIONQUEUE_H
+#define DELETIONQUEUE_H
+
+#include <QVulkanDeviceFunctions>
+#include <QVector>
+#include <functional>
+
+#include "memoryallocator.h"
+
+class VulkanWindow;
+
+class DeletionQueue
+{
+public:
+    void init(VulkanWindow *window,
+              QVulkanDeviceFunctions *deviceFunctions,
+              MemoryAllocator *memoryAllocator);
+    void release();
+
+    void destroyBuffer(VkBuffer buffer, MemoryAllocation &memory);
+    void destroyImage(VkImage image, VkImageView view, MemoryAllocation &memory);
+    void destroyDescriptorPool(VkDescriptorPool pool);
+    void destroyLater(const std::function<void()> &destroy);
+
+    void collect();
+
+    int pendingCount() const {
+        return m_entries.size();
+    }
+
+private:
+    struct Entry {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;
+        VkDescriptorPool pool = VK_NULL_HANDLE;
+        MemoryAllocation memory;
+        std::function<void()> destroy;
+        quint64 frame = 0;
+    };
+
+    VulkanWindow *m_window = nullptr;
+    QVulkanDeviceFunctions *m_deviceFunctions = nullptr;
+    MemoryAllocator *m_memoryAllocator = nullptr;
+
+    quint64 m_frameCounter = 0;
+    QVector<Entry> m_entries;
+
+private:
+    void enqueue(Entry &entry);
+    void destroy(Entry &entry);
+};
+
+#endif // DELETIONQUEUE_H
@@ -0,0 +1,42 @@
+#include "features.h"
+
+Q_LOGGING_CATEGORY(lcStats, "qtvk.stats", QtWarningMsg)
+
+struct FeatureVariable
+{
+    const char *name;
+    const char *description;
+};
+
+// In Feature order.
+static const FeatureVariable FEATURE_VARIABLES[] = {
+    {"QTVK_NO_TRANSFER_QUEUE", "upload on the graphics queue instead of a dedicated transfer queue"},
+    {"QTVK_NO_DIRECT_UPLOAD", "always upload vertex buffers through a staging buffer"},
+    {"QTVK_NO_BINDLESS", "bind one descriptor set per material instead of a texture table"},
+    {"QTVK_NO_TEXTURE_STREAMING", "keep every mip level of bindless textures resident"},
+    {"QTVK_NO_ATLAS", "give small textures their own images instead of packing them"},
+    {"QTVK_NO_PARALLEL_RECORDING", "record draws on the GUI thread only"},
+    {"QTVK_NO_COMMAND_REUSE", "re-record secondary command buffers every frame"},
+    {"QTVK_NO_PIPELINE_CACHE", "neither load nor save the pipeline cache file"},
+    {"QTVK_NO_ASYNC_PIPELINES", "compile pipelines on the GUI thread"},
+    {"QTVK_NO_TRANSIENT_DEPTH", "store the depth buffer and keep it in regular device memory"},
+    {"QTVK_NO_GPU_CULLING", "cull instances on the CPU"},
+    {"QTVK_NO_DRAW_INDIRECT_COUNT", "draw culled instances with fixed-count indirect draws"},
+    {"QTVK_NO_PIPELINE_STATISTICS", "skip the pipeline statistics queries"},
+};
+
+static_assert(sizeof(FEATURE_VARIABLES) / sizeof(FEATURE_VARIABLES[0]) == size_t(Feature::Count),
+              "every feature needs an environment variable");
+
+bool isFeatureEnabled(Feature feature) {
+    return !qEnvironmentVariableIsSet(FEATURE_VARIABLES[int(feature)].name);
+}
+
+QString featureHelpText() {
+    QString text = "Set these environment variables to switch an optimization off:\n";
+    for (const FeatureVariable &variable : FEATURE_VARIABLES) {
+        text += QString("  %1  %2\n").arg(variable.name, -28).arg(variable.description);
+    }
+    text += "Set QT_LOGGING_RULES=\"qtvk.stats.debug=true\" to log benchmark statistics.";
+    return text;
+}
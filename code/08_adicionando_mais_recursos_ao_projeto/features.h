@@ -0,0 +1,34 @@
+#ifndef FEATURES_H
+#define FEATURES_H
+
+#include <QLoggingCategory>
+#include <QString>
+
+// Benchmark and statistics output. Off by default; enable it with
+// QT_LOGGING_RULES="qtvk.stats.debug=true".
+Q_DECLARE_LOGGING_CATEGORY(lcStats)
+
+// Optimizations that can be switched off to compare against the path they
+// replaced. Setting QTVK_NO_<NAME> in the environment disables one; --help
+// lists them all.
+enum class Feature {
+    TransferQueue,
+    DirectUpload,
+    Bindless,
+    TextureStreaming,
+    Atlas,
+    ParallelRecording,
+    CommandReuse,
+    PipelineCache,
+    AsyncPipelines,
+    TransientDepth,
+    GpuCulling,
+    DrawIndirectCount,
+    PipelineStatistics,
+    Count
+};
+
+bool isFeatureEnabled(Feature feature);
+QString featureHelpText();
+
+#endif // FEATURES_H
@@ -0,0 +1,414 @@
+#include "gpuculler.h"
+
+#include <QVulkanFunctions>
+#include <array>
+
+#include "deletionqueue.h"
+#include "features.h"
+#include "renderer.h"
+#include "spirvshaders.h"
+#include "vulkanwindow.h"
+
+static const uint32_t WORKGROUP_SIZE = 64;
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+bool GpuCuller::init(Renderer *renderer,
+                     VulkanWindow *window,
+                     QVulkanDeviceFunctions *deviceFunctions,
+                     DeletionQueue *deletionQueue) {
+    m_renderer = renderer;
+    m_window = window;
+    m_deviceFunctions = deviceFunctions;
+    m_deletionQueue = deletionQueue;
+
+    if (!isFeatureEnabled(Feature::GpuCulling) || !graphicsQueueSupportsCompute())
+        return false;
+
+    if (m_window->drawIndirectCountEnabled()) {
+        m_drawIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndirectCountKHR>(
+            m_window->vulkanInstance()->getInstanceProcAddr("vkCmdDrawIndirectCountKHR")
+        );
+    }
+
+    createPipeline();
+
+    qCDebug(lcStats, "GPU culling enabled, %s",
+            m_drawIndirectCount ? "using vkCmdDrawIndirectCount" : "using fixed-count indirect draws");
+    return true;
+}
+
+bool GpuCuller::graphicsQueueSupportsCompute() const {
+    QVulkanFunctions *functions = m_window->vulkanInstance()->functions();
+
+    uint32_t queueFamilyCount = 0;
+    functions->vkGetPhysicalDeviceQueueFamilyProperties(m_window->physicalDevice(), &queueFamilyCount, nullptr);
+    QVector<VkQueueFamilyProperties> properties(int(queueFamilyCount));
+    functions->vkGetPhysicalDeviceQueueFamilyProperties(
+        m_window->physicalDevice(),
+        &queueFamilyCount,
+        properties.data()
+    );
+
+    const uint32_t graphicsFamily = m_window->graphicsQueueFamilyIndex();
+    return graphicsFamily < queueFamilyCount
+        && (properties[int(graphicsFamily)].queueFlags & VK_QUEUE_COMPUTE_BIT);
+}
+
+void GpuCuller::createPipeline() {
+    std::array<VkDescriptorSetLayoutBinding, 3> bindings = {};
+    for (uint32_t i = 0; i < bindings.size(); ++i) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    VkDevice device = m_window->device();
+    VkResult result = m_deviceFunctions->vkCreateDescriptorSetLayout(
+        device,
+        &layoutInfo,
+        nullptr,
+        &m_descriptorSetLayout
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create culling descriptor set layout: %d", result);
+    }
+
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(CullParams);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    result = m_deviceFunctions->vkCreatePipelineLayout(
+        device,
+        &pipelineLayoutInfo,
+        nullptr,
+        &m_pipelineLayout
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create culling pipeline layout: %d", result);
+    }
+
+    VkShaderModuleCreateInfo moduleInfo = {};
+    moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    moduleInfo.codeSize = cullComp.size;
+    moduleInfo.pCode = cullComp.code;
+
+    VkShaderModule shaderModule;
+    result = m_deviceFunctions->vkCreateShaderModule(device, &moduleInfo, nullptr, &shaderModule);
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create culling shader module: %d", result);
+    }
+
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = shaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = m_pipelineLayout;
+
+    result = m_deviceFunctions->vkCreateComputePipelines(
+        device,
+        m_renderer->pipelineCache(),
+        1,
+        &pipelineInfo,
+        nullptr,
+        &m_pipeline
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create culling pipeline: %d", result);
+    }
+
+    m_deviceFunctions->vkDestroyShaderModule(device, shaderModule, nullptr);
+}
+
+void GpuCuller::release() {
+    if (!isCreated())
+        return;
+
+    VkDevice device = m_window->device();
+    m_deviceFunctions->vkDestroyPipeline(device, m_pipeline, nullptr);
+    m_deviceFunctions->vkDestroyPipelineLayout(device, m_pipelineLayout, nullptr);
+    m_deviceFunctions->vkDestroyDescriptorSetLayout(device, m_descriptorSetLayout, nullptr);
+    m_pipeline = VK_NULL_HANDLE;
+    m_pipelineLayout = VK_NULL_HANDLE;
+    m_descriptorSetLayout = VK_NULL_HANDLE;
+    m_drawIndirectCount = nullptr;
+}
+
+void GpuCuller::create(CulledInstances &target, int capacity, uint32_t vertexCount, const QString &name) {
+    const int frameCount = m_window->concurrentFrameCount();
+    const VkDeviceSize alignment =
+        m_window->physicalDeviceProperties()->limits.minStorageBufferOffsetAlignment;
+
+    target.capacity = capacity;
+    target.vertexCount = vertexCount;
+
+    // Each frame in flight culls into its own region, so the GPU can still
+    // be drawing the previous frame's survivors.
+    target.instanceStride = alignUp(VkDeviceSize(capacity) * sizeof(InstanceData), alignment);
+    m_renderer->createBuffer(
+        target.instanceStride * frameCount,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        target.instanceBuffer,
+        target.instanceBufferMemory,
+        MemoryUsage::Vertex,
+        QString("%1 visible instances").arg(name)
+    );
+
+    target.drawStride = alignUp(sizeof(CullDrawCommand), alignment);
+    m_renderer->createBuffer(
+        target.drawStride * frameCount,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+            | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+            | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        target.drawBuffer,
+        target.drawBufferMemory,
+        MemoryUsage::Indirect,
+        QString("%1 draw commands").arg(name)
+    );
+
+    VkDescriptorPoolSize poolSize = {};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.descriptorCount = 3 * frameCount;
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = frameCount;
+
+    VkDevice device = m_window->device();
+    VkResult result = m_deviceFunctions->vkCreateDescriptorPool(
+        device,
+        &poolInfo,
+        nullptr,
+        &target.descriptorPool
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create culling descriptor pool: %d", result);
+    }
+
+    QVector<VkDescriptorSetLayout> setLayouts(frameCount, m_descriptorSetLayout);
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = target.descriptorPool;
+    allocInfo.descriptorSetCount = static_cast<uint32_t>(frameCount);
+    allocInfo.pSetLayouts = setLayouts.constData();
+
+    target.descriptorSets.resize(frameCount);
+    result = m_deviceFunctions->vkAllocateDescriptorSets(
+        device,
+        &allocInfo,
+        target.descriptorSets.data()
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to allocate culling descriptor sets: %d", result);
+    }
+
+    target.sourceBuffers.fill(VK_NULL_HANDLE, frameCount);
+}
+
+void GpuCuller::destroy(CulledInstances &target) {
+    if (target.instanceBuffer)
+        m_deletionQueue->destroyBuffer(target.instanceBuffer, target.instanceBufferMemory);
+    if (target.drawBuffer)
+        m_deletionQueue->destroyBuffer(target.drawBuffer, target.drawBufferMemory);
+    if (target.descriptorPool)
+        m_deletionQueue->destroyDescriptorPool(target.descriptorPool);
+
+    target = CulledInstances();
+}
+
+void GpuCuller::updateDescriptorSet(CulledInstances &target, int frame, VkBuffer sourceBuffer) {
+    // The source moves when it is re-uploaded or defragmented; only this
+    // frame's set is idle, so each set catches up on its own turn.
+    if (target.sourceBuffers[frame] == sourceBuffer)
+        return;
+
+    std::array<VkDescriptorBufferInfo, 3> bufferInfos = {};
+    bufferInfos[0].buffer = sourceBuffer;
+    bufferInfos[0].offset = 0;
+    bufferInfos[0].range = VkDeviceSize(target.capacity) * sizeof(InstanceData);
+    bufferInfos[1].buffer = target.instanceBuffer;
+    bufferInfos[1].offset = target.instanceStride * frame;
+    bufferInfos[1].range = VkDeviceSize(target.capacity) * sizeof(InstanceData);
+    bufferInfos[2].buffer = target.drawBuffer;
+    bufferInfos[2].offset = target.drawStride * frame;
+    bufferInfos[2].range = sizeof(CullDrawCommand);
+
+    std::array<VkWriteDescriptorSet, 3> descriptorWrites = {};
+    for (uint32_t i = 0; i < descriptorWrites.size(); ++i) {
+        descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[i].dstSet = target.descriptorSets[frame];
+        descriptorWrites[i].dstBinding = i;
+        descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[i].descriptorCount = 1;
+        descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+    }
+
+    m_deviceFunctions->vkUpdateDescriptorSets(
+        m_window->device(),
+        static_cast<uint32_t>(descriptorWrites.size()),
+        descriptorWrites.data(),
+        0,
+        nullptr
+    );
+
+    target.sourceBuffers[frame] = sourceBuffer;
+}
+
+void GpuCuller::cull(VkCommandBuffer commandBuffer,
+                     CulledInstances &target,
+                     VkBuffer sourceBuffer,
+                     const CullParams &params) {
+    const int frame = m_window->currentFrame();
+    updateDescriptorSet(target, frame, sourceBuffer);
+
+    CullDrawCommand drawCommand = {};
+    drawCommand.command.vertexCount = target.vertexCount;
+    m_deviceFunctions->vkCmdUpdateBuffer(
+        commandBuffer,
+        target.drawBuffer,
+        target.drawStride * frame,
+        sizeof(drawCommand),
+        &drawCommand
+    );
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = target.drawBuffer;
+    barrier.offset = target.drawStride * frame;
+    barrier.size = sizeof(drawCommand);
+
+    m_deviceFunctions->vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0,
+        0,
+        nullptr,
+        1,
+        &barrier,
+        0,
+        nullptr
+    );
+
+    m_deviceFunctions->vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+    m_deviceFunctions->vkCmdBindDescriptorSets(
+        commandBuffer,
+        VK_PIPELINE_BIND_POINT_COMPUTE,
+        m_pipelineLayout,
+        0,
+        1,
+        &target.descriptorSets[frame],
+        0,
+        nullptr
+    );
+    m_deviceFunctions->vkCmdPushConstants(
+        commandBuffer,
+        m_pipelineLayout,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        0,
+        sizeof(params),
+        &params
+    );
+    m_deviceFunctions->vkCmdDispatch(
+        commandBuffer,
+        (params.instanceCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE,
+        1,
+        1
+    );
+}
+
+void GpuCuller::finish(VkCommandBuffer commandBuffer) {
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+
+    m_deviceFunctions->vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+        0,
+        1,
+        &barrier,
+        0,
+        nullptr,
+        0,
+        nullptr
+    );
+}
+
+VkDeviceSize GpuCuller::instanceOffset(const CulledInstances &target) const {
+    return target.instanceStride * m_window->currentFrame();
+}
+
+void GpuCuller::draw(VkCommandBuffer commandBuffer, const CulledInstances &target) const {
+    const VkDeviceSize drawOffset = target.drawStride * m_window->currentFrame();
+
+    if (m_drawIndirectCount) {
+        m_drawIndirectCount(
+            commandBuffer,
+            target.drawBuffer,
+            drawOffset,
+            target.drawBuffer,
+            drawOffset + offsetof(CullDrawCommand, drawCount),
+            1,
+            sizeof(VkDrawIndirectCommand)
+        );
+        return;
+    }
+
+    // Without a count buffer the command is always issued; a fully culled
+    // batch simply draws zero instances.
+    m_deviceFunctions->vkCmdDrawIndirect(
+        commandBuffer,
+        target.drawBuffer,
+        drawOffset,
+        1,
+        sizeof(VkDrawIndirectCommand)
+    );
+}
+
+void GpuCuller::frustumPlanes(const QMatrix4x4 &viewProjection, float planes[6][4]) {
+    const QVector4D x = viewProjection.row(0);
+    const QVector4D y = viewProjection.row(1);
+    const QVector4D z = viewProjection.row(2);
+    const QVector4D w = viewProjection.row(3);
+
+    // Vulkan clip space keeps depth in [0, w].
+    const QVector4D rows[6] = {w + x, w - x, w + y, w - y, z, w - z};
+    for (int i = 0; i < 6; ++i) {
+        const float length = rows[i].toVector3D().length();
+        const QVector4D plane = length > 0.0f ? rows[i] / length : rows[i];
+        planes[i][0] = plane.x();
+        planes[i][1] = plane.y();
+        planes[i][2] = plane.z();
+        planes[i][3] = plane.w();
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef GPUCULLER_H
+#define GPUCULLER_H
+
+#include <QMatrix4x4>
+#include <QVulkanDeviceFunctions>
+#include <QVector>
+
+#include "memoryallocator.h"
+
+class DeletionQueue;
+class Renderer;
+class VulkanWindow;
+
+struct CullParams {
+    float planes[6][4];
+    float bounds[4];
+    uint32_t instanceCount;
+};
+
+struct CullDrawCommand {
+    VkDrawIndirectCommand command;
+    uint32_t drawCount;
+};
+
+struct CulledInstances
+{
+    VkBuffer instanceBuffer = VK_NULL_HANDLE;
+    MemoryAllocation instanceBufferMemory;
+    VkDeviceSize instanceStride = 0;
+
+    VkBuffer drawBuffer = VK_NULL_HANDLE;
+    MemoryAllocation drawBufferMemory;
+    VkDeviceSize drawStride = 0;
+
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    QVector<VkDescriptorSet> descriptorSets;
+    QVector<VkBuffer> sourceBuffers;
+
+    int capacity = 0;
+    uint32_t vertexCount = 0;
+};
+
+class GpuCuller
+{
+public:
+    bool init(Renderer *renderer,
+              VulkanWindow *window,
+              QVulkanDeviceFunctions *deviceFunctions,
+              DeletionQueue *deletionQueue);
+    void release();
+
+    bool isCreated() const {
+        return m_pipeline != VK_NULL_HANDLE;
+    }
+
+    void create(CulledInstances &target, int capacity, uint32_t vertexCount, const QString &name);
+    void destroy(CulledInstances &target);
+
+    void cull(VkCommandBuffer commandBuffer,
+              CulledInstances &target,
+              VkBuffer sourceBuffer,
+              const CullParams &params);
+    void finish(VkCommandBuffer commandBuffer);
+
+    void draw(VkCommandBuffer commandBuffer, const CulledInstances &target) const;
+
+    VkDeviceSize instanceOffset(const CulledInstances &target) const;
+
+    static void frustumPlanes(const QMatrix4x4 &viewProjection, float planes[6][4]);
+
+private:
+    Renderer *m_renderer = nullptr;
+    VulkanWindow *m_window = nullptr;
+    QVulkanDeviceFunctions *m_deviceFunctions = nullptr;
+    DeletionQueue *m_deletionQueue = nullptr;
+
+    VkDescriptorSetLayout m_descriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline m_pipeline = VK_NULL_HANDLE;
+
+    PFN_vkCmdDrawIndirectCountKHR m_drawIndirectCount = nullptr;
+
+private:
+    bool graphicsQueueSupportsCompute() const;
+    void createPipeline();
+    void updateDescriptorSet(CulledInstances &target, int frame, VkBuffer sourceBuffer);
+};
+
+#endif // GPUCULLER_H
@@ -1,10 +1,81 @@
 #include "mainwindow.h"
 #include <QApplication>
+#include <QCommandLineParser>
 #include <QVulkanInstance>
 
+#include "features.h"
+#include "textureatlasbuilder.h"
+
 int main(int argc, char *argv[]){
     QApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(featureHelpText());
+    parser.addHelpOption();
+    QCommandLineOption packAtlasOption(
+        "pack-atlas",
+        "Pack the given images into a texture atlas in <directory> and exit.",
+        "directory"
+    );
+    QCommandLineOption atlasOption(
+        "atlas",
+        "Load a texture atlas packed with --pack-atlas from <directory>.",
+        "directory"
+    );
+    QCommandLineOption memoryReportOption(
+        "memory-report",
+        "Write a JSON GPU memory report to <file> on exit (F12 writes one on demand).",
+        "file"
+    );
+    QCommandLineOption depthBitsOption(
+        "depth-bits",
+        "Use a 16, 24 or 32-bit depth buffer instead of the window default.",
+        "bits"
+    );
+    QCommandLineOption continuousOption(
+        "continuous",
+        "Render every frame even when nothing changes, for benchmarking."
+    );
+    QCommandLineOption instanceStressOption(
+        "instance-stress",
+        "Draw each loaded model as a grid of <count> instances; combine with --continuous to log frame times.",
+        "count"
+    );
+    QCommandLineOption depthPrepassOption(
+        "depth-prepass",
+        "Lay down depth in a prepass so each pixel is shaded once (F10 toggles it)."
+    );
+    parser.addOption(packAtlasOption);
+    parser.addOption(atlasOption);
+    parser.addOption(memoryReportOption);
+    parser.addOption(depthBitsOption);
+    parser.addOption(continuousOption);
+    parser.addOption(instanceStressOption);
+    parser.addOption(depthPrepassOption);
+    parser.addPositionalArgument("images", "Images to pack with --pack-atlas.");
+    parser.process(a);
+
+    if (parser.isSet(packAtlasOption)) {
+        const bool result = TextureAtlasBuilder::build(
+            parser.positionalArguments(),
+            parser.value(packAtlasOption)
+        );
+        return result ? 0 : 1;
+    }
+
     MainWindow w;
+    if (parser.isSet(atlasOption))
+        w.setTextureAtlasDirectory(parser.value(atlasOption));
+    if (parser.isSet(memoryReportOption))
+        w.setMemoryReportPath(parser.value(memoryReportOption));
+    if (parser.isSet(depthBitsOption))
+        w.setDepthBits(parser.value(depthBitsOption).toInt());
+    if (parser.isSet(continuousOption))
+        w.setContinuousRendering(true);
+    if (parser.isSet(instanceStressOption))
+        w.setInstanceStressCount(parser.value(instanceStressOption).toInt());
+    if (parser.isSet(depthPrepassOption))
+        w.setDepthPrepass(true);
     w.show();
 
     return a.exec();
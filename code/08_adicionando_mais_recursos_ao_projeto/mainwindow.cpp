@@ -3,8 +3,36 @@
 
 #include "vulkanwindow.h"
 #include "model.h"
+#include "features.h"
 
+#include <QColor>
 #include <QFileDialog>
+#include <cmath>
+
+static QVector<MeshInstance> instanceGrid(int count) {
+    const int side = qMax(1, int(std::ceil(std::cbrt(double(count)))));
+    const float spacing = 1.0f / side;
+
+    QVector<MeshInstance> instances(count);
+    for (int i = 0; i < count; ++i) {
+        const int x = i % side;
+        const int y = (i / side) % side;
+        const int z = i / (side * side);
+
+        MeshInstance &instance = instances[i];
+        instance.transform.translate(
+            (x + 0.5f) * spacing - 0.5f,
+            (y + 0.5f) * spacing - 0.5f,
+            (z + 0.5f) * spacing - 0.5f
+        );
+        instance.transform.scale(spacing * 0.8f);
+
+        const QColor color = QColor::fromHsvF(double(i) / count, 0.6, 1.0);
+        instance.tint = QVector4D(color.redF(), color.greenF(), color.blueF(), 1.0f);
+    }
+
+    return instances;
+}
 
 MainWindow::MainWindow(QWidget *parent) :
     QWidget(parent),
@@ -49,7 +77,19 @@ void MainWindow::loadModel() {
         QSharedPointer<Model> model =
             QSharedPointer<Model>::create();
         model->readOBJFile(fileName);
-        m_vulkanWindow->renderer()->addObject(model);
+
+        Renderer *renderer = m_vulkanWindow->renderer();
+        if (m_instanceStressCount > 0) {
+            renderer->addInstances(model, instanceGrid(m_instanceStressCount));
+            qCDebug(lcStats, "Added %d instances of %s", m_instanceStressCount, model->name.toStdString().c_str());
+            return;
+        }
+
+        // Lay loaded models out side by side instead of stacking them at the
+        // origin.
+        QMatrix4x4 transform;
+        transform.translate(1.5f * renderer->objectCount(), 0.0f, 0.0f);
+        renderer->addObject(model, transform);
 
         ui->loadTextureButton->setEnabled(true);
     }
@@ -17,6 +17,30 @@ public:
     explicit MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+    void setTextureAtlasDirectory(const QString &directory) {
+        m_vulkanWindow->setTextureAtlasDirectory(directory);
+    }
+
+    void setMemoryReportPath(const QString &path) {
+        m_vulkanWindow->setMemoryReportPath(path);
+    }
+
+    void setDepthBits(int bits) {
+        m_vulkanWindow->setDepthBits(bits);
+    }
+
+    void setContinuousRendering(bool continuous) {
+        m_vulkanWindow->setContinuousRendering(continuous);
+    }
+
+    void setDepthPrepass(bool enabled) {
+        m_vulkanWindow->setDepthPrepass(enabled);
+    }
+
+    void setInstanceStressCount(int count) {
+        m_instanceStressCount = count;
+    }
+
 public slots:
     void loadModel();
     void loadTexture();
@@ -24,6 +48,7 @@ public slots:
 private:
     Ui::MainWindow *ui;
     VulkanWindow *m_vulkanWindow;
+    int m_instanceStressCount = 0;
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,500 @@
+#include "memoryallocator.h"
+
+#include <QJsonArray>
+#include <QVulkanFunctions>
+
+#include "features.h"
+#include "vulkanwindow.h"
+
+static const VkDeviceSize MIN_ALLOCATION_SIZE = 256;
+static const VkDeviceSize DEFAULT_BLOCK_SIZE = 64 * 1024 * 1024;
+static const VkDeviceSize MIN_BLOCK_SIZE = 4 * 1024 * 1024;
+
+static const VkMemoryPropertyFlags DIRECT_UPLOAD_PROPERTIES =
+    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+    | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+    | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+void MemoryAllocator::init(VulkanWindow *window, QVulkanDeviceFunctions *deviceFunctions) {
+    m_window = window;
+    m_deviceFunctions = deviceFunctions;
+
+    QVulkanFunctions *f = m_window->vulkanInstance()->functions();
+    f->vkGetPhysicalDeviceMemoryProperties(m_window->physicalDevice(), &m_memoryProperties);
+
+    m_bufferImageGranularity =
+        m_window->physicalDeviceProperties()->limits.bufferImageGranularity;
+
+    m_tracker.init(m_memoryProperties.memoryHeapCount);
+
+    m_directUpload = isFeatureEnabled(Feature::DirectUpload)
+        && detectDirectUpload();
+}
+
+bool MemoryAllocator::detectDirectUpload() const {
+    const int typeIndex = memoryTypeIndex(~0u, DIRECT_UPLOAD_PROPERTIES);
+    if (typeIndex < 0)
+        return false;
+
+    const VkPhysicalDeviceType deviceType = m_window->physicalDeviceProperties()->deviceType;
+    if (deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU
+        || deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU)
+        return true;
+
+    VkDeviceSize largestDeviceLocalHeap = 0;
+    for (uint32_t i = 0; i < m_memoryProperties.memoryHeapCount; ++i) {
+        const VkMemoryHeap &heap = m_memoryProperties.memoryHeaps[i];
+        if (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+            largestDeviceLocalHeap = qMax(largestDeviceLocalHeap, heap.size);
+    }
+
+    const uint32_t heapIndex = m_memoryProperties.memoryTypes[typeIndex].heapIndex;
+    return m_memoryProperties.memoryHeaps[heapIndex].size >= largestDeviceLocalHeap;
+}
+
+int MemoryAllocator::memoryTypeIndex(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+    for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; i++) {
+        if ((typeFilter & (1 << i)) &&
+            (m_memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return int(i);
+        }
+    }
+
+    return -1;
+}
+
+uint32_t MemoryAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+    int typeIndex = memoryTypeIndex(typeFilter, properties);
+
+    if (typeIndex < 0 && (properties & DIRECT_UPLOAD_PROPERTIES) == DIRECT_UPLOAD_PROPERTIES)
+        typeIndex = memoryTypeIndex(typeFilter, properties & ~VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    if (typeIndex < 0 && (properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT))
+        typeIndex = memoryTypeIndex(typeFilter, properties & ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+
+    if (typeIndex < 0)
+        qFatal("Failed to find suitable memory type!");
+
+    return uint32_t(typeIndex);
+}
+
+VkMemoryPropertyFlags MemoryAllocator::directUploadProperties() {
+    return DIRECT_UPLOAD_PROPERTIES;
+}
+
+int MemoryAllocator::poolIndex(uint32_t memoryTypeIndex, bool linear) {
+    if (m_bufferImageGranularity <= MIN_ALLOCATION_SIZE)
+        linear = true;
+
+    for (int i = 0; i < m_pools.size(); ++i) {
+        if (m_pools[i].memoryTypeIndex == memoryTypeIndex && m_pools[i].linear == linear)
+            return i;
+    }
+
+    const uint32_t heapIndex = m_memoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+    const VkDeviceSize heapSize = m_memoryProperties.memoryHeaps[heapIndex].size;
+
+    Pool pool;
+    pool.memoryTypeIndex = memoryTypeIndex;
+    pool.linear = linear;
+    pool.blockSize = DEFAULT_BLOCK_SIZE;
+    while (pool.blockSize > MIN_BLOCK_SIZE && pool.blockSize > heapSize / 8)
+        pool.blockSize /= 2;
+
+    pool.orderCount = 1;
+    while ((MIN_ALLOCATION_SIZE << (pool.orderCount - 1)) < pool.blockSize)
+        ++pool.orderCount;
+
+    m_pools.append(pool);
+    return m_pools.size() - 1;
+}
+
+VkDeviceMemory MemoryAllocator::allocateDeviceMemory(VkDeviceSize size,
+                                                     uint32_t memoryTypeIndex,
+                                                     quint8 **mapped) {
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+    VkDeviceMemory memory;
+    VkDevice device = m_window->device();
+    VkResult result = m_deviceFunctions->vkAllocateMemory(device, &allocInfo, nullptr, &memory);
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to allocate device memory: %d", result);
+    }
+
+    *mapped = nullptr;
+    if (m_memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        result = m_deviceFunctions->vkMapMemory(
+            device,
+            memory,
+            0,
+            VK_WHOLE_SIZE,
+            0,
+            reinterpret_cast<void **>(mapped)
+        );
+        if (result != VK_SUCCESS) {
+            qFatal("Failed to map device memory: %d", result);
+        }
+    }
+
+    return memory;
+}
+
+bool MemoryAllocator::allocateFromBlock(Pool &pool, Block &block, int order, VkDeviceSize &offset) {
+    int available = order;
+    while (available < pool.orderCount && block.freeOffsets[available].isEmpty())
+        ++available;
+
+    if (available == pool.orderCount)
+        return false;
+
+    QSet<VkDeviceSize>::iterator it = block.freeOffsets[available].begin();
+    offset = *it;
+    block.freeOffsets[available].erase(it);
+
+    while (available > order) {
+        --available;
+        block.freeOffsets[available].insert(offset + (MIN_ALLOCATION_SIZE << available));
+    }
+
+    block.usedBytes += MIN_ALLOCATION_SIZE << order;
+    ++block.allocationCount;
+    ++pool.generation;
+
+    return true;
+}
+
+void MemoryAllocator::freeToBlock(Pool &pool, Block &block, int order, VkDeviceSize offset) {
+    block.usedBytes -= MIN_ALLOCATION_SIZE << order;
+    --block.allocationCount;
+    ++pool.generation;
+
+    while (order < pool.orderCount - 1) {
+        const VkDeviceSize buddy = offset ^ (MIN_ALLOCATION_SIZE << order);
+        if (!block.freeOffsets[order].remove(buddy))
+            break;
+
+        offset = qMin(offset, buddy);
+        ++order;
+    }
+
+    block.freeOffsets[order].insert(offset);
+}
+
+MemoryAllocation MemoryAllocator::allocate(const VkMemoryRequirements &requirements,
+                                           VkMemoryPropertyFlags properties,
+                                           bool linear,
+                                           MemoryUsage usage,
+                                           const QString &name) {
+    MemoryAllocation allocation;
+    allocation.memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+    allocation.size = requirements.size;
+
+    const uint32_t heapIndex = m_memoryProperties.memoryTypes[allocation.memoryTypeIndex].heapIndex;
+
+    const int index = poolIndex(allocation.memoryTypeIndex, linear);
+    Pool &pool = m_pools[index];
+
+    const bool lazilyAllocated = m_memoryProperties.memoryTypes[allocation.memoryTypeIndex].propertyFlags
+        & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+
+    if (requirements.size > pool.blockSize / 2 || lazilyAllocated) {
+        allocation.memory = allocateDeviceMemory(
+            requirements.size,
+            allocation.memoryTypeIndex,
+            &allocation.mapped
+        );
+        ++m_dedicatedAllocationCount;
+        m_dedicatedBytes += requirements.size;
+        allocation.trackingId = m_tracker.add(usage, name, requirements.size, heapIndex, true);
+        return allocation;
+    }
+
+    suballocate(index, requirements, pool.blocks.size(), true, allocation);
+    allocation.trackingId = m_tracker.add(usage, name, requirements.size, heapIndex, false);
+
+    return allocation;
+}
+
+bool MemoryAllocator::suballocate(int poolIndex,
+                                  const VkMemoryRequirements &requirements,
+                                  int blockLimit,
+                                  bool grow,
+                                  MemoryAllocation &allocation) {
+    Pool &pool = m_pools[poolIndex];
+
+    const VkDeviceSize chunkSize = qMax(requirements.size, requirements.alignment);
+    int order = 0;
+    while ((MIN_ALLOCATION_SIZE << order) < chunkSize)
+        ++order;
+
+    int blockIndex = -1;
+    VkDeviceSize offset = 0;
+    for (int i = 0; i < blockLimit; ++i) {
+        if (pool.blocks[i].memory && allocateFromBlock(pool, pool.blocks[i], order, offset)) {
+            blockIndex = i;
+            break;
+        }
+    }
+
+    if (blockIndex < 0) {
+        if (!grow)
+            return false;
+
+        Block block;
+        block.memory = allocateDeviceMemory(pool.blockSize, pool.memoryTypeIndex, &block.mapped);
+        block.freeOffsets.resize(pool.orderCount);
+        block.freeOffsets[pool.orderCount - 1].insert(0);
+
+        for (int i = 0; i < pool.blocks.size(); ++i) {
+            if (!pool.blocks[i].memory) {
+                blockIndex = i;
+                break;
+            }
+        }
+
+        if (blockIndex < 0) {
+            pool.blocks.append(block);
+            blockIndex = pool.blocks.size() - 1;
+        } else {
+            pool.blocks[blockIndex] = block;
+        }
+
+        allocateFromBlock(pool, pool.blocks[blockIndex], order, offset);
+    }
+
+    const Block &block = pool.blocks[blockIndex];
+    allocation.memory = block.memory;
+    allocation.offset = offset;
+    allocation.mapped = block.mapped ? block.mapped + offset : nullptr;
+    allocation.pool = poolIndex;
+    allocation.block = blockIndex;
+    allocation.order = order;
+
+    return true;
+}
+
+MemoryAllocation MemoryAllocator::allocateCompacted(const MemoryAllocation &current,
+                                                    const VkMemoryRequirements &requirements,
+                                                    MemoryUsage usage,
+                                                    const QString &name) {
+    MemoryAllocation allocation;
+    if (current.isDedicated() || current.block == 0)
+        return allocation;
+
+    allocation.memoryTypeIndex = current.memoryTypeIndex;
+    allocation.size = requirements.size;
+
+    if (!(requirements.memoryTypeBits & (1 << current.memoryTypeIndex))
+        || !suballocate(current.pool, requirements, current.block, false, allocation)) {
+        return MemoryAllocation();
+    }
+
+    const uint32_t heapIndex = m_memoryProperties.memoryTypes[allocation.memoryTypeIndex].heapIndex;
+    allocation.trackingId = m_tracker.add(usage, name, requirements.size, heapIndex, false);
+
+    return allocation;
+}
+
+bool MemoryAllocator::isFragmented(int index) const {
+    const Pool &pool = m_pools[index];
+
+    int liveBlocks = 0;
+    VkDeviceSize usedBytes = 0;
+    for (const Block &block : pool.blocks) {
+        if (block.memory) {
+            ++liveBlocks;
+            usedBytes += block.usedBytes;
+        }
+    }
+
+    return liveBlocks > 1 && usedBytes <= VkDeviceSize(liveBlocks - 1) * pool.blockSize;
+}
+
+MemoryAllocation MemoryAllocator::allocateForBuffer(VkBuffer buffer,
+                                                    VkMemoryPropertyFlags properties,
+                                                    MemoryUsage usage,
+                                                    const QString &name) {
+    VkDevice device = m_window->device();
+
+    VkMemoryRequirements memRequirements;
+    m_deviceFunctions->vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+    MemoryAllocation allocation = allocate(memRequirements, properties, true, usage, name);
+    m_deviceFunctions->vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+
+    return allocation;
+}
+
+MemoryAllocation MemoryAllocator::allocateForImage(VkImage image,
+                                                   VkMemoryPropertyFlags properties,
+                                                   MemoryUsage usage,
+                                                   const QString &name) {
+    VkDevice device = m_window->device();
+
+    VkMemoryRequirements memRequirements;
+    m_deviceFunctions->vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+    MemoryAllocation allocation = allocate(memRequirements, properties, false, usage, name);
+    m_deviceFunctions->vkBindImageMemory(device, image, allocation.memory, allocation.offset);
+
+    return allocation;
+}
+
+void MemoryAllocator::free(MemoryAllocation &allocation) {
+    if (allocation.isNull())
+        return;
+
+    VkDevice device = m_window->device();
+
+    m_tracker.remove(allocation.trackingId);
+
+    if (allocation.isDedicated()) {
+        m_deviceFunctions->vkFreeMemory(device, allocation.memory, nullptr);
+        --m_dedicatedAllocationCount;
+        m_dedicatedBytes -= allocation.size;
+    } else {
+        Pool &pool = m_pools[allocation.pool];
+        Block &block = pool.blocks[allocation.block];
+        freeToBlock(pool, block, allocation.order, allocation.offset);
+
+        if (block.allocationCount == 0 && allocation.block > 0) {
+            m_deviceFunctions->vkFreeMemory(device, block.memory, nullptr);
+            block = Block();
+
+            while (pool.blocks.size() > 1 && !pool.blocks.last().memory)
+                pool.blocks.removeLast();
+        }
+    }
+
+    allocation = MemoryAllocation();
+}
+
+MemoryAllocatorStats MemoryAllocator::stats() const {
+    MemoryAllocatorStats stats;
+    stats.dedicatedAllocationCount = m_dedicatedAllocationCount;
+    stats.dedicatedBytes = m_dedicatedBytes;
+
+    for (const Pool &pool : m_pools) {
+        for (const Block &block : pool.blocks) {
+            if (!block.memory)
+                continue;
+
+            ++stats.blockCount;
+            stats.allocationCount += block.allocationCount;
+            stats.blockBytes += pool.blockSize;
+            stats.usedBytes += block.usedBytes;
+            stats.freeBytes += pool.blockSize - block.usedBytes;
+
+            for (int order = pool.orderCount - 1; order >= 0; --order) {
+                if (!block.freeOffsets[order].isEmpty()) {
+                    stats.largestFreeRange = qMax(stats.largestFreeRange, MIN_ALLOCATION_SIZE << order);
+                    break;
+                }
+            }
+        }
+    }
+
+    return stats;
+}
+
+void MemoryAllocator::release() {
+    VkDevice device = m_window->device();
+
+    for (const Pool &pool : m_pools) {
+        for (const Block &block : pool.blocks) {
+            if (!block.memory)
+                continue;
+            if (block.allocationCount)
+                qWarning("Releasing memory block with %d live allocations", block.allocationCount);
+            m_deviceFunctions->vkFreeMemory(device, block.memory, nullptr);
+        }
+    }
+    m_pools.clear();
+    m_tracker.clear();
+
+    if (m_dedicatedAllocationCount)
+        qWarning("%d dedicated allocations were not freed", m_dedicatedAllocationCount);
+    m_dedicatedAllocationCount = 0;
+    m_dedicatedBytes = 0;
+}
+
+bool MemoryAllocator::queryBudget(QVector<VkDeviceSize> &heapUsage,
+                                  QVector<VkDeviceSize> &heapBudget) const {
+    if (!m_window->memoryBudgetEnabled())
+        return false;
+
+    QVulkanInstance *instance = m_window->vulkanInstance();
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2 =
+        reinterpret_cast<PFN_vkGetPhysicalDeviceMemoryProperties2KHR>(
+            instance->getInstanceProcAddr("vkGetPhysicalDeviceMemoryProperties2")
+        );
+    if (!getMemoryProperties2) {
+        getMemoryProperties2 = reinterpret_cast<PFN_vkGetPhysicalDeviceMemoryProperties2KHR>(
+            instance->getInstanceProcAddr("vkGetPhysicalDeviceMemoryProperties2KHR")
+        );
+    }
+    if (!getMemoryProperties2)
+        return false;
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+    budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+    VkPhysicalDeviceMemoryProperties2KHR memoryProperties = {};
+    memoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+    memoryProperties.pNext = &budgetProperties;
+
+    getMemoryProperties2(m_window->physicalDevice(), &memoryProperties);
+
+    const int heapCount = int(m_memoryProperties.memoryHeapCount);
+    heapUsage.resize(heapCount);
+    heapBudget.resize(heapCount);
+    for (int i = 0; i < heapCount; ++i) {
+        heapUsage[i] = budgetProperties.heapUsage[i];
+        heapBudget[i] = budgetProperties.heapBudget[i];
+    }
+
+    return true;
+}
+
+QJsonObject MemoryAllocator::report() const {
+    QVector<VkDeviceSize> heapUsage;
+    QVector<VkDeviceSize> heapBudget;
+    const bool hasBudget = queryBudget(heapUsage, heapBudget);
+
+    QJsonArray heaps;
+    for (uint32_t i = 0; i < m_memoryProperties.memoryHeapCount; ++i) {
+        const VkMemoryHeap &memoryHeap = m_memoryProperties.memoryHeaps[i];
+
+        QJsonObject heap;
+        heap["index"] = int(i);
+        heap["size"] = double(memoryHeap.size);
+        heap["deviceLocal"] = bool(memoryHeap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT);
+        heap["trackedBytes"] = double(m_tracker.heapBytes(i));
+        heap["peakBytes"] = double(m_tracker.heapPeakBytes(i));
+        if (hasBudget) {
+            heap["budget"] = double(heapBudget[i]);
+            heap["usage"] = double(heapUsage[i]);
+        }
+        heaps.append(heap);
+    }
+
+    const MemoryAllocatorStats allocatorStats = stats();
+    QJsonObject blocks;
+    blocks["blockCount"] = allocatorStats.blockCount;
+    blocks["blockBytes"] = double(allocatorStats.blockBytes);
+    blocks["usedBytes"] = double(allocatorStats.usedBytes);
+    blocks["freeBytes"] = double(allocatorStats.freeBytes);
+    blocks["largestFreeRange"] = double(allocatorStats.largestFreeRange);
+    blocks["fragmentation"] = double(allocatorStats.fragmentation());
+    blocks["dedicatedAllocationCount"] = allocatorStats.dedicatedAllocationCount;
+    blocks["dedicatedBytes"] = double(allocatorStats.dedicatedBytes);
+
+    QJsonObject json = m_tracker.toJson();
+    json["heaps"] = heaps;
+    json["blocks"] = blocks;
+
+    return json;
+}
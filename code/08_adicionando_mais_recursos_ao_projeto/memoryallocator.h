@@ -0,0 +1,152 @@
+#ifndef MEMORYALLOCATOR_H
+#define MEMORYALLOCATOR_H
+
+#include <QVulkanDeviceFunctions>
+#include <QJsonObject>
+#include <QSet>
+#include <QVector>
+
+#include "memorytracker.h"
+
+class VulkanWindow;
+
+struct MemoryAllocation
+{
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    quint8 *mapped = nullptr;
+    uint32_t memoryTypeIndex = 0;
+    int pool = -1;
+    int block = -1;
+    int order = 0;
+    quint32 trackingId = 0;
+
+    bool isNull() const {
+        return memory == VK_NULL_HANDLE;
+    }
+
+    bool isDedicated() const {
+        return pool < 0;
+    }
+};
+
+struct MemoryAllocatorStats
+{
+    int blockCount = 0;
+    int allocationCount = 0;
+    int dedicatedAllocationCount = 0;
+    VkDeviceSize blockBytes = 0;
+    VkDeviceSize usedBytes = 0;
+    VkDeviceSize freeBytes = 0;
+    VkDeviceSize largestFreeRange = 0;
+    VkDeviceSize dedicatedBytes = 0;
+
+    float fragmentation() const {
+        return freeBytes ? 1.0f - float(largestFreeRange) / float(freeBytes) : 0.0f;
+    }
+};
+
+class MemoryAllocator
+{
+public:
+    void init(VulkanWindow *window, QVulkanDeviceFunctions *deviceFunctions);
+    void release();
+
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+
+    VkMemoryPropertyFlags memoryTypeProperties(uint32_t memoryTypeIndex) const {
+        return m_memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+    }
+
+    bool hasDirectUpload() const {
+        return m_directUpload;
+    }
+
+    static VkMemoryPropertyFlags directUploadProperties();
+
+    MemoryAllocation allocate(const VkMemoryRequirements &requirements,
+                              VkMemoryPropertyFlags properties,
+                              bool linear,
+                              MemoryUsage usage,
+                              const QString &name);
+    MemoryAllocation allocateForBuffer(VkBuffer buffer,
+                                       VkMemoryPropertyFlags properties,
+                                       MemoryUsage usage,
+                                       const QString &name);
+    MemoryAllocation allocateForImage(VkImage image,
+                                      VkMemoryPropertyFlags properties,
+                                      MemoryUsage usage,
+                                      const QString &name);
+    MemoryAllocation allocateCompacted(const MemoryAllocation &current,
+                                       const VkMemoryRequirements &requirements,
+                                       MemoryUsage usage,
+                                       const QString &name);
+    void free(MemoryAllocation &allocation);
+
+    int poolCount() const {
+        return m_pools.size();
+    }
+
+    bool isFragmented(int pool) const;
+
+    // Bumped whenever one of the pool's free lists changes, so callers can
+    // skip retrying a placement that already failed.
+    quint64 generation(int pool) const {
+        return m_pools[pool].generation;
+    }
+
+    MemoryAllocatorStats stats() const;
+
+    const MemoryTracker &tracker() const {
+        return m_tracker;
+    }
+
+    QJsonObject report() const;
+
+private:
+    struct Block {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        quint8 *mapped = nullptr;
+        QVector<QSet<VkDeviceSize>> freeOffsets;
+        VkDeviceSize usedBytes = 0;
+        int allocationCount = 0;
+    };
+
+    struct Pool {
+        uint32_t memoryTypeIndex = 0;
+        bool linear = true;
+        VkDeviceSize blockSize = 0;
+        int orderCount = 0;
+        QVector<Block> blocks;
+        quint64 generation = 0;
+    };
+
+    VulkanWindow *m_window = nullptr;
+    QVulkanDeviceFunctions *m_deviceFunctions = nullptr;
+
+    VkPhysicalDeviceMemoryProperties m_memoryProperties = {};
+    VkDeviceSize m_bufferImageGranularity = 1;
+    bool m_directUpload = false;
+
+    QVector<Pool> m_pools;
+    MemoryTracker m_tracker;
+    int m_dedicatedAllocationCount = 0;
+    VkDeviceSize m_dedicatedBytes = 0;
+
+private:
+    bool detectDirectUpload() const;
+    int memoryTypeIndex(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+    int poolIndex(uint32_t memoryTypeIndex, bool linear);
+    VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex, quint8 **mapped);
+    bool suballocate(int poolIndex,
+                     const VkMemoryRequirements &requirements,
+                     int blockLimit,
+                     bool grow,
+                     MemoryAllocation &allocation);
+    bool allocateFromBlock(Pool &pool, Block &block, int order, VkDeviceSize &offset);
+    void freeToBlock(Pool &pool, Block &block, int order, VkDeviceSize offset);
+    bool queryBudget(QVector<VkDeviceSize> &heapUsage, QVector<VkDeviceSize> &heapBudget) const;
+};
+
+#endif // MEMORYALLOCATOR_H
@@ -0,0 +1,326 @@
+#include "memorydefragmenter.h"
+
+#include <algorithm>
+
+#include "deletionqueue.h"
+#include "vulkanwindow.h"
+
+void MemoryDefragmenter::init(VulkanWindow *window,
+                              QVulkanDeviceFunctions *deviceFunctions,
+                              MemoryAllocator *memoryAllocator,
+                              DeletionQueue *deletionQueue) {
+    m_window = window;
+    m_deviceFunctions = deviceFunctions;
+    m_memoryAllocator = memoryAllocator;
+    m_deletionQueue = deletionQueue;
+}
+
+void MemoryDefragmenter::release() {
+    m_resources.clear();
+    m_blockedPools.clear();
+}
+
+void MemoryDefragmenter::addBuffer(VkBuffer *buffer,
+                                   MemoryAllocation *memory,
+                                   VkDeviceSize size,
+                                   VkBufferUsageFlags usage,
+                                   VkAccessFlags dstAccessMask,
+                                   VkPipelineStageFlags dstStageMask,
+                                   MemoryUsage memoryUsage,
+                                   const QString &name) {
+    Resource resource;
+    resource.buffer = buffer;
+    resource.memory = memory;
+    resource.size = size;
+    resource.bufferUsage = usage;
+    resource.dstAccessMask = dstAccessMask;
+    resource.dstStageMask = dstStageMask;
+    resource.memoryUsage = memoryUsage;
+    resource.name = name;
+    m_resources.append(resource);
+}
+
+void MemoryDefragmenter::addImage(VkImage *image,
+                                  VkImageView *view,
+                                  MemoryAllocation *memory,
+                                  const VkImageCreateInfo &imageInfo,
+                                  const VkImageViewCreateInfo &viewInfo,
+                                  MemoryUsage memoryUsage,
+                                  const QString &name,
+                                  const std::function<void()> &moved) {
+    Resource resource;
+    resource.image = image;
+    resource.view = view;
+    resource.memory = memory;
+    resource.size = memory->size;
+    resource.imageInfo = imageInfo;
+    resource.imageInfo.pNext = nullptr;
+    resource.imageInfo.pQueueFamilyIndices = nullptr;
+    resource.viewInfo = viewInfo;
+    resource.viewInfo.pNext = nullptr;
+    resource.memoryUsage = memoryUsage;
+    resource.name = name;
+    resource.moved = moved;
+    m_resources.append(resource);
+}
+
+void MemoryDefragmenter::remove(MemoryAllocation *memory) {
+    for (int i = 0; i < m_resources.size(); ++i) {
+        if (m_resources[i].memory == memory) {
+            m_resources.remove(i);
+            return;
+        }
+    }
+}
+
+int MemoryDefragmenter::fragmentedPool() const {
+    for (int pool = 0; pool < m_memoryAllocator->poolCount(); ++pool) {
+        if (!m_memoryAllocator->isFragmented(pool))
+            continue;
+
+        // Nothing in the pool has been allocated or freed since no move
+        // succeeded, so the moves would fail again.
+        QHash<int, quint64>::const_iterator blocked = m_blockedPools.constFind(pool);
+        if (blocked != m_blockedPools.constEnd() && blocked.value() == m_memoryAllocator->generation(pool))
+            continue;
+
+        return pool;
+    }
+
+    return -1;
+}
+
+// Compacts one pool per call; block indices are only ordered within a pool.
+bool MemoryDefragmenter::update(VkCommandBuffer commandBuffer) {
+    if (m_bytesPerFrame == 0)
+        return false;
+
+    const int pool = fragmentedPool();
+    if (pool < 0)
+        return false;
+
+    QVector<Resource *> candidates;
+    for (Resource &resource : m_resources) {
+        if (resource.memory->pool == pool && resource.memory->block > 0)
+            candidates.append(&resource);
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Resource *a, const Resource *b) {
+        return a->memory->block > b->memory->block;
+    });
+
+    VkDeviceSize movedBytes = 0;
+    for (Resource *resource : candidates) {
+        if (movedBytes + resource->size > m_bytesPerFrame && movedBytes > 0)
+            break;
+
+        const bool moved = resource->buffer
+            ? moveBuffer(commandBuffer, *resource)
+            : moveImage(commandBuffer, *resource);
+        if (moved)
+            movedBytes += resource->size;
+    }
+
+    if (movedBytes == 0) {
+        m_blockedPools.insert(pool, m_memoryAllocator->generation(pool));
+        return false;
+    }
+
+    m_blockedPools.remove(pool);
+    return true;
+}
+
+bool MemoryDefragmenter::moveBuffer(VkCommandBuffer commandBuffer, Resource &resource) {
+    VkDevice device = m_window->device();
+
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = resource.size;
+    bufferInfo.usage = resource.bufferUsage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VkBuffer buffer;
+    VkResult result = m_deviceFunctions->vkCreateBuffer(device, &bufferInfo, nullptr, &buffer);
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create defragmentation buffer: %d", result);
+    }
+
+    VkMemoryRequirements memRequirements;
+    m_deviceFunctions->vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+    MemoryAllocation memory = m_memoryAllocator->allocateCompacted(
+        *resource.memory,
+        memRequirements,
+        resource.memoryUsage,
+        resource.name
+    );
+    if (memory.isNull()) {
+        m_deviceFunctions->vkDestroyBuffer(device, buffer, nullptr);
+        return false;
+    }
+
+    m_deviceFunctions->vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
+
+    VkBufferCopy copyRegion = {};
+    copyRegion.size = resource.size;
+    m_deviceFunctions->vkCmdCopyBuffer(commandBuffer, *resource.buffer, buffer, 1, &copyRegion);
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = resource.dstAccessMask;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+
+    m_deviceFunctions->vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        resource.dstStageMask,
+        0,
+        0,
+        nullptr,
+        1,
+        &barrier,
+        0,
+        nullptr
+    );
+
+    m_deletionQueue->destroyBuffer(*resource.buffer, *resource.memory);
+    *resource.buffer = buffer;
+    *resource.memory = memory;
+
+    if (resource.moved)
+        resource.moved();
+
+    return true;
+}
+
+bool MemoryDefragmenter::moveImage(VkCommandBuffer commandBuffer, Resource &resource) {
+    VkDevice device = m_window->device();
+
+    VkImage image;
+    VkResult result = m_deviceFunctions->vkCreateImage(device, &resource.imageInfo, nullptr, &image);
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create defragmentation image: %d", result);
+    }
+
+    VkMemoryRequirements memRequirements;
+    m_deviceFunctions->vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+    MemoryAllocation memory = m_memoryAllocator->allocateCompacted(
+        *resource.memory,
+        memRequirements,
+        resource.memoryUsage,
+        resource.name
+    );
+    if (memory.isNull()) {
+        m_deviceFunctions->vkDestroyImage(device, image, nullptr);
+        return false;
+    }
+
+    m_deviceFunctions->vkBindImageMemory(device, image, memory.memory, memory.offset);
+
+    const VkImageSubresourceRange range = resource.viewInfo.subresourceRange;
+    const uint32_t levelCount = resource.imageInfo.mipLevels;
+    const uint32_t layerCount = resource.imageInfo.arrayLayers;
+
+    VkImageMemoryBarrier barriers[2] = {};
+    barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[0].image = *resource.image;
+    barriers[0].subresourceRange.aspectMask = range.aspectMask;
+    barriers[0].subresourceRange.baseMipLevel = 0;
+    barriers[0].subresourceRange.levelCount = levelCount;
+    barriers[0].subresourceRange.baseArrayLayer = 0;
+    barriers[0].subresourceRange.layerCount = layerCount;
+
+    barriers[1] = barriers[0];
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].srcAccessMask = 0;
+    barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barriers[1].image = image;
+
+    m_deviceFunctions->vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        0,
+        nullptr,
+        0,
+        nullptr,
+        2,
+        barriers
+    );
+
+    QVector<VkImageCopy> regions;
+    for (uint32_t level = 0; level < levelCount; ++level) {
+        VkImageCopy region = {};
+        region.srcSubresource.aspectMask = range.aspectMask;
+        region.srcSubresource.mipLevel = level;
+        region.srcSubresource.baseArrayLayer = 0;
+        region.srcSubresource.layerCount = layerCount;
+        region.dstSubresource = region.srcSubresource;
+        region.extent.width = qMax(1u, resource.imageInfo.extent.width >> level);
+        region.extent.height = qMax(1u, resource.imageInfo.extent.height >> level);
+        region.extent.depth = 1;
+        regions.append(region);
+    }
+
+    m_deviceFunctions->vkCmdCopyImage(
+        commandBuffer,
+        *resource.image,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        uint32_t(regions.size()),
+        regions.constData()
+    );
+
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    m_deviceFunctions->vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        0,
+        0,
+        nullptr,
+        0,
+        nullptr,
+        1,
+        &barriers[1]
+    );
+
+    VkImageViewCreateInfo viewInfo = resource.viewInfo;
+    viewInfo.image = image;
+
+    VkImageView view;
+    result = m_deviceFunctions->vkCreateImageView(device, &viewInfo, nullptr, &view);
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create defragmentation image view: %d", result);
+    }
+
+    m_deletionQueue->destroyImage(*resource.image, *resource.view, *resource.memory);
+    *resource.image = image;
+    *resource.view = view;
+    *resource.memory = memory;
+    resource.viewInfo.image = image;
+
+    if (resource.moved)
+        resource.moved();
+
+    return true;
+}
@@ -0,0 +1,86 @@
+#ifndef MEMORYDEFRAGMENTER_H
+#define MEMORYDEFRAGMENTER_H
+
+#include <QVulkanDeviceFunctions>
+#include <QHash>
+#include <QVector>
+#include <functional>
+
+#include "memoryallocator.h"
+
+class VulkanWindow;
+class DeletionQueue;
+
+class MemoryDefragmenter
+{
+public:
+    void init(VulkanWindow *window,
+              QVulkanDeviceFunctions *deviceFunctions,
+              MemoryAllocator *memoryAllocator,
+              DeletionQueue *deletionQueue);
+    void release();
+
+    void addBuffer(VkBuffer *buffer,
+                   MemoryAllocation *memory,
+                   VkDeviceSize size,
+                   VkBufferUsageFlags usage,
+                   VkAccessFlags dstAccessMask,
+                   VkPipelineStageFlags dstStageMask,
+                   MemoryUsage memoryUsage,
+                   const QString &name);
+    void addImage(VkImage *image,
+                  VkImageView *view,
+                  MemoryAllocation *memory,
+                  const VkImageCreateInfo &imageInfo,
+                  const VkImageViewCreateInfo &viewInfo,
+                  MemoryUsage memoryUsage,
+                  const QString &name,
+                  const std::function<void()> &moved);
+    void remove(MemoryAllocation *memory);
+
+    bool update(VkCommandBuffer commandBuffer);
+
+    void setBytesPerFrame(VkDeviceSize bytes) {
+        m_bytesPerFrame = bytes;
+    }
+
+    VkDeviceSize bytesPerFrame() const {
+        return m_bytesPerFrame;
+    }
+
+private:
+    struct Resource {
+        VkBuffer *buffer = nullptr;
+        VkImage *image = nullptr;
+        VkImageView *view = nullptr;
+        MemoryAllocation *memory = nullptr;
+        VkDeviceSize size = 0;
+        VkBufferUsageFlags bufferUsage = 0;
+        VkAccessFlags dstAccessMask = 0;
+        VkPipelineStageFlags dstStageMask = 0;
+        VkImageCreateInfo imageInfo = {};
+        VkImageViewCreateInfo viewInfo = {};
+        MemoryUsage memoryUsage = MemoryUsage::Vertex;
+        QString name;
+        std::function<void()> moved;
+    };
+
+    VulkanWindow *m_window = nullptr;
+    QVulkanDeviceFunctions *m_deviceFunctions = nullptr;
+    MemoryAllocator *m_memoryAllocator = nullptr;
+    DeletionQueue *m_deletionQueue = nullptr;
+
+    VkDeviceSize m_bytesPerFrame = 4 * 1024 * 1024;
+    QVector<Resource> m_resources;
+
+    // Pools where no resource could be moved, keyed to the pool generation
+    // at the time; they are skipped until that pool changes.
+    QHash<int, quint64> m_blockedPools;
+
+private:
+    int fragmentedPool() const;
+    bool moveBuffer(VkCommandBuffer commandBuffer, Resource &resource);
+    bool moveImage(VkCommandBuffer commandBuffer, Resource &resource);
+};
+
+#endif // MEMORYDEFRAGMENTER_H
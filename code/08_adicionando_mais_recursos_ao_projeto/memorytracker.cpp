@@ -0,0 +1,120 @@
+#include "memorytracker.h"
+
+#include <QJsonArray>
+
+void MemoryTracker::init(uint32_t heapCount) {
+    const int usageCount = int(MemoryUsage::Count);
+
+    m_heapBytes.fill(0, int(heapCount));
+    m_heapPeakBytes.fill(0, int(heapCount));
+    m_usageBytes.fill(0, usageCount);
+    m_usagePeakBytes.fill(0, usageCount);
+    m_usageCounts.fill(0, usageCount);
+}
+
+void MemoryTracker::clear() {
+    m_records.clear();
+    m_heapBytes.fill(0);
+    m_usageBytes.fill(0);
+    m_usageCounts.fill(0);
+    m_totalBytes = 0;
+}
+
+quint32 MemoryTracker::add(MemoryUsage usage,
+                           const QString &name,
+                           VkDeviceSize size,
+                           uint32_t heapIndex,
+                           bool dedicated) {
+    Record record;
+    record.usage = usage;
+    record.name = name;
+    record.size = size;
+    record.heapIndex = heapIndex;
+    record.dedicated = dedicated;
+
+    const quint32 id = m_nextId++;
+    m_records.insert(id, record);
+
+    const int usageIndex = int(usage);
+    m_heapBytes[heapIndex] += size;
+    m_heapPeakBytes[heapIndex] = qMax(m_heapPeakBytes[heapIndex], m_heapBytes[heapIndex]);
+    m_usageBytes[usageIndex] += size;
+    m_usagePeakBytes[usageIndex] = qMax(m_usagePeakBytes[usageIndex], m_usageBytes[usageIndex]);
+    ++m_usageCounts[usageIndex];
+    m_totalBytes += size;
+    m_totalPeakBytes = qMax(m_totalPeakBytes, m_totalBytes);
+
+    return id;
+}
+
+void MemoryTracker::remove(quint32 id) {
+    QHash<quint32, Record>::iterator it = m_records.find(id);
+    if (it == m_records.end())
+        return;
+
+    const int usageIndex = int(it->usage);
+    m_heapBytes[it->heapIndex] -= it->size;
+    m_usageBytes[usageIndex] -= it->size;
+    --m_usageCounts[usageIndex];
+    m_totalBytes -= it->size;
+
+    m_records.erase(it);
+}
+
+const char *MemoryTracker::usageName(MemoryUsage usage) {
+    switch (usage) {
+    case MemoryUsage::Vertex:
+        return "vertex";
+    case MemoryUsage::Index:
+        return "index";
+    case MemoryUsage::Indirect:
+        return "indirect";
+    case MemoryUsage::Uniform:
+        return "uniform";
+    case MemoryUsage::Texture:
+        return "texture";
+    case MemoryUsage::Attachment:
+        return "attachment";
+    case MemoryUsage::Staging:
+        return "staging";
+    case MemoryUsage::Readback:
+        return "readback";
+    default:
+        return "unknown";
+    }
+}
+
+QJsonObject MemoryTracker::toJson() const {
+    QJsonObject usages;
+    for (int i = 0; i < int(MemoryUsage::Count); ++i) {
+        QJsonObject usage;
+        usage["bytes"] = double(m_usageBytes[i]);
+        usage["peakBytes"] = double(m_usagePeakBytes[i]);
+        usage["count"] = m_usageCounts[i];
+        usages[usageName(MemoryUsage(i))] = usage;
+    }
+
+    QJsonObject objects;
+    QJsonArray allocations;
+    for (const Record &record : m_records) {
+        QJsonObject allocation;
+        allocation["usage"] = usageName(record.usage);
+        allocation["name"] = record.name;
+        allocation["size"] = double(record.size);
+        allocation["heap"] = int(record.heapIndex);
+        allocation["dedicated"] = record.dedicated;
+        allocations.append(allocation);
+
+        const QString key = record.name.isEmpty() ? QStringLiteral("<unnamed>") : record.name;
+        objects[key] = objects[key].toDouble() + double(record.size);
+    }
+
+    QJsonObject json;
+    json["totalBytes"] = double(m_totalBytes);
+    json["peakBytes"] = double(m_totalPeakBytes);
+    json["usages"] = usages;
+    json["objects"] = objects;
+    json["allocations"] = allocations;
+
+    return json;
+}
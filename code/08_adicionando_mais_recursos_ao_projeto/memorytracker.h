@@ -0,0 +1,80 @@
+#ifndef MEMORYTRACKER_H
+#define MEMORYTRACKER_H
+
+#include <QHash>
+#include <QJsonObject>
+#include <QString>
+#include <QVector>
+#include <QVulkanDeviceFunctions>
+
+enum class MemoryUsage {
+    Vertex,
+    Index,
+    Indirect,
+    Uniform,
+    Texture,
+    Attachment,
+    Staging,
+    Readback,
+    Count
+};
+
+class MemoryTracker
+{
+public:
+    void init(uint32_t heapCount);
+    void clear();
+
+    quint32 add(MemoryUsage usage,
+                const QString &name,
+                VkDeviceSize size,
+                uint32_t heapIndex,
+                bool dedicated);
+    void remove(quint32 id);
+
+    int allocationCount() const {
+        return m_records.size();
+    }
+
+    VkDeviceSize heapBytes(uint32_t heapIndex) const {
+        return m_heapBytes[heapIndex];
+    }
+
+    VkDeviceSize heapPeakBytes(uint32_t heapIndex) const {
+        return m_heapPeakBytes[heapIndex];
+    }
+
+    VkDeviceSize totalBytes() const {
+        return m_totalBytes;
+    }
+
+    VkDeviceSize totalPeakBytes() const {
+        return m_totalPeakBytes;
+    }
+
+    QJsonObject toJson() const;
+
+    static const char *usageName(MemoryUsage usage);
+
+private:
+    struct Record {
+        MemoryUsage usage = MemoryUsage::Vertex;
+        QString name;
+        VkDeviceSize size = 0;
+        uint32_t heapIndex = 0;
+        bool dedicated = false;
+    };
+
+    quint32 m_nextId = 1;
+    QHash<quint32, Record> m_records;
+
+    QVector<VkDeviceSize> m_heapBytes;
+    QVector<VkDeviceSize> m_heapPeakBytes;
+    QVector<VkDeviceSize> m_usageBytes;
+    QVector<VkDeviceSize> m_usagePeakBytes;
+    QVector<int> m_usageCounts;
+    VkDeviceSize m_totalBytes = 0;
+    VkDeviceSize m_totalPeakBytes = 0;
+};
+
+#endif // MEMORYTRACKER_H
@@ -1,5 +1,8 @@
 #include "model.h"
 
+#include <QFileInfo>
+#include <cmath>
+
 #ifndef TINYOBJLOADER_IMPLEMENTATION
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
@@ -40,10 +43,16 @@ void Model::readOBJFile(QString const &filePath) {
     QVector3D minDimension = QVector3D(fmax, fmax, fmax);
     QVector3D maxDimension = QVector3D(fmin, fmin, fmin);
 
+    name = QFileInfo(filePath).fileName();
+
     if (vertices.size()) {
         vertices.clear();
     }
 
+    hasNormals = true;
+    hasTexCoords = true;
+    hasVertexColors = false;
+
     for (const tinyobj::shape_t &shape : shapes) {
         for (const tinyobj::index_t &index : shape.mesh.indices) {
             Vertex vertex = {};
@@ -57,13 +66,30 @@ void Model::readOBJFile(QString const &filePath) {
                 attribs.vertices[indexTemp + 2]
             };
 
-            indexTemp = index.texcoord_index * 2;
-            vertex.texCoord = {
-                attribs.texcoords[indexTemp + 0],
-                1.0f - attribs.texcoords[indexTemp + 1]
-            };
+            if (index.texcoord_index > -1) {
+                indexTemp = index.texcoord_index * 2;
+                vertex.texCoord = {
+                    attribs.texcoords[indexTemp + 0],
+                    1.0f - attribs.texcoords[indexTemp + 1]
+                };
+            } else {
+                hasTexCoords = false;
+            }
 
-            vertex.color = {1.0f, 1.0f, 1.0f};
+            // tinyobjloader fills in white for vertices without a color.
+            indexTemp = index.vertex_index * 3;
+            if (indexTemp + 2 < attribs.colors.size()) {
+                vertex.color = {
+                    attribs.colors[indexTemp + 0],
+                    attribs.colors[indexTemp + 1],
+                    attribs.colors[indexTemp + 2]
+                };
+                if (vertex.color != QVector3D(1.0f, 1.0f, 1.0f)) {
+                    hasVertexColors = true;
+                }
+            } else {
+                vertex.color = {1.0f, 1.0f, 1.0f};
+            }
 
             if (vertex.pos.x() < minDimension.x()) {
                 minDimension.setX(vertex.pos.x());
@@ -96,6 +122,7 @@ void Model::readOBJFile(QString const &filePath) {
                 };
             } else {
                 vertex.normal = {0.0f, 0.0f, 0.0f};
+                hasNormals = false;
             }
 
             vertices.push_back(vertex);
@@ -114,5 +141,24 @@ void Model::readOBJFile(QString const &filePath) {
     transformation.scale(sc);
     transformation.translate(-center);
 
+    boundingCenter = center;
+    boundingRadius = (maxDimension - minDimension).length() / 2;
+
+    float surfaceArea = 0.0f;
+    float texCoordArea = 0.0f;
+    for (int i = 0; i + 2 < vertices.size(); i += 3) {
+        const Vertex &a = vertices[i];
+        const Vertex &b = vertices[i + 1];
+        const Vertex &c = vertices[i + 2];
+
+        surfaceArea += QVector3D::crossProduct(b.pos - a.pos, c.pos - a.pos).length() / 2;
+
+        const QVector2D uv1 = b.texCoord - a.texCoord;
+        const QVector2D uv2 = c.texCoord - a.texCoord;
+        texCoordArea += qAbs(uv1.x() * uv2.y() - uv1.y() * uv2.x()) / 2;
+    }
+
+    texCoordDensity = surfaceArea > 0.0f ? std::sqrt(texCoordArea / surfaceArea) : 0.0f;
+
 
 }
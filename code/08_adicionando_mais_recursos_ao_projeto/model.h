@@ -59,8 +59,17 @@ struct Model
 
     void readOBJFile(QString const &filePath);
 
+    QString name;
     QVector<Vertex> vertices;
     QMatrix4x4 transformation;
+
+    QVector3D boundingCenter;
+    float boundingRadius = 0.0f;
+    float texCoordDensity = 0.0f;
+
+    bool hasNormals = false;
+    bool hasTexCoords = false;
+    bool hasVertexColors = false;
 };
 
 #endif // MODEL_H
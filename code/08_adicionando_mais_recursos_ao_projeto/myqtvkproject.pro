@@ -30,14 +30,56 @@ SOURCES += \
     vulkanwindow.cpp \
     renderer.cpp \
     model.cpp \
-    trackball.cpp
+    trackball.cpp \
+    commandrecorder.cpp \
+    deletionqueue.cpp \
+    features.cpp \
+    gpuculler.cpp \
+    memoryallocator.cpp \
+    memorydefragmenter.cpp \
+    memorytracker.cpp \
+    pipelinecache.cpp \
+    pipelinecompiler.cpp \
+    pipelinestatistics.cpp \
+    renderscheduler.cpp \
+    rendertarget.cpp \
+    scene.cpp \
+    uploadbatch.cpp \
+    virtualtexture.cpp \
+    virtualtexturebuilder.cpp \
+    texturetable.cpp \
+    textureatlas.cpp \
+    textureatlasbuilder.cpp \
+    texturestreamer.cpp
 
 HEADERS += \
         mainwindow.h \
     vulkanwindow.h \
     renderer.h \
     model.h \
-    trackball.h
+    trackball.h \
+    commandrecorder.h \
+    deletionqueue.h \
+    features.h \
+    gpuculler.h \
+    memoryallocator.h \
+    memorydefragmenter.h \
+    memorytracker.h \
+    pipelinecache.h \
+    pipelinecompiler.h \
+    pipelinestatistics.h \
+    renderscheduler.h \
+    rendertarget.h \
+    scene.h \
+    shadervariant.h \
+    spirvshaders.h \
+    uploadbatch.h \
+    virtualtexture.h \
+    virtualtexturebuilder.h \
+    texturetable.h \
+    textureatlas.h \
+    textureatlasbuilder.h \
+    texturestreamer.h
 
 FORMS += \
         mainwindow.ui
@@ -47,14 +89,23 @@ qnx: target.path = /tmp/$${TARGET}/bin
 else: unix:!android: target.path = /opt/$${TARGET}/bin
 !isEmpty(target.path): INSTALLS += target
 
-Shaders = shaders/shader.vert shaders/shader.frag
-for (shader, Shaders) {
-    exists($$_PRO_FILE_PWD_/$${shader}) {
-        message(Compiling Spir-V $$_PRO_FILE_PWD_/$${shader})
-        ERROR = $$system(glslangValidator -V -o $$_PRO_FILE_PWD_/$${shader}.spv $$_PRO_FILE_PWD_/$${shader})
-        message($$ERROR)
-    }
-}
+Shaders = shaders/shader.vert shaders/shader.frag \
+    shaders/virtualtexture.frag shaders/feedback.frag \
+    shaders/bindless.frag shaders/atlas.frag \
+    shaders/instanced.vert shaders/instanced.frag \
+    shaders/cull.comp shaders/depth.vert
+
+# Pass SPIRV_OPT_FLAGS=-Os to qmake to optimize the shaders for size.
+isEmpty(SPIRV_OPT_FLAGS): SPIRV_OPT_FLAGS = -O
+
+spirv.input = Shaders
+spirv.output = $$OUT_PWD/shaders/${QMAKE_FILE_BASE}${QMAKE_FILE_EXT}.spv.h
+spirv.commands = python3 $$_PRO_FILE_PWD_/shaders/build_spirv.py ${QMAKE_FILE_IN} ${QMAKE_FILE_OUT} $$SPIRV_OPT_FLAGS
+spirv.depends = $$_PRO_FILE_PWD_/shaders/build_spirv.py
+spirv.CONFIG += no_link target_predeps
+QMAKE_EXTRA_COMPILERS += spirv
+
+INCLUDEPATH += $$OUT_PWD/shaders
 
 RESOURCES += \
     resources.qrc
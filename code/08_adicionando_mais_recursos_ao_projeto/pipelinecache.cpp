@@ -0,0 +1,178 @@
+#include "pipelinecache.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <cstring>
+
+#include "features.h"
+#include "vulkanwindow.h"
+
+static const quint32 FILE_MAGIC = 0x43505651; // "QVPC"
+static const quint32 FILE_VERSION = 1;
+
+// Drivers reject foreign cache data on their own, but not all of them do it
+// gracefully, so files are only handed over when they were written for this
+// exact device and driver.
+struct PipelineCacheFileHeader {
+    quint32 magic;
+    quint32 version;
+    quint32 vendorID;
+    quint32 deviceID;
+    quint32 driverVersion;
+    quint8 pipelineCacheUUID[VK_UUID_SIZE];
+    quint32 dataSize;
+    quint8 dataHash[20];
+};
+
+// The header every driver writes at the start of the cache data.
+struct VulkanPipelineCacheHeader {
+    quint32 headerSize;
+    quint32 headerVersion;
+    quint32 vendorID;
+    quint32 deviceID;
+    quint8 pipelineCacheUUID[VK_UUID_SIZE];
+};
+
+static void fillFileHeader(const VkPhysicalDeviceProperties *properties,
+                           const QByteArray &data,
+                           PipelineCacheFileHeader &header) {
+    header.magic = FILE_MAGIC;
+    header.version = FILE_VERSION;
+    header.vendorID = properties->vendorID;
+    header.deviceID = properties->deviceID;
+    header.driverVersion = properties->driverVersion;
+    memcpy(header.pipelineCacheUUID, properties->pipelineCacheUUID, VK_UUID_SIZE);
+    header.dataSize = static_cast<quint32>(data.size());
+
+    const QByteArray hash = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+    memcpy(header.dataHash, hash.constData(), sizeof(header.dataHash));
+}
+
+void PipelineCache::create(VulkanWindow *window, QVulkanDeviceFunctions *deviceFunctions) {
+    m_window = window;
+    m_deviceFunctions = deviceFunctions;
+
+    const QByteArray initialData = load();
+    m_warm = !initialData.isEmpty();
+
+    VkPipelineCacheCreateInfo cacheInfo = {};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = size_t(initialData.size());
+    cacheInfo.pInitialData = initialData.isEmpty() ? nullptr : initialData.constData();
+
+    VkResult result = m_deviceFunctions->vkCreatePipelineCache(
+        m_window->device(),
+        &cacheInfo,
+        nullptr,
+        &m_cache
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create pipeline cache: %d", result);
+    }
+}
+
+void PipelineCache::release() {
+    if (!m_cache)
+        return;
+
+    save();
+
+    m_deviceFunctions->vkDestroyPipelineCache(m_window->device(), m_cache, nullptr);
+    m_cache = VK_NULL_HANDLE;
+    m_warm = false;
+}
+
+QString PipelineCache::fileName() const {
+    const VkPhysicalDeviceProperties *properties = m_window->physicalDeviceProperties();
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+        + QString("/pipelines/%1-%2.cache")
+              .arg(properties->vendorID, 4, 16, QLatin1Char('0'))
+              .arg(properties->deviceID, 4, 16, QLatin1Char('0'));
+}
+
+QByteArray PipelineCache::load() const {
+    if (!isFeatureEnabled(Feature::PipelineCache))
+        return QByteArray();
+
+    QFile file(fileName());
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+
+    PipelineCacheFileHeader fileHeader;
+    if (file.read(reinterpret_cast<char *>(&fileHeader), sizeof(fileHeader)) != sizeof(fileHeader))
+        return QByteArray();
+
+    const QByteArray data = file.readAll();
+
+    PipelineCacheFileHeader expected;
+    fillFileHeader(m_window->physicalDeviceProperties(), data, expected);
+    if (memcmp(&fileHeader, &expected, sizeof(expected)) != 0) {
+        qCDebug(lcStats, "Ignoring pipeline cache %s that does not match this device and driver",
+                file.fileName().toStdString().c_str());
+        return QByteArray();
+    }
+
+    VulkanPipelineCacheHeader cacheHeader;
+    if (size_t(data.size()) < sizeof(cacheHeader))
+        return QByteArray();
+    memcpy(&cacheHeader, data.constData(), sizeof(cacheHeader));
+    if (cacheHeader.headerSize < sizeof(cacheHeader)
+        || cacheHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        || cacheHeader.vendorID != expected.vendorID
+        || cacheHeader.deviceID != expected.deviceID
+        || memcmp(cacheHeader.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+        return QByteArray();
+
+    return data;
+}
+
+bool PipelineCache::save() {
+    if (!m_cache || !isFeatureEnabled(Feature::PipelineCache))
+        return false;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    VkDevice device = m_window->device();
+    size_t dataSize = 0;
+    VkResult result = m_deviceFunctions->vkGetPipelineCacheData(device, m_cache, &dataSize, nullptr);
+    if (result != VK_SUCCESS || dataSize == 0)
+        return false;
+
+    QByteArray data;
+    data.resize(int(dataSize));
+    result = m_deviceFunctions->vkGetPipelineCacheData(device, m_cache, &dataSize, data.data());
+    if (result != VK_SUCCESS)
+        return false;
+    data.resize(int(dataSize));
+
+    PipelineCacheFileHeader header;
+    fillFileHeader(m_window->physicalDeviceProperties(), data, header);
+
+    // QSaveFile writes to a temporary file and renames it on commit, so a
+    // crash mid-write never leaves a truncated cache behind.
+    const QString path = fileName();
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning("Failed to write pipeline cache to %s", path.toStdString().c_str());
+        return false;
+    }
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(data);
+    if (!file.commit()) {
+        qWarning("Failed to write pipeline cache to %s", path.toStdString().c_str());
+        return false;
+    }
+
+    qCDebug(lcStats, "Saved %d bytes of pipeline cache in %lld us",
+            data.size(),
+            static_cast<long long>(timer.nsecsElapsed() / 1000));
+    return true;
+}
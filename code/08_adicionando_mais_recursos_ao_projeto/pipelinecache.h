@@ -0,0 +1,37 @@
+#ifndef PIPELINECACHE_H
+#define PIPELINECACHE_H
+
+#include <QString>
+#include <QVulkanDeviceFunctions>
+
+class VulkanWindow;
+
+class PipelineCache
+{
+public:
+    void create(VulkanWindow *window, QVulkanDeviceFunctions *deviceFunctions);
+    void release();
+
+    VkPipelineCache handle() const {
+        return m_cache;
+    }
+
+    bool isWarm() const {
+        return m_warm;
+    }
+
+    bool save();
+
+private:
+    VulkanWindow *m_window = nullptr;
+    QVulkanDeviceFunctions *m_deviceFunctions = nullptr;
+
+    VkPipelineCache m_cache = VK_NULL_HANDLE;
+    bool m_warm = false;
+
+private:
+    QString fileName() const;
+    QByteArray load() const;
+};
+
+#endif // PIPELINECACHE_H
@@ -0,0 +1,276 @@
+#include "pipelinecompiler.h"
+
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+
+#include "features.h"
+#include "model.h"
+#include "pipelinecache.h"
+#include "renderer.h"
+#include "spirvshaders.h"
+#include "vulkanwindow.h"
+
+class PipelineCompileTask : public QRunnable
+{
+public:
+    PipelineCompileTask(PipelineCompiler *compiler,
+                        const GraphicsPipelineDescription &description,
+                        VkPipeline *target)
+        : m_compiler(compiler)
+        , m_description(description)
+        , m_target(target) {}
+
+    void run() override {
+        m_compiler->completePipeline(m_target, m_compiler->createPipeline(m_description));
+    }
+
+private:
+    PipelineCompiler *m_compiler;
+    GraphicsPipelineDescription m_description;
+    VkPipeline *m_target;
+};
+
+void GraphicsPipelineDescription::addConstant(uint32_t constantID, uint32_t value) {
+    VkSpecializationMapEntry entry = {};
+    entry.constantID = constantID;
+    entry.offset = static_cast<uint32_t>(specializationData.size());
+    entry.size = sizeof(value);
+
+    specializationEntries.append(entry);
+    specializationData.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void PipelineCompiler::init(VulkanWindow *window,
+                            QVulkanDeviceFunctions *deviceFunctions,
+                            PipelineCache *pipelineCache) {
+    m_window = window;
+    m_deviceFunctions = deviceFunctions;
+    m_pipelineCache = pipelineCache;
+
+    m_async = isFeatureEnabled(Feature::AsyncPipelines);
+    m_threadPool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1));
+}
+
+void PipelineCompiler::release() {
+    m_threadPool.waitForDone();
+
+    VkDevice device = m_window->device();
+    for (const CompiledPipeline &compiled : m_compiledPipelines) {
+        m_deviceFunctions->vkDestroyPipeline(device, compiled.pipeline, nullptr);
+    }
+    m_compiledPipelines.clear();
+    m_pendingCount = 0;
+}
+
+void PipelineCompiler::compile(const GraphicsPipelineDescription &description, VkPipeline *target) {
+    if (m_pendingCount++ == 0) {
+        m_batchCount = 0;
+        m_batchTimer.start();
+    }
+    ++m_batchCount;
+
+    PipelineCompileTask *task = new PipelineCompileTask(this, description, target);
+    if (m_async) {
+        m_threadPool.start(task);
+    } else {
+        task->run();
+        delete task;
+    }
+}
+
+bool PipelineCompiler::collect() {
+    QVector<CompiledPipeline> compiledPipelines;
+    {
+        QMutexLocker locker(&m_compiledMutex);
+        compiledPipelines.swap(m_compiledPipelines);
+    }
+
+    if (compiledPipelines.isEmpty()) {
+        return false;
+    }
+
+    for (const CompiledPipeline &compiled : compiledPipelines) {
+        *compiled.target = compiled.pipeline;
+    }
+
+    m_pendingCount -= compiledPipelines.size();
+    if (m_pendingCount == 0) {
+        qCDebug(lcStats, "Compiled %d pipelines in %.1f ms with a %s pipeline cache",
+                m_batchCount,
+                m_batchTimer.nsecsElapsed() / 1000000.0,
+                m_pipelineCache->isWarm() ? "warm" : "cold");
+    }
+
+    return true;
+}
+
+void PipelineCompiler::completePipeline(VkPipeline *target, VkPipeline pipeline) {
+    CompiledPipeline compiled;
+    compiled.target = target;
+    compiled.pipeline = pipeline;
+
+    QMutexLocker locker(&m_compiledMutex);
+    m_compiledPipelines.append(compiled);
+}
+
+VkShaderModule PipelineCompiler::createShaderModule(const SpirvModule &module) const {
+    VkShaderModuleCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    createInfo.codeSize = module.size;
+    createInfo.pCode = module.code;
+
+    VkShaderModule shaderModule;
+    VkResult result = m_deviceFunctions->vkCreateShaderModule(
+        m_window->device(),
+        &createInfo,
+        nullptr,
+        &shaderModule
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create shader module: %d", result);
+    }
+
+    return shaderModule;
+}
+
+// Runs on the worker threads. Pipeline caches are internally synchronized,
+// so every worker compiles against the shared one and hits it when warm.
+VkPipeline PipelineCompiler::createPipeline(const GraphicsPipelineDescription &description) const {
+    VkDevice device = m_window->device();
+
+    VkShaderModule vertShaderModule = createShaderModule(*description.vertShader);
+    VkShaderModule fragShaderModule = description.fragShader
+        ? createShaderModule(*description.fragShader)
+        : VK_NULL_HANDLE;
+
+    VkSpecializationInfo specializationInfo = {};
+    specializationInfo.mapEntryCount = static_cast<uint32_t>(description.specializationEntries.size());
+    specializationInfo.pMapEntries = description.specializationEntries.constData();
+    specializationInfo.dataSize = size_t(description.specializationData.size());
+    specializationInfo.pData = description.specializationData.constData();
+
+    VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
+    vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    vertShaderStageInfo.module = vertShaderModule;
+    vertShaderStageInfo.pName = "main";
+    vertShaderStageInfo.pSpecializationInfo =
+        description.specializationEntries.isEmpty() ? nullptr : &specializationInfo;
+
+    VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
+    fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    fragShaderStageInfo.module = fragShaderModule;
+    fragShaderStageInfo.pName = "main";
+    fragShaderStageInfo.pSpecializationInfo = vertShaderStageInfo.pSpecializationInfo;
+
+    VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+
+    VkDynamicState dynamicStates[] = {
+        VK_DYNAMIC_STATE_VIEWPORT,
+        VK_DYNAMIC_STATE_SCISSOR
+    };
+
+    VkPipelineDynamicStateCreateInfo dynamicInfo = {};
+    dynamicInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicInfo.dynamicStateCount = 2;
+    dynamicInfo.pDynamicStates = dynamicStates;
+
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+    QVector<VkVertexInputBindingDescription> bindingDescriptions;
+    QVector<VkVertexInputAttributeDescription> attributeDescriptions;
+
+    bindingDescriptions.append(Vertex::getBindingDescription());
+    for (const VkVertexInputAttributeDescription &attribute : Vertex::getAttributeDescriptions())
+        attributeDescriptions.append(attribute);
+
+    if (description.instanced) {
+        bindingDescriptions.append(InstanceData::getBindingDescription());
+        for (const VkVertexInputAttributeDescription &attribute : InstanceData::getAttributeDescriptions())
+            attributeDescriptions.append(attribute);
+    }
+
+    vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.constData();
+    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.constData();
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssemblyInfo = {};
+    inputAssemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    inputAssemblyInfo.primitiveRestartEnable = VK_FALSE;
+
+    VkPipelineRasterizationStateCreateInfo rasterizationInfo = {};
+    rasterizationInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizationInfo.depthClampEnable = VK_FALSE;
+    rasterizationInfo.rasterizerDiscardEnable = VK_FALSE;
+    rasterizationInfo.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizationInfo.cullMode = VK_CULL_MODE_BACK_BIT;
+    rasterizationInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterizationInfo.depthBiasEnable = VK_FALSE;
+    rasterizationInfo.depthBiasConstantFactor = 0.0f;
+    rasterizationInfo.depthBiasClamp = 0.0f;
+    rasterizationInfo.depthBiasSlopeFactor = 0.0f;
+    rasterizationInfo.lineWidth = 1.0f;
+
+    VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+    colorBlendAttachment.colorWriteMask = fragShaderModule
+        ? VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT
+        : 0;
+    colorBlendAttachment.blendEnable = VK_FALSE;
+
+    VkPipelineColorBlendStateCreateInfo colorBlending = {};
+    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.logicOpEnable = VK_FALSE;
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &colorBlendAttachment;
+
+    VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+    depthStencil.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = description.depthWrite ? VK_TRUE : VK_FALSE;
+    depthStencil.depthCompareOp = description.depthCompareOp;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.minDepthBounds = 0.0f;
+    depthStencil.maxDepthBounds = 1.0f;
+    depthStencil.stencilTestEnable = VK_FALSE;
+    depthStencil.front = {};
+    depthStencil.back = {};
+
+    VkGraphicsPipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount = fragShaderModule ? 2 : 1;
+    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.pDynamicState = &dynamicInfo;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssemblyInfo;
+    pipelineInfo.pRasterizationState = &rasterizationInfo;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.layout = description.layout;
+    pipelineInfo.renderPass = description.renderPass;
+    pipelineInfo.subpass = 0;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+
+    VkPipeline pipeline;
+    VkResult result = m_deviceFunctions->vkCreateGraphicsPipelines(
+            device,
+            m_pipelineCache->handle(),
+            1,
+            &pipelineInfo,
+            nullptr,
+            &pipeline
+        );
+
+    if (result != VK_SUCCESS)
+        qFatal("Failed to graphics pipeline: %d", result);
+
+    if (fragShaderModule)
+        m_deviceFunctions->vkDestroyShaderModule(device, fragShaderModule, nullptr);
+    m_deviceFunctions->vkDestroyShaderModule(device, vertShaderModule, nullptr);
+
+    return pipeline;
+}
@@ -0,0 +1,73 @@
+#ifndef PIPELINECOMPILER_H
+#define PIPELINECOMPILER_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QThreadPool>
+#include <QVulkanDeviceFunctions>
+#include <QVector>
+
+class PipelineCache;
+class VulkanWindow;
+struct SpirvModule;
+
+// A description without a fragment shader builds a depth-only pipeline.
+struct GraphicsPipelineDescription
+{
+    const SpirvModule *vertShader = nullptr;
+    const SpirvModule *fragShader = nullptr;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    bool instanced = false;
+    VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS;
+    bool depthWrite = true;
+
+    // Shared by both stages; constants a stage does not declare are ignored.
+    QVector<VkSpecializationMapEntry> specializationEntries;
+    QByteArray specializationData;
+
+    void addConstant(uint32_t constantID, uint32_t value);
+};
+
+class PipelineCompiler
+{
+public:
+    void init(VulkanWindow *window, QVulkanDeviceFunctions *deviceFunctions, PipelineCache *pipelineCache);
+    void release();
+
+    // Compiles on a worker thread; *target stays VK_NULL_HANDLE until the
+    // collect() call after the pipeline is finished.
+    void compile(const GraphicsPipelineDescription &description, VkPipeline *target);
+    bool collect();
+
+    bool isCompiling() const {
+        return m_pendingCount > 0;
+    }
+
+    VkPipeline createPipeline(const GraphicsPipelineDescription &description) const;
+    void completePipeline(VkPipeline *target, VkPipeline pipeline);
+
+private:
+    struct CompiledPipeline {
+        VkPipeline *target;
+        VkPipeline pipeline;
+    };
+
+    VulkanWindow *m_window = nullptr;
+    QVulkanDeviceFunctions *m_deviceFunctions = nullptr;
+    PipelineCache *m_pipelineCache = nullptr;
+
+    bool m_async = true;
+    QThreadPool m_threadPool;
+    QMutex m_compiledMutex;
+    QVector<CompiledPipeline> m_compiledPipelines;
+
+    int m_pendingCount = 0;
+    int m_batchCount = 0;
+    QElapsedTimer m_batchTimer;
+
+private:
+    VkShaderModule createShaderModule(const SpirvModule &module) const;
+};
+
+#endif // PIPELINECOMPILER_H
@@ -0,0 +1,127 @@
+#include "pipelinestatistics.h"
+
+#include <QVulkanFunctions>
+#include <array>
+
+#include "features.h"
+#include "vulkanwindow.h"
+
+// Results come back in bit order, so vertex invocations precede fragment
+// invocations.
+static const VkQueryPipelineStatisticFlags STATISTICS =
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT
+    | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+bool PipelineStatistics::init(VulkanWindow *window,
+                              QVulkanDeviceFunctions *deviceFunctions,
+                              bool secondaryCommandBuffers) {
+    m_window = window;
+    m_deviceFunctions = deviceFunctions;
+
+    if (!isFeatureEnabled(Feature::PipelineStatistics)) {
+        return false;
+    }
+
+    VkPhysicalDeviceFeatures features;
+    m_window->vulkanInstance()->functions()->vkGetPhysicalDeviceFeatures(
+        m_window->physicalDevice(),
+        &features
+    );
+    if (!features.pipelineStatisticsQuery
+        || (secondaryCommandBuffers && !features.inheritedQueries)) {
+        return false;
+    }
+
+    VkQueryPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+    poolInfo.queryCount = static_cast<uint32_t>(m_window->concurrentFrameCount());
+    poolInfo.pipelineStatistics = STATISTICS;
+
+    VkResult result = m_deviceFunctions->vkCreateQueryPool(
+        m_window->device(),
+        &poolInfo,
+        nullptr,
+        &m_queryPool
+    );
+    if (result != VK_SUCCESS) {
+        qWarning("Failed to create pipeline statistics query pool: %d", result);
+        m_queryPool = VK_NULL_HANDLE;
+        return false;
+    }
+
+    m_pending.fill(false, m_window->concurrentFrameCount());
+    resetAverages();
+    return true;
+}
+
+void PipelineStatistics::release() {
+    if (!m_queryPool) {
+        return;
+    }
+
+    m_deviceFunctions->vkDestroyQueryPool(m_window->device(), m_queryPool, nullptr);
+    m_queryPool = VK_NULL_HANDLE;
+    m_pending.clear();
+}
+
+VkQueryPipelineStatisticFlags PipelineStatistics::flags() const {
+    return m_queryPool ? STATISTICS : 0;
+}
+
+void PipelineStatistics::begin(VkCommandBuffer commandBuffer) {
+    const int frame = m_window->currentFrame();
+
+    // The frame fence has been waited on, so the previous query in this
+    // slot is complete.
+    collect(frame);
+
+    m_deviceFunctions->vkCmdResetQueryPool(commandBuffer, m_queryPool, uint32_t(frame), 1);
+    m_deviceFunctions->vkCmdBeginQuery(commandBuffer, m_queryPool, uint32_t(frame), 0);
+}
+
+void PipelineStatistics::end(VkCommandBuffer commandBuffer) {
+    const int frame = m_window->currentFrame();
+    m_deviceFunctions->vkCmdEndQuery(commandBuffer, m_queryPool, uint32_t(frame));
+    m_pending[frame] = true;
+}
+
+void PipelineStatistics::collect(int frame) {
+    if (!m_pending[frame]) {
+        return;
+    }
+    m_pending[frame] = false;
+
+    std::array<quint64, 2> results = {};
+    VkResult result = m_deviceFunctions->vkGetQueryPoolResults(
+        m_window->device(),
+        m_queryPool,
+        uint32_t(frame),
+        1,
+        sizeof(results),
+        results.data(),
+        sizeof(results),
+        VK_QUERY_RESULT_64_BIT
+    );
+    if (result != VK_SUCCESS) {
+        return;
+    }
+
+    m_vertexInvocations += results[0];
+    m_fragmentInvocations += results[1];
+    ++m_sampleCount;
+}
+
+double PipelineStatistics::averageVertexInvocations() const {
+    return m_sampleCount > 0 ? double(m_vertexInvocations) / m_sampleCount : 0.0;
+}
+
+double PipelineStatistics::averageFragmentInvocations() const {
+    return m_sampleCount > 0 ? double(m_fragmentInvocations) / m_sampleCount : 0.0;
+}
+
+void PipelineStatistics::resetAverages() {
+    m_vertexInvocations = 0;
+    m_fragmentInvocations = 0;
+    m_sampleCount = 0;
+}
@@ -0,0 +1,45 @@
+#ifndef PIPELINESTATISTICS_H
+#define PIPELINESTATISTICS_H
+
+#include <QVulkanDeviceFunctions>
+#include <QVector>
+
+class VulkanWindow;
+
+class PipelineStatistics
+{
+public:
+    bool init(VulkanWindow *window, QVulkanDeviceFunctions *deviceFunctions, bool secondaryCommandBuffers);
+    void release();
+
+    bool isCreated() const {
+        return m_queryPool != VK_NULL_HANDLE;
+    }
+
+    // Secondary command buffers executed inside the query must inherit
+    // these statistics.
+    VkQueryPipelineStatisticFlags flags() const;
+
+    void begin(VkCommandBuffer commandBuffer);
+    void end(VkCommandBuffer commandBuffer);
+
+    double averageVertexInvocations() const;
+    double averageFragmentInvocations() const;
+    void resetAverages();
+
+private:
+    VulkanWindow *m_window = nullptr;
+    QVulkanDeviceFunctions *m_deviceFunctions = nullptr;
+
+    VkQueryPool m_queryPool = VK_NULL_HANDLE;
+    QVector<bool> m_pending;
+
+    quint64 m_vertexInvocations = 0;
+    quint64 m_fragmentInvocations = 0;
+    int m_sampleCount = 0;
+
+private:
+    void collect(int frame);
+};
+
+#endif // PIPELINESTATISTICS_H
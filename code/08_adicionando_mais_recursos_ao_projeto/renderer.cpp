@@ -1,38 +1,94 @@
 #include "renderer.h"
 
+#include <QElapsedTimer>
 #include <QFile>
-#include <QTime>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QImageReader>
+#include <QThread>
 #include <QVulkanFunctions>
 #include <array>
+#include <cmath>
 
+#include "features.h"
 #include "vulkanwindow.h"
 
 #include "model.h"
+#include "spirvshaders.h"
+#include "virtualtexture.h"
 
 static const QString DEFAULT_TEXTURE_PATH =
     ":/textures/default.png";
 
-Object3D::Object3D(QSharedPointer<Model> model)
-    : model(model) {}
+static const int VIRTUAL_TEXTURE_THRESHOLD = 8192;
+
+// Vertex shaders receive the model matrix in the first half of the push
+// constant block and fragment shaders their material data in the second;
+// 128 bytes is the minimum every device supports.
+static const uint32_t MATERIAL_PUSH_CONSTANT_OFFSET = sizeof(ObjectPushConstants);
+static const uint32_t MATERIAL_PUSH_CONSTANT_SIZE = 64;
+
+static_assert(sizeof(VirtualTextureParams) <= MATERIAL_PUSH_CONSTANT_SIZE
+              && sizeof(TextureAtlasParams) <= MATERIAL_PUSH_CONSTANT_SIZE,
+              "material parameters must fit the material push constant range");
+
+static const int STATS_INTERVAL_FRAMES = 600;
 
 Renderer::Renderer(VulkanWindow *window) : m_window(window) {
 
 }
 
+// Device resources are gone by now; releaseResources() keeps these so they
+// can be recreated when the device comes back.
+Renderer::~Renderer() {
+    qDeleteAll(m_meshes);
+    qDeleteAll(m_materials);
+    qDeleteAll(m_instanceBatches);
+}
+
 void Renderer::initResources() {
     VkDevice device = m_window->device();
     m_deviceFunctions = m_window->vulkanInstance()->deviceFunctions(device);
 
+    m_memoryAllocator.init(m_window, m_deviceFunctions);
+    m_deletionQueue.init(m_window, m_deviceFunctions, &m_memoryAllocator);
+    m_memoryDefragmenter.init(m_window, m_deviceFunctions, &m_memoryAllocator, &m_deletionQueue);
+    m_uploadBatch.init(m_window, m_deviceFunctions, &m_memoryAllocator);
+    m_textureStreamer.init(this, m_window, m_deviceFunctions, &m_uploadBatch);
+    m_pipelineCache.create(m_window, m_deviceFunctions);
+    m_pipelineCompiler.init(m_window, m_deviceFunctions, &m_pipelineCache);
+
+    m_renderTarget.create(m_window, m_deviceFunctions, &m_memoryAllocator, m_window->depthBits());
+
+    m_parallelRecording = isFeatureEnabled(Feature::ParallelRecording);
+    m_commandReuse = isFeatureEnabled(Feature::CommandReuse);
+    m_renderScheduler.setContinuous(m_window->continuousRendering());
+    if (m_parallelRecording) {
+        m_commandRecorder.init(m_window, m_deviceFunctions, QThread::idealThreadCount());
+    }
+    if (m_pipelineStatistics.init(m_window, m_deviceFunctions, m_parallelRecording)) {
+        m_commandRecorder.setPipelineStatistics(m_pipelineStatistics.flags());
+    }
+
+    createUniformBuffer();
     createDescriptorSetLayout();
+    createFrameDescriptorSet();
     initPipeline();
     createTextureSampler();
+    initBindless();
+    initTextureAtlas();
+    initInstancing();
+    initDepthPrepass();
+    m_gpuCuller.init(this, m_window, m_deviceFunctions, &m_deletionQueue);
 }
 
 void Renderer::createBuffer(VkDeviceSize size,
                             VkBufferUsageFlags usage,
                             VkMemoryPropertyFlags properties,
                             VkBuffer& buffer,
-                            VkDeviceMemory& bufferMemory) {
+                            MemoryAllocation& bufferMemory,
+                            MemoryUsage memoryUsage,
+                            const QString &name) {
 
     VkBufferCreateInfo bufferInfo = {};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -53,101 +109,220 @@ void Renderer::createBuffer(VkDeviceSize size,
         qFatal("Failed to create vertex buffer: %d", result);
     }
 
-    VkMemoryRequirements memRequirements;
-    m_deviceFunctions->vkGetBufferMemoryRequirements(
-            device,
-            buffer,
-            &memRequirements
-        );
-
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+    bufferMemory = m_memoryAllocator.allocateForBuffer(buffer, properties, memoryUsage, name);
+}
 
-    result = m_deviceFunctions->vkAllocateMemory(
-            device,
-            &allocInfo,
-            nullptr,
-            &bufferMemory
-        );
-    if ( result != VK_SUCCESS) {
-        qFatal("Failed to allocate vertex buffer memory!");
+void Renderer::initObjects() {
+    for (Mesh *mesh : m_meshes) {
+        if (mesh && mesh->vertexBuffer == VK_NULL_HANDLE)
+            createMeshVertexBuffer(mesh);
     }
 
-    m_deviceFunctions->vkBindBufferMemory(
-            device,
-            buffer,
-            bufferMemory,
-            0
-        );
+    for (Material *material : m_materials) {
+        if (material && !isMaterialReady(material))
+            addTextureImage(material, DEFAULT_TEXTURE_PATH);
+    }
 
+    for (InstanceBatch *batch : m_instanceBatches) {
+        if (batch && !batch->uploaded)
+            uploadInstanceBatch(batch);
+    }
 }
 
-uint32_t Renderer::findMemoryType(
-        uint32_t typeFilter,
-        VkMemoryPropertyFlags properties) {
+void Renderer::recordDraws(VkCommandBuffer commandBuffer,
+                           VkDescriptorSet textureTableSet,
+                           int first,
+                           int last) {
+    const QSize swapChainImageSize = m_window->swapChainImageSize();
+
+    VkViewport viewport;
+    viewport.x = 0;
+    viewport.y = 0;
+    viewport.width = swapChainImageSize.width();
+    viewport.height = swapChainImageSize.height();
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    m_deviceFunctions->vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+    VkRect2D scissor;
+    scissor.offset.x = 0;
+    scissor.offset.y = 0;
+    scissor.extent.width = viewport.width;
+    scissor.extent.height = viewport.height;
+    m_deviceFunctions->vkCmdSetScissor(
+        commandBuffer,
+        0,
+        1,
+        &scissor
+    );
 
-    VkPhysicalDeviceMemoryProperties memProperties;
-    QVulkanInstance *inst = m_window->vulkanInstance();
-    QVulkanFunctions *f = inst->functions();
+    // Every pipeline layout shares set 0 and the push constant ranges, so
+    // the frame uniforms stay bound across pipeline switches.
+    bindFrameDescriptorSet(commandBuffer, m_pipelineLayout);
+
+    DrawState state;
+    state.textureTableSet = textureTableSet;
+
+    // The prepass lays down depth for every object before any of them is
+    // shaded; instances keep their own depth test and come last.
+    const int objectCount = m_scene.size();
+    const int prepassCount = m_prepassActive ? objectCount : 0;
+    for (int index = first; index < last; ++index) {
+        if (index < prepassCount)
+            drawObjectDepth(commandBuffer, index, state);
+        else if (index < prepassCount + objectCount)
+            drawObject(commandBuffer, index - prepassCount, false, state);
+        else
+            drawInstances(commandBuffer, index - prepassCount - objectCount);
+    }
+}
 
-    f->vkGetPhysicalDeviceMemoryProperties(
-            m_window->physicalDevice(),
-            &memProperties
-        );
+void Renderer::bindFrameDescriptorSet(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout) {
+    const uint32_t dynamicOffset = frameUniformOffset();
+    m_deviceFunctions->vkCmdBindDescriptorSets(
+        commandBuffer,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        pipelineLayout,
+        0,
+        1,
+        &m_frameDescriptorSet,
+        1,
+        &dynamicOffset
+    );
+}
 
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-         if ((typeFilter & (1 << i)) &&
-            (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
-        }
+void Renderer::drawObject(VkCommandBuffer commandBuffer, int index, bool feedbackPass, DrawState &state)
+{
+    const Mesh *mesh = m_meshes.at(m_scene.meshes().at(index));
+    const int materialIndex = m_scene.materials().at(index);
+    const Material *material = m_materials.at(materialIndex);
+    if (!mesh->vertexBuffer || !isMaterialReady(material)) {
+        return;
     }
 
-    qFatal("Failed to find suitable memory type!");
+    VkPipelineLayout pipelineLayout = m_pipelineLayout;
+    VkDescriptorSet materialSet = material->descriptorSet;
+    if (material->virtualTexture) {
+        pipelineLayout = m_virtualTexturePipelineLayout;
+    } else if (material->atlasEntry >= 0) {
+        pipelineLayout = m_atlasPipelineLayout;
+        materialSet = m_textureAtlas.descriptorSet();
+    } else if (material->textureIndex >= 0) {
+        pipelineLayout = m_bindlessPipelineLayout;
+        materialSet = state.textureTableSet;
+    }
 
-}
+    const VkPipeline pipeline = feedbackPass
+        ? m_feedbackPipeline
+        : findPipelineVariant(objectShaderVariant(mesh, materialIndex));
 
-void Renderer::initObject() {
-    createObjectVertexBuffer();
+    // Still compiling; the object appears once its pipeline is collected.
+    if (!pipeline) {
+        return;
+    }
 
-    createUniformBuffer();
+    // Objects sharing a material skip the redundant binds.
+    if (pipeline != state.pipeline) {
+        m_deviceFunctions->vkCmdBindPipeline(
+            commandBuffer,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            pipeline
+        );
+        state.pipeline = pipeline;
+    }
+
+    if (materialSet != state.materialSet) {
+        m_deviceFunctions->vkCmdBindDescriptorSets(
+            commandBuffer,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            pipelineLayout,
+            1,
+            1,
+            &materialSet,
+            0,
+            nullptr
+        );
+        state.materialSet = materialSet;
+    }
 
-    addTextureImage(DEFAULT_TEXTURE_PATH);
+    if (material->virtualTexture) {
+        VirtualTextureParams params = material->virtualTexture->params(feedbackPass);
+        m_deviceFunctions->vkCmdPushConstants(
+            commandBuffer,
+            pipelineLayout,
+            VK_SHADER_STAGE_FRAGMENT_BIT,
+            MATERIAL_PUSH_CONSTANT_OFFSET,
+            sizeof(params),
+            &params
+        );
+    } else if (material->atlasEntry >= 0) {
+        TextureAtlasParams params = m_textureAtlas.params(material->atlasEntry);
+        m_deviceFunctions->vkCmdPushConstants(
+            commandBuffer,
+            pipelineLayout,
+            VK_SHADER_STAGE_FRAGMENT_BIT,
+            MATERIAL_PUSH_CONSTANT_OFFSET,
+            sizeof(params),
+            &params
+        );
+    } else if (material->textureIndex >= 0) {
+        const uint32_t textureIndex = static_cast<uint32_t>(material->textureIndex);
+        m_deviceFunctions->vkCmdPushConstants(
+            commandBuffer,
+            pipelineLayout,
+            VK_SHADER_STAGE_FRAGMENT_BIT,
+            MATERIAL_PUSH_CONSTANT_OFFSET,
+            sizeof(textureIndex),
+            &textureIndex
+        );
+    }
+
+    drawMesh(commandBuffer, index, mesh, pipelineLayout);
 }
 
-void Renderer::drawObject()
+void Renderer::drawObjectDepth(VkCommandBuffer commandBuffer, int index, DrawState &state)
 {
-    if (!m_object) {
+    const Mesh *mesh = m_meshes.at(m_scene.meshes().at(index));
+    const int materialIndex = m_scene.materials().at(index);
+    if (!mesh->vertexBuffer || !isMaterialReady(m_materials.at(materialIndex))) {
         return;
     }
 
-    if (m_object->vertexBuffer == VK_NULL_HANDLE) {
-        initObject();
+    // Depth left by an object the main pass cannot shade yet would show up
+    // as a hole in whatever lies behind it.
+    if (!findPipelineVariant(objectShaderVariant(mesh, materialIndex))) {
+        return;
     }
 
-    updateUniformBuffer();
-
-    VkCommandBuffer commandBuffer = m_window->currentCommandBuffer();
+    if (m_depthPipeline != state.pipeline) {
+        m_deviceFunctions->vkCmdBindPipeline(
+            commandBuffer,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            m_depthPipeline
+        );
+        state.pipeline = m_depthPipeline;
+    }
 
-    m_deviceFunctions->vkCmdBindPipeline(
-        commandBuffer,
-        VK_PIPELINE_BIND_POINT_GRAPHICS,
-        m_graphicsPipeline
-    );
+    drawMesh(commandBuffer, index, mesh, m_depthPipelineLayout);
+}
 
-    m_deviceFunctions->vkCmdBindDescriptorSets(
+void Renderer::drawMesh(VkCommandBuffer commandBuffer,
+                        int index,
+                        const Mesh *mesh,
+                        VkPipelineLayout pipelineLayout) {
+    ObjectPushConstants object;
+    const QMatrix4x4 model = m_scene.transforms().at(index) * mesh->model->transformation;
+    memcpy(object.model, model.constData(), sizeof(object.model));
+    m_deviceFunctions->vkCmdPushConstants(
         commandBuffer,
-        VK_PIPELINE_BIND_POINT_GRAPHICS,
-        m_pipelineLayout,
-        0,
-        1,
-        &m_object->descriptorSet,
+        pipelineLayout,
+        VK_SHADER_STAGE_VERTEX_BIT,
         0,
-        nullptr
+        sizeof(object),
+        &object
     );
 
-    VkBuffer vertexBuffers[] = {m_object->vertexBuffer};
+    VkBuffer vertexBuffers[] = {mesh->vertexBuffer};
     VkDeviceSize offsets[] = {0};
     m_deviceFunctions->vkCmdBindVertexBuffers(
         commandBuffer,
@@ -159,104 +334,457 @@ void Renderer::drawObject()
 
     m_deviceFunctions->vkCmdDraw(
         commandBuffer,
-        static_cast<uint32_t>(m_object->model->vertices.size()),
+        static_cast<uint32_t>(mesh->model->vertices.size()),
         1,
         0,
         0
     );
+}
+
+ShaderVariant Renderer::objectShaderVariant(const Mesh *mesh, int materialIndex) const {
+    const Material *material = m_materials.at(materialIndex);
+    const Model *model = mesh->model.data();
+
+    ShaderVariant variant;
+    if (material->virtualTexture) {
+        variant.material = MaterialShader::VirtualTexture;
+    } else if (material->atlasEntry >= 0) {
+        variant.material = MaterialShader::Atlas;
+    } else if (material->textureIndex >= 0) {
+        variant.material = MaterialShader::Bindless;
+    }
 
+    // The shared default material only carries a white texture.
+    if (model->hasNormals)
+        variant.features |= ShaderLit;
+    if (model->hasTexCoords && materialIndex != m_defaultMaterial)
+        variant.features |= ShaderTextured;
+    if (model->hasVertexColors)
+        variant.features |= ShaderVertexColor;
+
+    variant.debugView = m_debugView;
+    variant.depthEqual = m_prepassActive;
+    return variant;
 }
 
-void Renderer::createTextureImageView() {
-    VkImageViewCreateInfo viewInfo = {};
-    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    viewInfo.pNext = nullptr;
-    viewInfo.flags = 0;
-    viewInfo.image = m_object->textureImage;
-    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    viewInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
-    viewInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-    viewInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-    viewInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-    viewInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = 1;
-    viewInfo.subresourceRange.baseArrayLayer = 0;
-    viewInfo.subresourceRange.layerCount = 1;
+// Called from the recording threads, so a miss is only flagged here and
+// resolved by requestPipelineVariants() on the next frame.
+VkPipeline Renderer::findPipelineVariant(const ShaderVariant &variant) {
+    const auto it = m_pipelineVariants.find(variant.key());
+    if (it == m_pipelineVariants.end()) {
+        m_missingPipelineVariants = true;
+        return VK_NULL_HANDLE;
+    }
+    return it->second;
+}
+
+void Renderer::requestPipelineVariants() {
+    if (!m_missingPipelineVariants.exchange(false)) {
+        return;
+    }
+
+    for (int index = 0; index < m_scene.size(); ++index) {
+        const Mesh *mesh = m_meshes.at(m_scene.meshes().at(index));
+        const ShaderVariant variant = objectShaderVariant(mesh, m_scene.materials().at(index));
+        if (m_pipelineVariants.count(variant.key())) {
+            continue;
+        }
+
+        GraphicsPipelineDescription description;
+        description.vertShader = &shaderVert;
+        description.renderPass = m_renderTarget.renderPass();
+        switch (variant.material) {
+        case MaterialShader::Descriptor:
+            description.fragShader = &shaderFrag;
+            description.layout = m_pipelineLayout;
+            break;
+        case MaterialShader::Bindless:
+            description.fragShader = &bindlessFrag;
+            description.layout = m_bindlessPipelineLayout;
+            description.addConstant(0, m_textureTable.capacity());
+            break;
+        case MaterialShader::Atlas:
+            description.fragShader = &atlasFrag;
+            description.layout = m_atlasPipelineLayout;
+            break;
+        case MaterialShader::VirtualTexture:
+            description.fragShader = &virtualtextureFrag;
+            description.layout = m_virtualTexturePipelineLayout;
+            break;
+        }
+        variant.specialize(description);
+
+        m_pipelineCompiler.compile(description, &m_pipelineVariants[variant.key()]);
+    }
+}
 
+void Renderer::releasePipelineVariants() {
     VkDevice device = m_window->device();
-    if (m_object->textureImageView) {
-        m_deviceFunctions->vkDestroyImageView(
-            device,
-            m_object->textureImageView,
-            nullptr
-        );
+    for (const auto &variant : m_pipelineVariants) {
+        m_deviceFunctions->vkDestroyPipeline(device, variant.second, nullptr);
+    }
+    m_pipelineVariants.clear();
+    m_missingPipelineVariants = false;
+}
+
+void Renderer::cycleDebugView() {
+    const quint32 count = quint32(ShaderDebugView::Count);
+    m_debugView = ShaderDebugView((quint32(m_debugView) + 1) % count);
+
+    m_commandRecorder.invalidate();
+    m_window->requestUpdate();
+}
+
+void Renderer::setDepthPrepass(bool enabled) {
+    if (m_depthPrepass == enabled) {
+        return;
     }
 
-    VkResult result = m_deviceFunctions->vkCreateImageView(
-        device,
-        &viewInfo,
-        nullptr,
-        &m_object->textureImageView
+    m_depthPrepass = enabled;
+    m_pipelineStatistics.resetAverages();
+    qCDebug(lcStats, "Depth prepass %s", enabled ? "enabled" : "disabled");
+
+    m_commandRecorder.invalidate();
+    m_window->requestUpdate();
+}
+
+void Renderer::drawInstances(VkCommandBuffer commandBuffer, int batchIndex)
+{
+    const InstanceBatch *batch = m_instanceBatches.at(batchIndex);
+    if (!batch || !batch->instanceBuffer || !m_instancePipeline) {
+        return;
+    }
+
+    const Mesh *mesh = m_meshes.at(batch->mesh);
+    if (!mesh->vertexBuffer) {
+        return;
+    }
+
+    m_deviceFunctions->vkCmdBindPipeline(
+        commandBuffer,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        m_instancePipeline
     );
-    if (result != VK_SUCCESS) {
-        qFatal("Failed to create texture image view: %d", result);
+
+    // Culled batches read this frame's compacted copy of the instances.
+    const bool culled = batch->culled.instanceBuffer != VK_NULL_HANDLE;
+    VkBuffer vertexBuffers[] = {
+        mesh->vertexBuffer,
+        culled ? batch->culled.instanceBuffer : batch->instanceBuffer
+    };
+    VkDeviceSize offsets[] = {0, culled ? m_gpuCuller.instanceOffset(batch->culled) : 0};
+    m_deviceFunctions->vkCmdBindVertexBuffers(
+        commandBuffer,
+        0,
+        2,
+        vertexBuffers,
+        offsets
+    );
+
+    if (culled) {
+        m_gpuCuller.draw(commandBuffer, batch->culled);
+        return;
     }
+
+    m_deviceFunctions->vkCmdDraw(
+        commandBuffer,
+        static_cast<uint32_t>(mesh->model->vertices.size()),
+        static_cast<uint32_t>(batch->instances.size()),
+        0,
+        0
+    );
 }
 
 void Renderer::createUniformBuffer() {
-    VkDeviceSize uniformBufferSize = sizeof(UniformBufferObject);
+    const VkDeviceSize alignment =
+        m_window->physicalDeviceProperties()->limits.minUniformBufferOffsetAlignment;
+    m_uniformStride = (sizeof(FrameUniformData) + alignment - 1) & ~(alignment - 1);
+
+    VkDeviceSize uniformBufferSize = m_uniformStride * m_window->concurrentFrameCount();
+    const VkMemoryPropertyFlags properties = m_memoryAllocator.hasDirectUpload()
+        ? MemoryAllocator::directUploadProperties()
+        : VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
     createBuffer(
         uniformBufferSize,
         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-        m_window->hostVisibleMemoryIndex(),
-        m_object->uniformBuffer,
-        m_object->uniformBufferMemory
+        properties,
+        m_uniformBuffer,
+        m_uniformBufferMemory,
+        MemoryUsage::Uniform,
+        "uniform ring"
     );
 }
 
-void Renderer::createObjectVertexBuffer() {
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    VkDeviceSize bufferSize = sizeof(m_object->model->vertices[0]) * m_object->model->vertices.size();
+void Renderer::releaseUniformBuffer() {
+    m_deviceFunctions->vkDestroyBuffer(m_window->device(), m_uniformBuffer, nullptr);
+    m_uniformBuffer = VK_NULL_HANDLE;
 
-    createBuffer(bufferSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        stagingBuffer,
-        stagingBufferMemory);
+    m_memoryAllocator.free(m_uniformBufferMemory);
+}
 
-    void* data;
-    VkDevice device = m_window->device();
-    m_deviceFunctions->vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, m_object->model->vertices.data(), (size_t) bufferSize);
-    m_deviceFunctions->vkUnmapMemory(device, stagingBufferMemory);
+uint32_t Renderer::frameUniformOffset() const {
+    return static_cast<uint32_t>(m_uniformStride * m_window->currentFrame());
+}
 
-    createBuffer(
-        bufferSize,
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        m_object->vertexBuffer,
-        m_object->vertexBufferMemory
-    );
+void Renderer::createFrameDescriptorSet() {
+    VkDescriptorPoolSize poolSize = {};
+    poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    poolSize.descriptorCount = 1;
 
-    copyBuffer(stagingBuffer, m_object->vertexBuffer, bufferSize);
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = 1;
 
-    m_deviceFunctions->vkDestroyBuffer(
+    VkDevice device = m_window->device();
+    VkResult result = m_deviceFunctions->vkCreateDescriptorPool(
         device,
-        stagingBuffer,
-        nullptr
+        &poolInfo,
+        nullptr,
+        &m_frameDescriptorPool
     );
-    m_deviceFunctions->vkFreeMemory(
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create frame descriptor pool: %d", result);
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = m_frameDescriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &m_frameDescriptorSetLayout;
+
+    result = m_deviceFunctions->vkAllocateDescriptorSets(
         device,
-        stagingBufferMemory,
-        nullptr
+        &allocInfo,
+        &m_frameDescriptorSet
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to allocate frame descriptor set: %d", result);
+    }
+
+    VkDescriptorBufferInfo bufferInfo = {};
+    bufferInfo.buffer = m_uniformBuffer;
+    bufferInfo.offset = 0;
+    bufferInfo.range = sizeof(FrameUniformData);
+
+    VkWriteDescriptorSet descriptorWrite = {};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = m_frameDescriptorSet;
+    descriptorWrite.dstBinding = 0;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pBufferInfo = &bufferInfo;
+
+    m_deviceFunctions->vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+
+    m_sceneUniformDirty = 0xff;
+}
+
+VkPipelineLayout Renderer::createPipelineLayout(VkDescriptorSetLayout materialSetLayout, const char *name) {
+    std::array<VkDescriptorSetLayout, 2> setLayouts = {
+        m_frameDescriptorSetLayout,
+        materialSetLayout
+    };
+
+    std::array<VkPushConstantRange, 2> pushConstantRanges = {};
+    pushConstantRanges[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstantRanges[0].offset = 0;
+    pushConstantRanges[0].size = sizeof(ObjectPushConstants);
+    pushConstantRanges[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    pushConstantRanges[1].offset = MATERIAL_PUSH_CONSTANT_OFFSET;
+    pushConstantRanges[1].size = MATERIAL_PUSH_CONSTANT_SIZE;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = materialSetLayout ? 2 : 1;
+    pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+    pipelineLayoutInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstantRanges.size());
+    pipelineLayoutInfo.pPushConstantRanges = pushConstantRanges.data();
+
+    VkPipelineLayout pipelineLayout;
+    VkResult result = m_deviceFunctions->vkCreatePipelineLayout(
+        m_window->device(),
+        &pipelineLayoutInfo,
+        nullptr,
+        &pipelineLayout
+    );
+    if (result != VK_SUCCESS)
+        qFatal("Failed to create %s pipeline layout: %d", name, result);
+
+    return pipelineLayout;
+}
+
+void Renderer::createMeshVertexBuffer(Mesh *mesh) {
+    const QVector<Vertex> &vertices = mesh->model->vertices;
+    createVertexBuffer(
+        vertices.constData(),
+        sizeof(vertices[0]) * vertices.size(),
+        mesh->vertexBuffer,
+        mesh->vertexBufferMemory,
+        mesh->model->name
+    );
+}
+
+void Renderer::uploadInstanceBatch(InstanceBatch *batch) {
+    releaseInstanceBatchResources(batch);
+
+    if (!batch->instances.isEmpty()) {
+        createVertexBuffer(
+            batch->instances.constData(),
+            sizeof(batch->instances[0]) * batch->instances.size(),
+            batch->instanceBuffer,
+            batch->instanceBufferMemory,
+            QString("%1 instances").arg(m_meshes.at(batch->mesh)->model->name),
+            m_gpuCuller.isCreated() ? VK_BUFFER_USAGE_STORAGE_BUFFER_BIT : 0
+        );
+
+        if (m_gpuCuller.isCreated()) {
+            const Model *model = m_meshes.at(batch->mesh)->model.data();
+            m_gpuCuller.create(
+                batch->culled,
+                batch->instances.size(),
+                static_cast<uint32_t>(model->vertices.size()),
+                model->name
+            );
+        }
+    }
+
+    batch->uploaded = true;
+}
+
+void Renderer::releaseInstanceBatchResources(InstanceBatch *batch) {
+    m_commandRecorder.invalidate();
+
+    if (batch->instanceBuffer) {
+        m_memoryDefragmenter.remove(&batch->instanceBufferMemory);
+        m_deletionQueue.destroyBuffer(batch->instanceBuffer, batch->instanceBufferMemory);
+        batch->instanceBuffer = VK_NULL_HANDLE;
+    }
+    if (batch->culled.drawBuffer) {
+        m_gpuCuller.destroy(batch->culled);
+    }
+    batch->uploaded = false;
+}
+
+void Renderer::createVertexBuffer(const void *data,
+                                  VkDeviceSize bufferSize,
+                                  VkBuffer &buffer,
+                                  MemoryAllocation &bufferMemory,
+                                  const QString &name,
+                                  VkBufferUsageFlags extraUsage) {
+    m_commandRecorder.invalidate();
+
+    if (m_vertexUploadCount == 0) {
+        m_vertexUploadTimer.start();
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+        | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+        | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+        | extraUsage;
+
+    // Storage vertex buffers are also read by the culling shader. The
+    // defragmenter may copy the buffer in any later frame, so transfer
+    // reads have to see the upload (or a previous move) as well.
+    VkAccessFlags dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT
+        | VK_ACCESS_TRANSFER_READ_BIT;
+    VkPipelineStageFlags dstStageMask = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT
+        | VK_PIPELINE_STAGE_TRANSFER_BIT;
+    if (extraUsage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) {
+        dstAccessMask |= VK_ACCESS_SHADER_READ_BIT;
+        dstStageMask |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    }
+
+    if (m_memoryAllocator.hasDirectUpload()) {
+        createBuffer(
+            bufferSize,
+            usage,
+            MemoryAllocator::directUploadProperties(),
+            buffer,
+            bufferMemory,
+            MemoryUsage::Vertex,
+            name
+        );
+
+        memcpy(bufferMemory.mapped, data, (size_t) bufferSize);
+    } else {
+        VkBuffer stagingBuffer;
+        MemoryAllocation stagingBufferMemory;
+
+        createBuffer(bufferSize,
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            stagingBuffer,
+            stagingBufferMemory,
+            MemoryUsage::Staging,
+            name);
+
+        memcpy(stagingBufferMemory.mapped, data, (size_t) bufferSize);
+
+        createBuffer(
+            bufferSize,
+            usage,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            buffer,
+            bufferMemory,
+            MemoryUsage::Vertex,
+            name
+        );
+
+        copyBuffer(stagingBuffer, buffer, bufferSize, dstAccessMask, dstStageMask);
+
+        m_uploadBatch.retainStagingBuffer(stagingBuffer, stagingBufferMemory);
+    }
+
+    m_memoryDefragmenter.addBuffer(
+        &buffer,
+        &bufferMemory,
+        bufferSize,
+        usage,
+        dstAccessMask,
+        dstStageMask,
+        MemoryUsage::Vertex,
+        name
     );
+
+    ++m_vertexUploadCount;
+    m_vertexUploadBytes += bufferSize;
+    m_vertexUploadCpuTime += timer.nsecsElapsed();
+}
+
+// Compares the direct and staging paths end to end: the CPU time covers
+// the copies, command recording and the batch submit, and the completion
+// time runs until the upload fences have signalled. Fences are polled once
+// per frame, so the completion time is frame-granular.
+void Renderer::reportVertexUploads() {
+    if (m_vertexUploadCount == 0
+        || m_uploadBatch.isRecording()
+        || m_uploadBatch.submissionsInFlight() > 0) {
+        return;
+    }
+
+    qCDebug(lcStats, "Uploaded %d vertex buffers (%lld bytes) %s: %.2f ms on the CPU, complete after %.2f ms",
+            m_vertexUploadCount,
+            static_cast<long long>(m_vertexUploadBytes),
+            m_memoryAllocator.hasDirectUpload() ? "directly" : "through staging",
+            m_vertexUploadCpuTime / 1000000.0,
+            m_vertexUploadTimer.nsecsElapsed() / 1000000.0);
+
+    m_vertexUploadCount = 0;
+    m_vertexUploadBytes = 0;
+    m_vertexUploadCpuTime = 0;
 }
 
-void Renderer::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+void Renderer::copyBuffer(VkBuffer srcBuffer,
+                          VkBuffer dstBuffer,
+                          VkDeviceSize size,
+                          VkAccessFlags dstAccessMask,
+                          VkPipelineStageFlags dstStageMask) {
+    VkCommandBuffer commandBuffer = m_uploadBatch.commandBuffer();
 
     VkBufferCopy copyRegion = {};
     copyRegion.srcOffset = 0;
@@ -264,7 +792,7 @@ void Renderer::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize s
     copyRegion.size = size;
     m_deviceFunctions->vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
 
-    endSingleTimeCommands(commandBuffer);
+    m_uploadBatch.releaseBufferToGraphics(dstBuffer, size, dstAccessMask, dstStageMask);
 }
 
 void Renderer::createDescriptorSetLayout() {
@@ -277,20 +805,16 @@ void Renderer::createDescriptorSetLayout() {
     samplerLayoutBinding.pImmutableSamplers = nullptr;
 
     VkDescriptorSetLayoutBinding uboLayoutBinding = {};
-    uboLayoutBinding.binding = 1;
-    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    uboLayoutBinding.binding = 0;
+    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     uboLayoutBinding.descriptorCount = 1;
     uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
     uboLayoutBinding.pImmutableSamplers = nullptr;
 
-    std::array<VkDescriptorSetLayoutBinding, 2> bindings =
-        {samplerLayoutBinding, uboLayoutBinding};
-
     VkDescriptorSetLayoutCreateInfo layoutInfo = {};
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layoutInfo.bindingCount =
-        static_cast<uint32_t>(bindings.size());
-    layoutInfo.pBindings = bindings.data();
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &samplerLayoutBinding;
 
     VkDevice device = m_window->device();
     VkResult result = m_deviceFunctions->vkCreateDescriptorSetLayout(
@@ -302,49 +826,53 @@ void Renderer::createDescriptorSetLayout() {
     if (result != VK_SUCCESS) {
         qFatal("Failed to create descriptor set layout: %d", result);
     }
+
+    layoutInfo.pBindings = &uboLayoutBinding;
+
+    result = m_deviceFunctions->vkCreateDescriptorSetLayout(
+        device,
+        &layoutInfo,
+        nullptr,
+        &m_frameDescriptorSetLayout
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create frame descriptor set layout: %d", result);
+    }
 }
 
-void Renderer::createDescriptorPool() {
-    std::array<VkDescriptorPoolSize, 2> poolSizes = {};
-    poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[0].descriptorCount = 1;
-    poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[1].descriptorCount = 1;
+void Renderer::createDescriptorPool(Material *material) {
+    VkDescriptorPoolSize poolSize = {};
+    poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSize.descriptorCount = 1;
 
     VkDescriptorPoolCreateInfo poolInfo = {};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolInfo.poolSizeCount =
-        static_cast<uint32_t>(poolSizes.size());
-    poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = 1;
 
     VkDevice device = m_window->device();
 
-    if (m_object->descriptorPool) {
-        m_deviceFunctions->vkDestroyDescriptorPool(
-            device,
-            m_object->descriptorPool,
-            nullptr
-        );
-        m_object->descriptorPool = VK_NULL_HANDLE;
-    }
+    releaseMaterialDescriptorSet(material);
 
     VkResult result = m_deviceFunctions->vkCreateDescriptorPool(
         device,
         &poolInfo,
         nullptr,
-        &m_object->descriptorPool
+        &material->descriptorPool
     );
     if (result != VK_SUCCESS) {
         qFatal("Failed to create descriptor pool: %d", result);
     }
 }
 
-void Renderer::createDescriptorSets() {
+void Renderer::createDescriptorSets(Material *material) {
+    m_commandRecorder.invalidate();
+
     VkDescriptorSetAllocateInfo allocInfo = {};
     allocInfo.sType =
         VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    allocInfo.descriptorPool = m_object->descriptorPool;
+    allocInfo.descriptorPool = material->descriptorPool;
     allocInfo.descriptorSetCount = 1;
     allocInfo.pSetLayouts = &m_descriptorSetLayout;
 
@@ -352,7 +880,7 @@ void Renderer::createDescriptorSets() {
     VkResult result = m_deviceFunctions->vkAllocateDescriptorSets(
         device,
         &allocInfo,
-        &m_object->descriptorSet
+        &material->descriptorSet
     );
     if (result != VK_SUCCESS) {
         qFatal("Failed to allocate descriptor sets: %d", result);
@@ -360,81 +888,41 @@ void Renderer::createDescriptorSets() {
 
     VkDescriptorImageInfo descriptorImageInfo = {};
     descriptorImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    descriptorImageInfo.imageView = m_object->textureImageView;
+    descriptorImageInfo.imageView = material->texture ? material->texture->imageView() : VK_NULL_HANDLE;
     descriptorImageInfo.sampler = m_textureSampler;
 
-    VkDescriptorBufferInfo bufferInfo = {};
-    bufferInfo.buffer = m_object->uniformBuffer;
-    bufferInfo.offset = 0;
-    bufferInfo.range = sizeof(UniformBufferObject);
-
-    std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
-
-    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[0].dstSet = m_object->descriptorSet;
-    descriptorWrites[0].dstBinding = 0;
-    descriptorWrites[0].dstArrayElement = 0;
-    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    descriptorWrites[0].descriptorCount = 1;
-    descriptorWrites[0].pImageInfo = &descriptorImageInfo;
-
-    descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[1].dstSet = m_object->descriptorSet;
-    descriptorWrites[1].dstBinding = 1;
-    descriptorWrites[1].dstArrayElement = 0;
-    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    descriptorWrites[1].descriptorCount = 1;
-    descriptorWrites[1].pBufferInfo = &bufferInfo;
+    VkWriteDescriptorSet descriptorWrite = {};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = material->descriptorSet;
+    descriptorWrite.dstBinding = 0;
+    descriptorWrite.dstArrayElement = 0;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pImageInfo = &descriptorImageInfo;
 
     m_deviceFunctions->vkUpdateDescriptorSets(
         device,
-        descriptorWrites.size(),
-        descriptorWrites.data(),
+        1,
+        &descriptorWrite,
         0,
         nullptr
     );
 }
 
-VkCommandBuffer Renderer::beginSingleTimeCommands() {
-    VkCommandBufferAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = m_window->graphicsCommandPool();
-    allocInfo.commandBufferCount = 1;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-
-    VkCommandBuffer commandBuffer;
-    VkDevice device = m_window->device();
-    m_deviceFunctions->vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
-
-    VkCommandBufferBeginInfo beginInfo = {};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-    beginInfo.pInheritanceInfo = nullptr;
-
-    m_deviceFunctions->vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-    return commandBuffer;
-}
-
-void Renderer::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-    m_deviceFunctions->vkEndCommandBuffer(commandBuffer);
-
-    VkSubmitInfo submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-
-    VkQueue graphicsQueue = m_window->graphicsQueue();
-    m_deviceFunctions->vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    m_deviceFunctions->vkQueueWaitIdle(graphicsQueue);
-
-    VkDevice device = m_window->device();
-    VkCommandPool commandPool = m_window->graphicsCommandPool();
-    m_deviceFunctions->vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-}
-
 void Renderer::transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout) {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+        && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+        m_uploadBatch.releaseImageToGraphics(
+            image,
+            oldLayout,
+            newLayout,
+            VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+        );
+        return;
+    }
+
+    VkCommandBuffer commandBuffer = m_uploadBatch.commandBuffer();
 
     VkImageMemoryBarrier barrier = {};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -460,14 +948,6 @@ void Renderer::transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkI
         sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
         destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
     }
-    else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
-        && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-        sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-    }
     else {
         qFatal("Unsupported layout transition!");
     }
@@ -484,12 +964,10 @@ void Renderer::transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkI
         1,
         &barrier
     );
-
-    endSingleTimeCommands(commandBuffer);
 }
 
 void Renderer::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    VkCommandBuffer commandBuffer = m_uploadBatch.commandBuffer();
 
     VkBufferImageCopy region = {};
     region.bufferOffset = 0;
@@ -514,8 +992,6 @@ void Renderer::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width,
         1,
         &region
     );
-
-    endSingleTimeCommands(commandBuffer);
 }
 
 void Renderer::createTextureSampler() {
@@ -528,7 +1004,7 @@ void Renderer::createTextureSampler() {
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     samplerInfo.mipLodBias = 0.0f;
     samplerInfo.minLod = 0.0f;
-    samplerInfo.maxLod = 0.0f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
     samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
     samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
     samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
@@ -552,159 +1028,670 @@ void Renderer::createTextureSampler() {
 }
 
 void Renderer::addTextureImage(QString texturePath) {
+    setObjectTexture(m_selectedObject, texturePath);
+}
+
+void Renderer::setObjectTexture(ObjectHandle handle, const QString &texturePath) {
+    const int index = m_scene.indexOf(handle);
+    if (index < 0) {
+        return;
+    }
+
+    int material = m_scene.materials()[index];
+    if (material == m_defaultMaterial) {
+        const int defaultMaterial = material;
+        material = createMaterial();
+        ++m_materials[material]->users;
+        m_scene.setMaterial(handle, material);
+        releaseMaterial(defaultMaterial);
+        m_commandRecorder.invalidate();
+    }
+
+    addTextureImage(m_materials[material], texturePath);
+}
+
+void Renderer::addTextureImage(Material *material, const QString &texturePath) {
+    m_window->requestUpdate();
+
+    QImageReader reader(texturePath);
+    const QSize imageSize = reader.size();
+    const int maxImageDimension = qMin(
+        VIRTUAL_TEXTURE_THRESHOLD,
+        int(m_window->physicalDeviceProperties()->limits.maxImageDimension2D)
+    );
+    if (imageSize.width() > maxImageDimension || imageSize.height() > maxImageDimension) {
+        addVirtualTexture(material, texturePath);
+        return;
+    }
+
+    releaseVirtualTexture(material);
+
+    if (m_textureAtlas.isCreated()) {
+        const QString key = TextureAtlasBuilder::keyForPath(texturePath);
+        int atlasEntry = m_textureAtlas.findTexture(key);
+        if (atlasEntry < 0 && TextureAtlasBuilder::fits(imageSize)) {
+            atlasEntry = m_textureAtlas.addTexture(key, QImage(texturePath));
+        }
+
+        if (atlasEntry >= 0) {
+            releaseTextureImage(material);
+            releaseMaterialDescriptorSet(material);
+            material->atlasEntry = atlasEntry;
+            m_commandRecorder.invalidate();
+            return;
+        }
+    }
+
+    material->atlasEntry = -1;
+
     QImage image(texturePath);
 
     if (image.isNull()) {
         qFatal("Failed to load texture image!");
     }
 
-    image = image.convertToFormat(QImage::Format_RGBA8888);
-    VkDeviceSize imageSize = image.sizeInBytes();
+    const bool streamable = m_textureStreaming
+        && (material->textureIndex >= 0 || !m_textureTable.isFull());
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    createBuffer(
-        imageSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
-            | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        stagingBuffer,
-        stagingBufferMemory
+    StreamedTexture *previousTexture = material->texture;
+    material->texture = m_textureStreamer.createTexture(
+        image,
+        streamable,
+        QFileInfo(texturePath).fileName()
     );
+    if (previousTexture) {
+        m_textureStreamer.destroyTexture(previousTexture);
+    }
+
+    if (m_bindless) {
+        if (material->textureIndex < 0) {
+            material->textureIndex = m_textureTable.addTexture(material->texture->imageView());
+        } else {
+            m_textureTable.setTexture(material->textureIndex, material->texture->imageView());
+        }
+    }
+
+    if (material->textureIndex >= 0) {
+        releaseMaterialDescriptorSet(material);
+        m_commandRecorder.invalidate();
+        return;
+    }
+
+    createDescriptorPool(material);
+    createDescriptorSets(material);
+}
+
+void Renderer::addVirtualTexture(Material *material, const QString &texturePath) {
+    const QString pageDirectory = VirtualTextureBuilder::pageDirectory(texturePath);
+
+    VirtualTextureInfo info;
+    if (!VirtualTextureBuilder::readInfo(pageDirectory, info)) {
+        QElapsedTimer timer;
+        timer.start();
+
+        if (!VirtualTextureBuilder::build(texturePath, pageDirectory)) {
+            qWarning("Failed to build virtual texture pages for %s", texturePath.toStdString().c_str());
+            return;
+        }
+
+        qCDebug(lcStats, "Built virtual texture pages in %lld ms", static_cast<long long>(timer.elapsed()));
+    }
+
+    QSharedPointer<VirtualTexture> virtualTexture =
+        QSharedPointer<VirtualTexture>::create(this, m_window, m_deviceFunctions);
+    if (!virtualTexture->open(pageDirectory)) {
+        qWarning("Failed to open virtual texture pages in %s", pageDirectory.toStdString().c_str());
+        return;
+    }
+
+    releaseVirtualTexture(material);
+    releaseTextureImage(material);
+
+    virtualTexture->create(m_virtualTextureBudget);
+    virtualTexture->createFeedbackTarget(m_window->swapChainImageSize());
+
+    if (!m_virtualTexturePipelineLayout) {
+        initVirtualTexturePipelines(virtualTexture->feedbackRenderPass());
+        m_feedbackPassOwner = virtualTexture;
+    }
+
+    material->virtualTexture = virtualTexture;
+    createVirtualTextureDescriptorSet(material);
+}
+
+void Renderer::releaseVirtualTexture(Material *material) {
+    if (!material->virtualTexture) {
+        return;
+    }
+
+    QSharedPointer<VirtualTexture> virtualTexture = material->virtualTexture;
+    m_deletionQueue.destroyLater([this, virtualTexture]() {
+        if (virtualTexture == m_feedbackPassOwner) {
+            m_feedbackPassOwnerRetired = true;
+            return;
+        }
+        virtualTexture->release();
+    });
+    material->virtualTexture.reset();
+}
+
+void Renderer::releaseFeedbackPassOwner() {
+    if (m_feedbackPassOwnerRetired) {
+        m_feedbackPassOwner->release();
+    }
+    m_feedbackPassOwner.reset();
+    m_feedbackPassOwnerRetired = false;
+}
+
+void Renderer::initVirtualTexturePipelines(VkRenderPass feedbackRenderPass) {
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[0].descriptorCount = 1;
+    bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[1].descriptorCount = 1;
+    bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
 
-    void *data;
     VkDevice device = m_window->device();
-    m_deviceFunctions->vkMapMemory(
+    VkResult result = m_deviceFunctions->vkCreateDescriptorSetLayout(
         device,
-        stagingBufferMemory,
-        0,
-        imageSize,
-        0,
-        &data
-    );
-    memcpy(data, image.constBits(), static_cast<size_t>(imageSize));
-    m_deviceFunctions->vkUnmapMemory(device, stagingBufferMemory);
-
-    VkImageCreateInfo imageInfo = {};
-    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-    imageInfo.pNext = nullptr;
-    imageInfo.flags = 0;
-    imageInfo.imageType = VK_IMAGE_TYPE_2D;
-    imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
-    imageInfo.extent.width = image.width();
-    imageInfo.extent.height = image.height();
-    imageInfo.extent.depth = 1;
-    imageInfo.mipLevels = 1;
-    imageInfo.arrayLayers = 1;
-    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    imageInfo.queueFamilyIndexCount = 0;
-    imageInfo.pQueueFamilyIndices = nullptr;
-    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-
-    if (m_object->textureImage) {
-       m_deviceFunctions->vkDestroyImage(device, m_object->textureImage, nullptr);
-        m_object->textureImage = VK_NULL_HANDLE;
-    }
-
-    VkResult result = m_deviceFunctions->vkCreateImage(device, &imageInfo, nullptr, &m_object->textureImage);
+        &layoutInfo,
+        nullptr,
+        &m_virtualTextureDescriptorSetLayout
+    );
     if (result != VK_SUCCESS) {
-       qFatal("Failed to create image: %d", result);
+        qFatal("Failed to create virtual texture descriptor set layout: %d", result);
     }
 
-    VkMemoryRequirements memRequirements;
-    m_deviceFunctions->vkGetImageMemoryRequirements(
-        device,
-        m_object->textureImage,
-        &memRequirements
-    );
+    m_virtualTexturePipelineLayout = createPipelineLayout(m_virtualTextureDescriptorSetLayout, "virtual texture");
+
+    GraphicsPipelineDescription description;
+    description.vertShader = &shaderVert;
+    description.fragShader = &feedbackFrag;
+    description.layout = m_virtualTexturePipelineLayout;
+    description.renderPass = feedbackRenderPass;
+    // Feedback only needs texture coordinates, so skip the lighting inputs.
+    ShaderVariant feedbackVariant;
+    feedbackVariant.specialize(description);
+    m_pipelineCompiler.compile(description, &m_feedbackPipeline);
+}
 
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(
-        memRequirements.memoryTypeBits,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-    );
+void Renderer::createVirtualTextureDescriptorSet(Material *material) {
+    VkDevice device = m_window->device();
 
-    if (m_object->textureImageMemory != VK_NULL_HANDLE) {
-        m_deviceFunctions->vkFreeMemory(
-            device,
-            m_object->textureImageMemory,
-            nullptr
-        );
-        m_object->textureImageMemory = VK_NULL_HANDLE;
-    }
+    releaseMaterialDescriptorSet(material);
 
-    result = m_deviceFunctions->vkAllocateMemory(
+    VkDescriptorPoolSize poolSize = {};
+    poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSize.descriptorCount = 2;
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = 1;
+
+    VkResult result = m_deviceFunctions->vkCreateDescriptorPool(
         device,
-        &allocInfo,
+        &poolInfo,
         nullptr,
-        &m_object->textureImageMemory
+        &material->descriptorPool
     );
     if (result != VK_SUCCESS) {
-        qFatal("Failed to allocate image memory: %d", result);
+        qFatal("Failed to create virtual texture descriptor pool: %d", result);
     }
 
-    m_deviceFunctions->vkBindImageMemory(
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = material->descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &m_virtualTextureDescriptorSetLayout;
+
+    result = m_deviceFunctions->vkAllocateDescriptorSets(
         device,
-        m_object->textureImage,
-        m_object->textureImageMemory,
-        0
+        &allocInfo,
+        &material->descriptorSet
     );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to allocate virtual texture descriptor set: %d", result);
+    }
+
+    const VirtualTexture *virtualTexture = material->virtualTexture.data();
+
+    VkDescriptorImageInfo physicalCacheInfo = {};
+    physicalCacheInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    physicalCacheInfo.imageView = virtualTexture->physicalCacheView();
+    physicalCacheInfo.sampler = virtualTexture->physicalCacheSampler();
+
+    VkDescriptorImageInfo indirectionInfo = {};
+    indirectionInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    indirectionInfo.imageView = virtualTexture->indirectionView();
+    indirectionInfo.sampler = virtualTexture->indirectionSampler();
+
+    std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+
+    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[0].dstSet = material->descriptorSet;
+    descriptorWrites[0].dstBinding = 0;
+    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrites[0].descriptorCount = 1;
+    descriptorWrites[0].pImageInfo = &physicalCacheInfo;
+
+    descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[1].dstSet = material->descriptorSet;
+    descriptorWrites[1].dstBinding = 1;
+    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrites[1].descriptorCount = 1;
+    descriptorWrites[1].pImageInfo = &indirectionInfo;
 
-    transitionImageLayout(
-        m_object->textureImage,
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+    m_deviceFunctions->vkUpdateDescriptorSets(
+        device,
+        static_cast<uint32_t>(descriptorWrites.size()),
+        descriptorWrites.data(),
+        0,
+        nullptr
     );
+}
+
+void Renderer::initBindless() {
+    if (!isFeatureEnabled(Feature::Bindless)) {
+        return;
+    }
 
-    copyBufferToImage(
-        stagingBuffer, m_object->textureImage,
-        static_cast<uint32_t>(image.width()),
-        static_cast<uint32_t>(image.height())
+    VkPhysicalDeviceFeatures features;
+    m_window->vulkanInstance()->functions()->vkGetPhysicalDeviceFeatures(
+        m_window->physicalDevice(),
+        &features
     );
+    if (!features.shaderSampledImageArrayDynamicIndexing) {
+        return;
+    }
 
-    transitionImageLayout(
-        m_object->textureImage,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    QImage defaultImage(1, 1, QImage::Format_RGBA8888);
+    defaultImage.fill(Qt::white);
+    m_defaultTexture = m_textureStreamer.createTexture(defaultImage, false, "default texture");
+
+    m_textureTable.create(
+        m_window,
+        m_deviceFunctions,
+        m_textureSampler,
+        m_defaultTexture->imageView(),
+        m_window->descriptorIndexingEnabled()
     );
 
-    m_deviceFunctions->vkDestroyBuffer(
-        device, stagingBuffer,
-        nullptr
+    m_bindlessPipelineLayout = createPipelineLayout(m_textureTable.descriptorSetLayout(), "bindless");
+
+    const uint32_t textureCount = m_textureTable.capacity();
+
+    m_bindless = true;
+    m_textureStreaming = isFeatureEnabled(Feature::TextureStreaming);
+
+    qCDebug(
+        lcStats,
+        "Bindless texture table: %u slots%s",
+        textureCount,
+        m_textureTable.isPartiallyBound() ? " (partially bound)" : ""
     );
-    m_deviceFunctions->vkFreeMemory(
-        device,
-        stagingBufferMemory,
-        nullptr
+}
+
+void Renderer::releaseBindless() {
+    if (!m_bindless) {
+        return;
+    }
+
+    VkDevice device = m_window->device();
+
+    m_deviceFunctions->vkDestroyPipelineLayout(device, m_bindlessPipelineLayout, nullptr);
+    m_bindlessPipelineLayout = VK_NULL_HANDLE;
+
+    m_textureTable.release();
+
+    m_textureStreamer.destroyTexture(m_defaultTexture);
+    m_defaultTexture = nullptr;
+
+    m_bindless = false;
+    m_textureStreaming = false;
+}
+
+void Renderer::initTextureAtlas() {
+    if (!isFeatureEnabled(Feature::Atlas)) {
+        return;
+    }
+
+    m_textureAtlas.create(this, m_window, m_deviceFunctions, &m_uploadBatch);
+
+    const QString atlasDirectory = m_window->textureAtlasDirectory();
+    if (!atlasDirectory.isEmpty()) {
+        if (!m_textureAtlas.load(atlasDirectory)) {
+            qWarning("Failed to load texture atlas from %s", atlasDirectory.toStdString().c_str());
+        }
+    }
+
+    m_atlasPipelineLayout = createPipelineLayout(m_textureAtlas.descriptorSetLayout(), "texture atlas");
+}
+
+void Renderer::releaseTextureAtlas() {
+    if (!m_textureAtlas.isCreated()) {
+        return;
+    }
+
+    VkDevice device = m_window->device();
+
+    m_deviceFunctions->vkDestroyPipelineLayout(device, m_atlasPipelineLayout, nullptr);
+    m_atlasPipelineLayout = VK_NULL_HANDLE;
+
+    m_textureAtlas.release();
+}
+
+void Renderer::initInstancing() {
+    m_instancePipelineLayout = createPipelineLayout(VK_NULL_HANDLE, "instance");
+
+    GraphicsPipelineDescription description;
+    description.vertShader = &instancedVert;
+    description.fragShader = &instancedFrag;
+    description.layout = m_instancePipelineLayout;
+    description.renderPass = m_renderTarget.renderPass();
+    description.instanced = true;
+    m_pipelineCompiler.compile(description, &m_instancePipeline);
+}
+
+void Renderer::releaseInstancing() {
+    VkDevice device = m_window->device();
+
+    m_deviceFunctions->vkDestroyPipeline(device, m_instancePipeline, nullptr);
+    m_deviceFunctions->vkDestroyPipelineLayout(device, m_instancePipelineLayout, nullptr);
+    m_instancePipeline = VK_NULL_HANDLE;
+    m_instancePipelineLayout = VK_NULL_HANDLE;
+}
+
+// Compiled up front even when the prepass starts disabled, so toggling it
+// at runtime only swaps the material variants.
+void Renderer::initDepthPrepass() {
+    m_depthPrepass = m_window->depthPrepass();
+    m_depthPipelineLayout = createPipelineLayout(VK_NULL_HANDLE, "depth prepass");
+
+    GraphicsPipelineDescription description;
+    description.vertShader = &depthVert;
+    description.layout = m_depthPipelineLayout;
+    description.renderPass = m_renderTarget.renderPass();
+    m_pipelineCompiler.compile(description, &m_depthPipeline);
+}
+
+void Renderer::releaseDepthPrepass() {
+    VkDevice device = m_window->device();
+
+    m_deviceFunctions->vkDestroyPipeline(device, m_depthPipeline, nullptr);
+    m_deviceFunctions->vkDestroyPipelineLayout(device, m_depthPipelineLayout, nullptr);
+    m_depthPipeline = VK_NULL_HANDLE;
+    m_depthPipelineLayout = VK_NULL_HANDLE;
+}
+
+ObjectHandle Renderer::addObject(QSharedPointer<Model> model, const QMatrix4x4 &transform) {
+    if (!model->isValid()) {
+        return ObjectHandle();
+    }
+
+    const int mesh = acquireMesh(model);
+    const int material = acquireDefaultMaterial();
+    m_selectedObject = m_scene.add(mesh, material, transform, objectBounds(transform, m_meshes[mesh]));
+
+    m_commandRecorder.invalidate();
+    m_window->requestUpdate();
+
+    return m_selectedObject;
+}
+
+void Renderer::removeObject(ObjectHandle handle) {
+    const int index = m_scene.indexOf(handle);
+    if (index < 0) {
+        return;
+    }
+
+    const int mesh = m_scene.meshes()[index];
+    const int material = m_scene.materials()[index];
+    m_scene.remove(handle);
+
+    releaseMesh(mesh);
+    releaseMaterial(material);
+
+    m_commandRecorder.invalidate();
+    m_window->requestUpdate();
+}
+
+void Renderer::setObjectTransform(ObjectHandle handle, const QMatrix4x4 &transform) {
+    const int index = m_scene.indexOf(handle);
+    if (index < 0) {
+        return;
+    }
+
+    const Mesh *mesh = m_meshes[m_scene.meshes()[index]];
+    m_scene.setTransform(handle, transform, objectBounds(transform, mesh));
+
+    // The model matrix is recorded as a push constant.
+    m_commandRecorder.invalidate();
+    m_window->requestUpdate();
+}
+
+int Renderer::addInstances(QSharedPointer<Model> model, const QVector<MeshInstance> &instances) {
+    if (!model->isValid()) {
+        return -1;
+    }
+
+    InstanceBatch *batch = new InstanceBatch;
+    batch->mesh = acquireMesh(model);
+
+    int index = m_instanceBatches.indexOf(nullptr);
+    if (index < 0) {
+        index = m_instanceBatches.size();
+        m_instanceBatches.append(batch);
+    } else {
+        m_instanceBatches[index] = batch;
+    }
+
+    setInstances(index, instances);
+
+    return index;
+}
+
+void Renderer::setInstances(int index, const QVector<MeshInstance> &instances) {
+    InstanceBatch *batch = m_instanceBatches.value(index);
+    if (!batch) {
+        return;
+    }
+
+    const QMatrix4x4 &meshTransformation = m_meshes[batch->mesh]->model->transformation;
+
+    batch->instances.resize(instances.size());
+    for (int i = 0; i < instances.size(); ++i) {
+        InstanceData &data = batch->instances[i];
+        const QMatrix4x4 model = instances[i].transform * meshTransformation;
+        memcpy(data.model, model.constData(), sizeof(data.model));
+        data.tint[0] = instances[i].tint.x();
+        data.tint[1] = instances[i].tint.y();
+        data.tint[2] = instances[i].tint.z();
+        data.tint[3] = instances[i].tint.w();
+    }
+
+    batch->uploaded = false;
+    m_window->requestUpdate();
+}
+
+void Renderer::removeInstances(int index) {
+    InstanceBatch *batch = m_instanceBatches.value(index);
+    if (!batch) {
+        return;
+    }
+
+    releaseInstanceBatchResources(batch);
+    releaseMesh(batch->mesh);
+    delete batch;
+    m_instanceBatches[index] = nullptr;
+
+    m_window->requestUpdate();
+}
+
+int Renderer::instanceCount() const {
+    int count = 0;
+    for (const InstanceBatch *batch : m_instanceBatches) {
+        if (batch)
+            count += batch->instances.size();
+    }
+    return count;
+}
+
+QVector4D Renderer::objectBounds(const QMatrix4x4 &transform, const Mesh *mesh) const {
+    const QMatrix4x4 model = transform * mesh->model->transformation;
+    const float scale = qMax(
+        model.column(0).toVector3D().length(),
+        qMax(model.column(1).toVector3D().length(), model.column(2).toVector3D().length())
     );
 
-    createTextureImageView();
-    createDescriptorPool();
-    createDescriptorSets();
+    return QVector4D(model.map(mesh->model->boundingCenter), mesh->model->boundingRadius * scale);
+}
+
+int Renderer::acquireMesh(QSharedPointer<Model> model) {
+    int freeIndex = -1;
+    for (int index = 0; index < m_meshes.size(); ++index) {
+        Mesh *mesh = m_meshes[index];
+        if (!mesh) {
+            if (freeIndex < 0)
+                freeIndex = index;
+        } else if (mesh->model == model) {
+            ++mesh->users;
+            return index;
+        }
+    }
+
+    Mesh *mesh = new Mesh;
+    mesh->model = model;
+    mesh->users = 1;
+
+    if (freeIndex < 0) {
+        freeIndex = m_meshes.size();
+        m_meshes.append(mesh);
+    } else {
+        m_meshes[freeIndex] = mesh;
+    }
+
+    return freeIndex;
+}
+
+void Renderer::releaseMesh(int index) {
+    Mesh *mesh = m_meshes[index];
+    if (--mesh->users > 0) {
+        return;
+    }
+
+    releaseMeshResources(mesh);
+    delete mesh;
+    m_meshes[index] = nullptr;
 }
 
-void Renderer::addObject(QSharedPointer<Model> model) {
-    if (model->isValid()) {
-        if (m_object)
-            releaseObjectResources();
+int Renderer::createMaterial() {
+    const int freeIndex = m_materials.indexOf(nullptr);
+    if (freeIndex < 0) {
+        m_materials.append(new Material);
+        return m_materials.size() - 1;
+    }
 
-        m_object = new Object3D(model);
+    m_materials[freeIndex] = new Material;
+    return freeIndex;
+}
 
-        m_window->requestUpdate();
+int Renderer::acquireDefaultMaterial() {
+    // Untextured objects share one material, so adding thousands of them
+    // does not load the default texture thousands of times.
+    if (m_defaultMaterial < 0) {
+        m_defaultMaterial = createMaterial();
+    }
+
+    ++m_materials[m_defaultMaterial]->users;
+    return m_defaultMaterial;
+}
+
+bool Renderer::isMaterialReady(const Material *material) const {
+    // Bindless and atlas textures live in shared sets, so only the other
+    // materials own a descriptor set.
+    return material->descriptorSet || material->textureIndex >= 0 || material->atlasEntry >= 0;
+}
+
+void Renderer::releaseMaterial(int index) {
+    Material *material = m_materials[index];
+    if (--material->users > 0) {
+        return;
+    }
+
+    releaseMaterialResources(material);
+    delete material;
+    m_materials[index] = nullptr;
+
+    if (index == m_defaultMaterial) {
+        m_defaultMaterial = -1;
+    }
+}
+
+void Renderer::initSwapChainResources() {
+    m_renderTarget.createFramebuffers();
+    m_commandRecorder.invalidate();
+
+    for (Material *material : m_materials) {
+        if (material && material->virtualTexture) {
+            material->virtualTexture->createFeedbackTarget(m_window->swapChainImageSize());
+        }
+    }
+}
+
+void Renderer::releaseSwapChainResources() {
+    m_renderTarget.releaseFramebuffers();
+
+    for (Material *material : m_materials) {
+        if (material && material->virtualTexture) {
+            material->virtualTexture->releaseFeedbackTarget();
+        }
     }
 }
 
 void Renderer::startNextFrame() {
+    VkCommandBuffer commandBuffer = m_window->currentCommandBuffer();
+
+    m_renderScheduler.beginFrame();
+    m_deletionQueue.collect();
+
+    m_defragmenting = m_memoryDefragmenter.update(commandBuffer);
+    if (m_defragmenting) {
+        m_commandRecorder.invalidate();
+    }
+
+    initObjects();
+    if (m_pipelineCompiler.collect()) {
+        m_commandRecorder.invalidate();
+    }
+    if (m_feedbackPassOwner && m_feedbackPipeline) {
+        releaseFeedbackPassOwner();
+    }
+    m_prepassActive = m_depthPrepass && m_depthPipeline;
+    requestPipelineVariants();
+    updateUniformBuffer();
+    updateTextureStreaming(commandBuffer);
+    if (m_textureAtlas.isCreated() && m_textureAtlas.update(commandBuffer)) {
+        m_commandRecorder.invalidate();
+    }
+    renderFeedbackPasses(commandBuffer);
+    cullInstances(commandBuffer);
+
     VkRenderPassBeginInfo renderPassInfo = {};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassInfo.renderPass = m_window->defaultRenderPass();
-    renderPassInfo.framebuffer = m_window->currentFramebuffer();
+    renderPassInfo.renderPass = m_renderTarget.renderPass();
+    renderPassInfo.framebuffer = m_renderTarget.currentFramebuffer();
     renderPassInfo.renderArea.offset.x = 0;
     renderPassInfo.renderArea.offset.y = 0;
     const QSize swapChainImageSize = m_window->swapChainImageSize();
@@ -717,294 +1704,413 @@ void Renderer::startNextFrame() {
     renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
     renderPassInfo.pClearValues = clearValues.data();
 
-    VkCommandBuffer commandBuffer = m_window->currentCommandBuffer();
-    m_deviceFunctions->vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    const VkDescriptorSet textureTableSet = m_bindless
+        ? m_textureTable.currentDescriptorSet()
+        : VK_NULL_HANDLE;
+    const int prepassCount = m_prepassActive ? m_scene.size() : 0;
+    const int drawCount = prepassCount + m_scene.size() + m_instanceBatches.size();
 
-    VkViewport viewport;
-    viewport.x = 0;
-    viewport.y = 0;
-    viewport.width = swapChainImageSize.width();
-    viewport.height = swapChainImageSize.height();
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-    m_deviceFunctions->vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    if (m_pipelineStatistics.isCreated()) {
+        m_pipelineStatistics.begin(commandBuffer);
+    }
 
-    VkRect2D scissor;
-    scissor.offset.x = 0;
-    scissor.offset.y = 0;
-    scissor.extent.width = viewport.width;
-    scissor.extent.height = viewport.height;
-    m_deviceFunctions->vkCmdSetScissor(
-        commandBuffer,
-        0,
-        1,
-        &scissor
-    );
+    if (m_parallelRecording) {
+        m_deviceFunctions->vkCmdBeginRenderPass(
+            commandBuffer,
+            &renderPassInfo,
+            VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+        );
 
-    drawObject();
+        const QVector<VkCommandBuffer> secondaryCommandBuffers = m_commandRecorder.record(
+            renderPassInfo.renderPass,
+            renderPassInfo.framebuffer,
+            drawCount,
+            [this, textureTableSet](VkCommandBuffer secondaryCommandBuffer, int first, int last) {
+                recordDraws(secondaryCommandBuffer, textureTableSet, first, last);
+            },
+            m_commandReuse && !hasVirtualTextures()
+        );
+
+        m_deviceFunctions->vkCmdExecuteCommands(
+            commandBuffer,
+            static_cast<uint32_t>(secondaryCommandBuffers.size()),
+            secondaryCommandBuffers.constData()
+        );
+    } else {
+        m_deviceFunctions->vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        recordDraws(commandBuffer, textureTableSet, 0, drawCount);
+    }
 
     m_deviceFunctions->vkCmdEndRenderPass(commandBuffer);
 
+    if (m_pipelineStatistics.isCreated()) {
+        m_pipelineStatistics.end(commandBuffer);
+    }
+
+    m_uploadBatch.collectRetired();
+    reportVertexUploads();
+
+    QElapsedTimer submitTimer;
+    submitTimer.start();
+    m_uploadBatch.submit();
+    if (m_vertexUploadCount > 0) {
+        m_vertexUploadCpuTime += submitTimer.nsecsElapsed();
+    }
+
     m_window->frameReady();
-    m_window->requestUpdate();
+
+    if (m_renderScheduler.endFrame(hasPendingWork())) {
+        m_window->requestUpdate();
+    }
+
+    if (++m_statsFrameCount == STATS_INTERVAL_FRAMES) {
+        m_statsFrameCount = 0;
+
+        const int instances = instanceCount();
+        if (instances > 0) {
+            qCDebug(lcStats, "Drew %d objects and %d instances, %.2f ms per frame",
+                    m_scene.size(),
+                    instances,
+                    m_renderScheduler.frameInterval() / 1000000.0);
+        }
+
+        if (m_pipelineStatistics.isCreated()) {
+            const double pixels = double(swapChainImageSize.width()) * swapChainImageSize.height();
+            qCDebug(lcStats, "Depth prepass %s: %.0f vertex and %.0f fragment shader invocations per frame, %.2f per pixel",
+                    m_depthPrepass ? "on" : "off",
+                    m_pipelineStatistics.averageVertexInvocations(),
+                    m_pipelineStatistics.averageFragmentInvocations(),
+                    m_pipelineStatistics.averageFragmentInvocations() / pixels);
+            m_pipelineStatistics.resetAverages();
+        }
+    }
 }
 
-void Renderer::updateUniformBuffer()
-{
-    static QTime startTime(QTime::currentTime());
+void Renderer::renderFeedbackPasses(VkCommandBuffer commandBuffer) {
+    const QVector<int> &materials = m_scene.materials();
+
+    for (int materialIndex = 0; materialIndex < m_materials.size(); ++materialIndex) {
+        const Material *material = m_materials[materialIndex];
+        if (!material || !material->virtualTexture) {
+            continue;
+        }
+
+        VirtualTexture *virtualTexture = material->virtualTexture.data();
+        virtualTexture->update(commandBuffer);
+        virtualTexture->beginFeedbackPass(commandBuffer);
+        bindFrameDescriptorSet(commandBuffer, m_virtualTexturePipelineLayout);
+
+        DrawState state;
+        for (int index = 0; index < materials.size(); ++index) {
+            if (materials[index] == materialIndex)
+                drawObject(commandBuffer, index, true, state);
+        }
+        virtualTexture->endFeedbackPass(commandBuffer);
+    }
+}
+
+void Renderer::cullInstances(VkCommandBuffer commandBuffer) {
+    if (!m_gpuCuller.isCreated()) {
+        return;
+    }
 
-    float time = static_cast<float>(startTime.elapsed())/1000.0f;
+    CullParams params = {};
+    GpuCuller::frustumPlanes(m_cullMatrix, params.planes);
+
+    bool culled = false;
+    for (InstanceBatch *batch : m_instanceBatches) {
+        if (!batch || !batch->culled.drawBuffer) {
+            continue;
+        }
+
+        // Instance matrices already include the mesh transformation, so the
+        // bounds stay in model space.
+        const Model *model = m_meshes.at(batch->mesh)->model.data();
+        params.bounds[0] = model->boundingCenter.x();
+        params.bounds[1] = model->boundingCenter.y();
+        params.bounds[2] = model->boundingCenter.z();
+        params.bounds[3] = model->boundingRadius;
+        params.instanceCount = static_cast<uint32_t>(batch->instances.size());
+
+        m_gpuCuller.cull(commandBuffer, batch->culled, batch->instanceBuffer, params);
+        culled = true;
+    }
+
+    if (culled) {
+        m_gpuCuller.finish(commandBuffer);
+    }
+}
+
+bool Renderer::hasVirtualTextures() const {
+    for (const Material *material : m_materials) {
+        if (material && material->virtualTexture)
+            return true;
+    }
+    return false;
+}
+
+bool Renderer::hasPendingWork() const {
+    if (m_defragmenting
+        || m_uploadBatch.submissionsInFlight() > 0
+        || m_deletionQueue.pendingCount() > 0
+        || m_textureStreamer.isStreaming()
+        || m_pipelineCompiler.isCompiling()
+        || m_missingPipelineVariants) {
+        return true;
+    }
+
+    for (const Material *material : m_materials) {
+        if (material && material->virtualTexture && material->virtualTexture->isStreaming())
+            return true;
+    }
+    return false;
+}
 
-    UniformBufferObject ubo = {};
-    ubo.model.setToIdentity();
-    ubo.model.translate(0, 0, m_window->getZoom());
-    ubo.model.rotate(m_window->getTrackballRotation());
-    ubo.model *= m_object->model->transformation;
+void Renderer::updateUniformBuffer()
+{
+    QMatrix4x4 sceneMatrix;
+    sceneMatrix.translate(0, 0, m_window->getZoom());
+    sceneMatrix.rotate(m_window->getTrackballRotation());
 
     QVector3D eye = QVector3D(0.0, 0.0, 1.0);
     QVector3D center = QVector3D(0.0, 0.0, 0.0);
     QVector3D up = QVector3D(0.0, 1.0, 0.0);
 
-    ubo.view.setToIdentity();
-    ubo.view.lookAt(eye, center, up);
+    QMatrix4x4 view;
+    view.lookAt(eye, center, up);
 
     QSize swapChainImageSize = m_window->swapChainImageSize();
     float aspectRatio = static_cast<float>(swapChainImageSize.width()) / static_cast<float>(swapChainImageSize.height());
-    ubo.proj = m_window->clipCorrectionMatrix();
-    ubo.proj.perspective(45.0f, aspectRatio, 0.01f, 100.0f);
+    QMatrix4x4 proj = m_window->clipCorrectionMatrix();
+    proj.perspective(45.0f, aspectRatio, 0.01f, 100.0f);
 
-    float ecLightPosition[] = {
-        m_lightPosition.x(),
-        m_lightPosition.y(),
-        m_lightPosition.z()
-    };
+    m_cullMatrix = proj * view * sceneMatrix;
 
-    quint8 *data;
-    VkDevice device = m_window->device();
-    m_deviceFunctions->vkMapMemory(device, m_object->uniformBufferMemory, 0, sizeof(UniformBufferObject), 0, reinterpret_cast<void **>(&data));
-
-    memcpy(data, ubo.model.constData(), 64);
-    memcpy(data + 64, ubo.view.constData(), 64);
-    memcpy(data + 128, ubo.proj.constData(), 64);
-    memcpy(data + 192, ecLightPosition, 3 * sizeof(float));
+    if (sceneMatrix != m_lastViewMatrix || proj != m_lastProjectionMatrix) {
+        m_lastViewMatrix = sceneMatrix;
+        m_lastProjectionMatrix = proj;
+        m_scene.markAllDirty();
+        m_sceneUniformDirty = 0xff;
+    }
 
-    m_deviceFunctions->vkUnmapMemory(device, m_object->uniformBufferMemory);
-}
+    // Object matrices are pushed while recording, so only a camera change
+    // rewrites this frame's uniforms; object changes just refresh the
+    // texture levels below.
+    const quint8 frameMask = quint8(1u << m_window->currentFrame());
+    const bool sceneUniformDirty = m_sceneUniformDirty & frameMask;
+    if (!sceneUniformDirty && !m_scene.hasDirty(frameMask)) {
+        return;
+    }
 
+    // Keep drawing for the frames it takes texture feedback to catch up with
+    // the new view.
+    m_renderScheduler.invalidate(m_window->concurrentFrameCount() + 1);
+
+    if (sceneUniformDirty) {
+        FrameUniformData uniformData;
+        memcpy(uniformData.scene, sceneMatrix.constData(), sizeof(uniformData.scene));
+        memcpy(uniformData.view, view.constData(), sizeof(uniformData.view));
+        memcpy(uniformData.proj, proj.constData(), sizeof(uniformData.proj));
+        uniformData.lightPosition[0] = m_lightPosition.x();
+        uniformData.lightPosition[1] = m_lightPosition.y();
+        uniformData.lightPosition[2] = m_lightPosition.z();
+        uniformData.lightPosition[3] = 1.0f;
+
+        memcpy(m_uniformBufferMemory.mapped + frameUniformOffset(), &uniformData, sizeof(uniformData));
+        m_sceneUniformDirty &= quint8(~frameMask);
+    }
 
-void Renderer::initPipeline() {
-    VkDevice device = m_window->device();
-    QByteArray vertShaderCode = readFile(":shaders/shader.vert.spv");
-    QByteArray fragShaderCode = readFile(":shaders/shader.frag.spv");
+    const QMatrix4x4 sceneView = view * sceneMatrix;
+    QVector<float> materialLevels(m_materials.size(), -1.0f);
+
+    const QVector<QMatrix4x4> &transforms = m_scene.transforms();
+    const QVector<QVector4D> &bounds = m_scene.bounds();
+    const QVector<int> &meshes = m_scene.meshes();
+    const QVector<int> &materials = m_scene.materials();
+
+    for (int index = 0; index < m_scene.size(); ++index) {
+        const StreamedTexture *texture = m_materials[materials[index]]->texture;
+        if (texture) {
+            const Mesh *mesh = m_meshes[meshes[index]];
+            const QMatrix4x4 model = transforms[index] * mesh->model->transformation;
+            const float level = requiredTextureLevel(
+                sceneView,
+                proj,
+                bounds[index],
+                model.column(0).toVector3D().length(),
+                mesh->model.data(),
+                texture->size()
+            );
+
+            float &materialLevel = materialLevels[materials[index]];
+            materialLevel = materialLevel < 0.0f ? level : qMin(materialLevel, level);
+        }
+    }
 
-    VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-    VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+    m_scene.clearDirty(frameMask);
 
-    VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
-    vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vertShaderStageInfo.module = vertShaderModule;
-    vertShaderStageInfo.pName = "main";
+    for (int index = 0; index < m_materials.size(); ++index) {
+        if (materialLevels[index] >= 0.0f)
+            m_materials[index]->texture->setRequestedLevel(materialLevels[index]);
+    }
+}
 
-    VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
-    fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    fragShaderStageInfo.module = fragShaderModule;
-    fragShaderStageInfo.pName = "main";
+float Renderer::requiredTextureLevel(const QMatrix4x4 &sceneView,
+                                     const QMatrix4x4 &proj,
+                                     const QVector4D &bounds,
+                                     float worldScale,
+                                     const Model *model,
+                                     const QSize &textureSize) const {
+    if (model->texCoordDensity <= 0.0f) {
+        return 0.0f;
+    }
 
-    VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+    const QVector3D viewCenter = sceneView.map(bounds.toVector3D());
+    const float distance = -viewCenter.z() - bounds.w();
+    if (distance <= 0.0f) {
+        return 0.0f;
+    }
 
-    VkDynamicState dynamicStates[] = {
-        VK_DYNAMIC_STATE_VIEWPORT,
-        VK_DYNAMIC_STATE_SCISSOR
-    };
+    const float viewportHeight = float(m_window->swapChainImageSize().height());
+    const float pixelsPerUnit = qAbs(proj(1, 1)) * viewportHeight * 0.5f / distance;
 
-    VkPipelineDynamicStateCreateInfo dynamicInfo = {};
-    dynamicInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    dynamicInfo.dynamicStateCount = 2;
-    dynamicInfo.pDynamicStates = dynamicStates;
-
-    VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
-    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-
-    auto bindingDescription = Vertex::getBindingDescription();
-    auto attributeDescriptions = Vertex::getAttributeDescriptions();
-
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
-
-    VkPipelineInputAssemblyStateCreateInfo inputAssemblyInfo = {};
-    inputAssemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    inputAssemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    inputAssemblyInfo.primitiveRestartEnable = VK_FALSE;
-
-    VkPipelineRasterizationStateCreateInfo rasterizationInfo = {};
-    rasterizationInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizationInfo.depthClampEnable = VK_FALSE;
-    rasterizationInfo.rasterizerDiscardEnable = VK_FALSE;
-    rasterizationInfo.polygonMode = VK_POLYGON_MODE_FILL;
-    rasterizationInfo.cullMode = VK_CULL_MODE_BACK_BIT;
-    rasterizationInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-    rasterizationInfo.depthBiasEnable = VK_FALSE;
-    rasterizationInfo.depthBiasConstantFactor = 0.0f;
-    rasterizationInfo.depthBiasClamp = 0.0f;
-    rasterizationInfo.depthBiasSlopeFactor = 0.0f;
-    rasterizationInfo.lineWidth = 1.0f;
-
-    VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = VK_FALSE;
-
-    VkPipelineColorBlendStateCreateInfo colorBlending = {};
-    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    colorBlending.logicOpEnable = VK_FALSE;
-    colorBlending.attachmentCount = 1;
-    colorBlending.pAttachments = &colorBlendAttachment;
+    const float texelsPerUnit = qMax(textureSize.width(), textureSize.height())
+        * model->texCoordDensity / worldScale;
 
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout;
+    return std::log2(qMax(texelsPerUnit / pixelsPerUnit, 1.0f));
+}
 
-    VkResult result = m_deviceFunctions->vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &m_pipelineLayout);
-    if (result != VK_SUCCESS)
-        qFatal("Failed to create pipeline layout: %d", result);
-
-    VkPipelineDepthStencilStateCreateInfo depthStencil = {};
-    depthStencil.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-    depthStencil.depthTestEnable = VK_TRUE;
-    depthStencil.depthWriteEnable = VK_TRUE;
-    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
-    depthStencil.depthBoundsTestEnable = VK_FALSE;
-    depthStencil.minDepthBounds = 0.0f;
-    depthStencil.maxDepthBounds = 1.0f;
-    depthStencil.stencilTestEnable = VK_FALSE;
-    depthStencil.front = {};
-    depthStencil.back = {};
-
-    VkGraphicsPipelineCreateInfo pipelineInfo = {};
-    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineInfo.stageCount = 2;
-    pipelineInfo.pStages = shaderStages;
-    pipelineInfo.pDynamicState = &dynamicInfo;
-    pipelineInfo.pVertexInputState = &vertexInputInfo;
-    pipelineInfo.pInputAssemblyState = &inputAssemblyInfo;
-    pipelineInfo.pRasterizationState = &rasterizationInfo;
-    pipelineInfo.pColorBlendState = &colorBlending;
-    pipelineInfo.layout = m_pipelineLayout;
-    pipelineInfo.renderPass = m_window->defaultRenderPass();
-    pipelineInfo.subpass = 0;
-    pipelineInfo.pDepthStencilState = &depthStencil;
-
-    result = m_deviceFunctions->vkCreateGraphicsPipelines(
-            device,
-            VK_NULL_HANDLE,
-            1,
-            &pipelineInfo,
-            nullptr,
-            &m_graphicsPipeline
-        );
+void Renderer::updateTextureStreaming(VkCommandBuffer commandBuffer) {
+    const QVector<StreamedTexture *> changed = m_textureStreamer.update(commandBuffer);
+    if (changed.isEmpty()) {
+        return;
+    }
 
-    if (result != VK_SUCCESS)
-        qFatal("Failed to graphics pipeline: %d", result);
+    for (Material *material : m_materials) {
+        if (!material || !material->texture || !changed.contains(material->texture)) {
+            continue;
+        }
 
-    m_deviceFunctions->vkDestroyShaderModule(device, fragShaderModule, nullptr);
-    m_deviceFunctions->vkDestroyShaderModule(device, vertShaderModule, nullptr);
+        if (material->textureIndex >= 0) {
+            m_textureTable.setTexture(material->textureIndex, material->texture->imageView());
+            m_commandRecorder.invalidate();
+        } else if (material->atlasEntry < 0) {
+            createDescriptorPool(material);
+            createDescriptorSets(material);
+        }
+    }
 }
 
-QByteArray Renderer::readFile(const QString &fileName) {
-    QFile file(fileName);
-    if (!file.open(QIODevice::ReadOnly))
-        QDebug(QtFatalMsg) << QLatin1String("Failed to open file:") << fileName;
-    QByteArray content = file.readAll();
-    file.close();
 
-    return content;
+// Material pipelines are compiled per shader variant on first use; see
+// requestPipelineVariants().
+void Renderer::initPipeline() {
+    m_pipelineLayout = createPipelineLayout(m_descriptorSetLayout, "graphics");
 }
 
-VkShaderModule Renderer::createShaderModule(const QByteArray &code) {
-    VkShaderModuleCreateInfo createInfo = {};
-    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    createInfo.codeSize = size_t(code.size());
-    createInfo.pCode = reinterpret_cast<const uint32_t *>(code.constData());
+void Renderer::releaseMeshResources(Mesh *mesh) {
+    m_commandRecorder.invalidate();
 
-    VkShaderModule shaderModule;
-    VkDevice device = m_window->device();
-    VkResult result = m_deviceFunctions->vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule);
-    if (result != VK_SUCCESS)
-        QDebug(QtFatalMsg) << QLatin1String("Failed to create shader module:") << result;
-
-    return shaderModule;
+    if (mesh->vertexBuffer) {
+        m_memoryDefragmenter.remove(&mesh->vertexBufferMemory);
+        m_deletionQueue.destroyBuffer(mesh->vertexBuffer, mesh->vertexBufferMemory);
+        mesh->vertexBuffer = VK_NULL_HANDLE;
+    }
 }
 
-void Renderer::releaseObjectResources() {
-    VkDevice device = m_window->device();
+void Renderer::releaseMaterialResources(Material *material) {
+    m_commandRecorder.invalidate();
 
-    if (m_object->vertexBuffer) {
-        m_deviceFunctions->vkDestroyBuffer(
-            device,
-            m_object->vertexBuffer,
-            nullptr
-        );
-        m_object->vertexBuffer = VK_NULL_HANDLE;
-    }
+    releaseTextureImage(material);
+    releaseVirtualTexture(material);
+    releaseMaterialDescriptorSet(material);
+}
 
-    if (m_object->uniformBuffer) {
-        m_deviceFunctions->vkDestroyBuffer(device, m_object->uniformBuffer, nullptr);
-        m_object->uniformBuffer = VK_NULL_HANDLE;
+void Renderer::releaseMaterialDescriptorSet(Material *material) {
+    if (material->descriptorPool) {
+        m_deletionQueue.destroyDescriptorPool(material->descriptorPool);
+        material->descriptorPool = VK_NULL_HANDLE;
     }
+    material->descriptorSet = VK_NULL_HANDLE;
+}
 
-    if(m_object->vertexBufferMemory) {
-        m_deviceFunctions->vkFreeMemory(
-            device,
-            m_object->vertexBufferMemory,
-            nullptr
-        );
-        m_object->vertexBufferMemory = VK_NULL_HANDLE;
+void Renderer::releaseTextureImage(Material *material) {
+    if (material->textureIndex >= 0) {
+        m_textureTable.removeTexture(material->textureIndex);
+        material->textureIndex = -1;
     }
 
-    if (m_object->textureImageView) {
-        m_deviceFunctions->vkDestroyImageView(
-            device,
-            m_object->textureImageView,
-            nullptr
-        );
-    }
+    material->atlasEntry = -1;
 
-    if (m_object->textureImage) {
-        m_deviceFunctions->vkDestroyImage(
-            device, m_object->textureImage,
-            nullptr
-        );
-        m_object->textureImage = VK_NULL_HANDLE;
+    if (material->texture) {
+        m_textureStreamer.destroyTexture(material->texture);
+        material->texture = nullptr;
     }
+}
 
-    if (m_object->textureImageMemory) {
-        m_deviceFunctions->vkFreeMemory(
-            device,
-            m_object->textureImageMemory,
-            nullptr
-        );
-        m_object->textureImageMemory = VK_NULL_HANDLE;
+void Renderer::writeMemoryReport(const QString &path) const {
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning("Failed to write memory report to %s", path.toStdString().c_str());
+        return;
     }
 
-    if (m_object->descriptorPool) {
-        m_deviceFunctions->vkDestroyDescriptorPool(
-            device,
-            m_object->descriptorPool,
-            nullptr
-        );
-        m_object->descriptorPool = VK_NULL_HANDLE;
-    }
+    QJsonObject report = m_memoryAllocator.report();
+    report["renderTarget"] = m_renderTarget.report();
+
+    file.write(QJsonDocument(report).toJson());
 }
 
 void Renderer::releaseResources() {
     VkDevice device = m_window->device();
 
-    m_deviceFunctions->vkDestroyPipeline(device, m_graphicsPipeline, nullptr);
+    if (!m_window->memoryReportPath().isEmpty()) {
+        writeMemoryReport(m_window->memoryReportPath());
+    }
+
+    qCDebug(lcStats, "Rendered %llu frames, skipped about %llu",
+            static_cast<unsigned long long>(m_renderScheduler.renderedFrames()),
+            static_cast<unsigned long long>(m_renderScheduler.skippedFrames()));
+
+    m_pipelineCompiler.release();
+    releasePipelineVariants();
+    m_uploadBatch.release();
+
+    for (Mesh *mesh : m_meshes) {
+        if (mesh)
+            releaseMeshResources(mesh);
+    }
+    for (Material *material : m_materials) {
+        if (material)
+            releaseMaterialResources(material);
+    }
+    for (InstanceBatch *batch : m_instanceBatches) {
+        if (batch)
+            releaseInstanceBatchResources(batch);
+    }
+    releaseInstancing();
+    releaseDepthPrepass();
+    m_gpuCuller.release();
+    releaseBindless();
+    releaseTextureAtlas();
+    m_textureStreamer.release();
+    m_deviceFunctions->vkDestroyDescriptorPool(device, m_frameDescriptorPool, nullptr);
+    m_frameDescriptorPool = VK_NULL_HANDLE;
+    m_frameDescriptorSet = VK_NULL_HANDLE;
+    releaseUniformBuffer();
+    m_memoryDefragmenter.release();
+    m_deletionQueue.release();
+    releaseFeedbackPassOwner();
+
+    if (m_virtualTexturePipelineLayout) {
+        m_deviceFunctions->vkDestroyPipeline(device, m_feedbackPipeline, nullptr);
+        m_deviceFunctions->vkDestroyPipelineLayout(device, m_virtualTexturePipelineLayout, nullptr);
+        m_deviceFunctions->vkDestroyDescriptorSetLayout(device, m_virtualTextureDescriptorSetLayout, nullptr);
+        m_feedbackPipeline = VK_NULL_HANDLE;
+        m_virtualTexturePipelineLayout = VK_NULL_HANDLE;
+        m_virtualTextureDescriptorSetLayout = VK_NULL_HANDLE;
+    }
+
     m_deviceFunctions->vkDestroyPipelineLayout(device, m_pipelineLayout, nullptr);
 
     m_deviceFunctions->vkDestroySampler(
@@ -1018,4 +2124,20 @@ void Renderer::releaseResources() {
             m_descriptorSetLayout,
             nullptr
         );
+
+    m_deviceFunctions->vkDestroyDescriptorSetLayout(
+            device,
+            m_frameDescriptorSetLayout,
+            nullptr
+        );
+
+    if (m_parallelRecording) {
+        m_commandRecorder.release();
+    }
+    m_pipelineStatistics.release();
+
+    m_pipelineCache.release();
+
+    m_renderTarget.release();
+    m_memoryAllocator.release();
 }
@@ -1,86 +1,348 @@
 #ifndef RENDERER_H
 #define RENDERER_H
 
+#include <QElapsedTimer>
 #include <QVulkanWindowRenderer>
 #include <QVulkanDeviceFunctions>
 #include <QSharedPointer>
+#include <array>
+#include <atomic>
+#include <unordered_map>
+
+#include "commandrecorder.h"
+#include "deletionqueue.h"
+#include "gpuculler.h"
+#include "memoryallocator.h"
+#include "memorydefragmenter.h"
+#include "pipelinecache.h"
+#include "pipelinecompiler.h"
+#include "pipelinestatistics.h"
+#include "renderscheduler.h"
+#include "rendertarget.h"
+#include "scene.h"
+#include "shadervariant.h"
+#include "textureatlas.h"
+#include "texturestreamer.h"
+#include "texturetable.h"
+#include "uploadbatch.h"
 
 class VulkanWindow;
+class VirtualTexture;
 
 struct Model;
 
-struct Object3D
+struct Mesh
 {
-    Object3D(QSharedPointer<Model> model);
+    QSharedPointer<Model> model;
 
     VkBuffer vertexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory vertexBufferMemory = VK_NULL_HANDLE;
+    MemoryAllocation vertexBufferMemory;
 
-    VkBuffer uniformBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory uniformBufferMemory = VK_NULL_HANDLE;
+    int users = 0;
+};
 
-    VkImage textureImage = VK_NULL_HANDLE;
-    VkDeviceMemory textureImageMemory = VK_NULL_HANDLE;
-    VkImageView textureImageView = VK_NULL_HANDLE;
+struct Material
+{
+    StreamedTexture *texture = nullptr;
+    int textureIndex = -1;
+    int atlasEntry = -1;
 
     VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
     VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
 
-    QSharedPointer<Model> model;
+    QSharedPointer<VirtualTexture> virtualTexture;
+
+    int users = 0;
+};
+
+struct FrameUniformData {
+    float scene[16];
+    float view[16];
+    float proj[16];
+    float lightPosition[4];
+};
+
+struct ObjectPushConstants {
+    float model[16];
+};
+
+struct DrawState
+{
+    VkDescriptorSet textureTableSet = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkDescriptorSet materialSet = VK_NULL_HANDLE;
+};
+
+struct MeshInstance
+{
+    QMatrix4x4 transform;
+    QVector4D tint = QVector4D(1.0f, 1.0f, 1.0f, 1.0f);
 };
 
-struct UniformBufferObject {
-    QMatrix4x4 model;
-    QMatrix4x4 view;
-    QMatrix4x4 proj;
-    QVector3D lighPosition;
+struct InstanceData {
+    float model[16];
+    float tint[4];
+
+    static VkVertexInputBindingDescription getBindingDescription() {
+        VkVertexInputBindingDescription bindingDescription = {};
+
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+        bindingDescription.stride = sizeof(InstanceData);
+        bindingDescription.binding = 1;
+
+        return bindingDescription;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, 5> getAttributeDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 5> attributeDescriptions = {};
+
+        // A mat4 attribute takes one location per column.
+        for (uint32_t column = 0; column < 4; ++column) {
+            attributeDescriptions[column].binding = 1;
+            attributeDescriptions[column].location = 4 + column;
+            attributeDescriptions[column].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+            attributeDescriptions[column].offset = offsetof(InstanceData, model) + column * 4 * sizeof(float);
+        }
+
+        attributeDescriptions[4].binding = 1;
+        attributeDescriptions[4].location = 8;
+        attributeDescriptions[4].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        attributeDescriptions[4].offset = offsetof(InstanceData, tint);
+
+        return attributeDescriptions;
+    }
+};
+
+struct InstanceBatch
+{
+    int mesh = -1;
+    QVector<InstanceData> instances;
+
+    VkBuffer instanceBuffer = VK_NULL_HANDLE;
+    MemoryAllocation instanceBufferMemory;
+    bool uploaded = false;
+
+    CulledInstances culled;
 };
 
 class Renderer : public QVulkanWindowRenderer {
 public:
     Renderer(VulkanWindow *window);
+    ~Renderer();
 
     void initResources() override;
+    void initSwapChainResources() override;
+    void releaseSwapChainResources() override;
     void releaseResources() override;
     void startNextFrame() override;
     void addTextureImage(QString texturePath);
-    void addObject(QSharedPointer<Model> model);
+
+    ObjectHandle addObject(QSharedPointer<Model> model, const QMatrix4x4 &transform = QMatrix4x4());
+    void removeObject(ObjectHandle handle);
+    void setObjectTransform(ObjectHandle handle, const QMatrix4x4 &transform);
+    void setObjectTexture(ObjectHandle handle, const QString &texturePath);
+
+    int objectCount() const {
+        return m_scene.size();
+    }
+
+    int addInstances(QSharedPointer<Model> model, const QVector<MeshInstance> &instances);
+    void setInstances(int batch, const QVector<MeshInstance> &instances);
+    void removeInstances(int batch);
+    int instanceCount() const;
+
+    void setVirtualTextureBudget(VkDeviceSize budget) {
+        m_virtualTextureBudget = budget;
+    }
+
+    void setTextureStreamingBudget(VkDeviceSize budget) {
+        m_textureStreamer.setBudget(budget);
+    }
+
+    void setDefragmentationBudget(VkDeviceSize bytesPerFrame) {
+        m_memoryDefragmenter.setBytesPerFrame(bytesPerFrame);
+    }
+
+    quint64 skippedFrames() const {
+        return m_renderScheduler.skippedFrames();
+    }
+
+    void cycleDebugView();
+
+    void setDepthPrepass(bool enabled);
+
+    bool depthPrepass() const {
+        return m_depthPrepass;
+    }
+
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& bufferMemory, MemoryUsage memoryUsage, const QString &name);
+    void writeMemoryReport(const QString &path) const;
+
+    MemoryAllocator *memoryAllocator() {
+        return &m_memoryAllocator;
+    }
+
+    DeletionQueue *deletionQueue() {
+        return &m_deletionQueue;
+    }
+
+    MemoryDefragmenter *memoryDefragmenter() {
+        return &m_memoryDefragmenter;
+    }
+
+    VkPipelineCache pipelineCache() const {
+        return m_pipelineCache.handle();
+    }
 
 private:
     VulkanWindow *m_window = nullptr;
     QVulkanDeviceFunctions *m_deviceFunctions;
     VkDescriptorSetLayout m_descriptorSetLayout = nullptr;
     VkPipelineLayout m_pipelineLayout = nullptr;
-    VkPipeline m_graphicsPipeline = nullptr;
     VkSampler m_textureSampler = nullptr;
+
+    VkDescriptorSetLayout m_virtualTextureDescriptorSetLayout = nullptr;
+    VkPipelineLayout m_virtualTexturePipelineLayout = nullptr;
+    VkPipeline m_feedbackPipeline = nullptr;
+    // The virtual texture whose render pass the feedback pipeline is being
+    // compiled against; it is not released until the pipeline is collected.
+    QSharedPointer<VirtualTexture> m_feedbackPassOwner;
+    bool m_feedbackPassOwnerRetired = false;
+    VkDeviceSize m_virtualTextureBudget = 64 * 1024 * 1024;
+
+    bool m_bindless = false;
+    TextureTable m_textureTable;
+    VkPipelineLayout m_bindlessPipelineLayout = nullptr;
+    StreamedTexture *m_defaultTexture = nullptr;
+
+    TextureStreamer m_textureStreamer;
+    bool m_textureStreaming = false;
+
+    TextureAtlas m_textureAtlas;
+    VkPipelineLayout m_atlasPipelineLayout = nullptr;
     QVector3D m_lightPosition = QVector3D(0.0, 1.0, 1.0);
 
-    Object3D* m_object = nullptr;
+    Scene m_scene;
+    QVector<Mesh *> m_meshes;
+    QVector<Material *> m_materials;
+    int m_defaultMaterial = -1;
+
+    QVector<InstanceBatch *> m_instanceBatches;
+    VkPipelineLayout m_instancePipelineLayout = VK_NULL_HANDLE;
+    VkPipeline m_instancePipeline = VK_NULL_HANDLE;
+    quint8 m_sceneUniformDirty = 0xff;
+    GpuCuller m_gpuCuller;
+    QMatrix4x4 m_cullMatrix;
+    int m_statsFrameCount = 0;
+    ObjectHandle m_selectedObject;
+
+    VkDescriptorSetLayout m_frameDescriptorSetLayout = nullptr;
+    VkDescriptorPool m_frameDescriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSet m_frameDescriptorSet = VK_NULL_HANDLE;
+
+    VkBuffer m_uniformBuffer = VK_NULL_HANDLE;
+    MemoryAllocation m_uniformBufferMemory;
+    VkDeviceSize m_uniformStride = 0;
+
+    RenderTarget m_renderTarget;
+    CommandRecorder m_commandRecorder;
+    bool m_parallelRecording = false;
+    bool m_commandReuse = false;
+
+    RenderScheduler m_renderScheduler;
+    QMatrix4x4 m_lastViewMatrix;
+    QMatrix4x4 m_lastProjectionMatrix;
+    bool m_defragmenting = false;
+
+    MemoryAllocator m_memoryAllocator;
+    DeletionQueue m_deletionQueue;
+    MemoryDefragmenter m_memoryDefragmenter;
+    UploadBatch m_uploadBatch;
+
+    // Vertex uploads since the upload batch was last idle; reported once
+    // all of them have landed on the GPU.
+    int m_vertexUploadCount = 0;
+    VkDeviceSize m_vertexUploadBytes = 0;
+    qint64 m_vertexUploadCpuTime = 0;
+    QElapsedTimer m_vertexUploadTimer;
+
+    PipelineCache m_pipelineCache;
+    PipelineCompiler m_pipelineCompiler;
+
+    // Keyed by ShaderVariant::key(). Element references survive rehashing,
+    // which the compiler relies on to install pipelines in place.
+    std::unordered_map<quint32, VkPipeline> m_pipelineVariants;
+    std::atomic<bool> m_missingPipelineVariants{false};
+    ShaderDebugView m_debugView = ShaderDebugView::None;
+
+    VkPipelineLayout m_depthPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline m_depthPipeline = VK_NULL_HANDLE;
+    bool m_depthPrepass = false;
+    bool m_prepassActive = false;
+    PipelineStatistics m_pipelineStatistics;
 
 private:
     void initPipeline();
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
-    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
-    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-    VkCommandBuffer beginSingleTimeCommands();
-    void endSingleTimeCommands(VkCommandBuffer commandBuffer);
+    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkAccessFlags dstAccessMask, VkPipelineStageFlags dstStageMask);
     void transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout);
     void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
     void createTextureSampler();
     void createDescriptorSetLayout();
-    void createDescriptorPool();
-    void createDescriptorSets();
-    void initObject();
-    void drawObject();
-    void createTextureImageView();
+    void createDescriptorPool(Material *material);
+    void createDescriptorSets(Material *material);
+    void initObjects();
+    void recordDraws(VkCommandBuffer commandBuffer, VkDescriptorSet textureTableSet, int first, int last);
+    void bindFrameDescriptorSet(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout);
+    void drawObject(VkCommandBuffer commandBuffer, int index, bool feedbackPass, DrawState &state);
+    void drawObjectDepth(VkCommandBuffer commandBuffer, int index, DrawState &state);
+    void drawMesh(VkCommandBuffer commandBuffer, int index, const Mesh *mesh, VkPipelineLayout pipelineLayout);
+    ShaderVariant objectShaderVariant(const Mesh *mesh, int materialIndex) const;
+    VkPipeline findPipelineVariant(const ShaderVariant &variant);
+    void requestPipelineVariants();
+    void releasePipelineVariants();
+    void drawInstances(VkCommandBuffer commandBuffer, int batch);
+    void cullInstances(VkCommandBuffer commandBuffer);
     void createUniformBuffer();
+    void releaseUniformBuffer();
+    void createFrameDescriptorSet();
+    uint32_t frameUniformOffset() const;
+    VkPipelineLayout createPipelineLayout(VkDescriptorSetLayout materialSetLayout, const char *name);
     void updateUniformBuffer();
-    void createObjectVertexBuffer();
-    void releaseObjectResources();
-
-
-    static QByteArray readFile(const QString &fileName);
-    VkShaderModule createShaderModule(const QByteArray &code);
+    float requiredTextureLevel(const QMatrix4x4 &sceneView, const QMatrix4x4 &proj, const QVector4D &bounds, float worldScale, const Model *model, const QSize &textureSize) const;
+    void updateTextureStreaming(VkCommandBuffer commandBuffer);
+    void renderFeedbackPasses(VkCommandBuffer commandBuffer);
+    bool hasVirtualTextures() const;
+    bool hasPendingWork() const;
+    QVector4D objectBounds(const QMatrix4x4 &transform, const Mesh *mesh) const;
+    int acquireMesh(QSharedPointer<Model> model);
+    void releaseMesh(int mesh);
+    int createMaterial();
+    int acquireDefaultMaterial();
+    void releaseMaterial(int material);
+    bool isMaterialReady(const Material *material) const;
+    void releaseMaterialDescriptorSet(Material *material);
+    void createVertexBuffer(const void *data, VkDeviceSize size, VkBuffer &buffer, MemoryAllocation &bufferMemory, const QString &name, VkBufferUsageFlags extraUsage = 0);
+    void createMeshVertexBuffer(Mesh *mesh);
+    void reportVertexUploads();
+    void uploadInstanceBatch(InstanceBatch *batch);
+    void releaseInstanceBatchResources(InstanceBatch *batch);
+    void initInstancing();
+    void releaseInstancing();
+    void initDepthPrepass();
+    void releaseDepthPrepass();
+    void releaseMeshResources(Mesh *mesh);
+    void releaseMaterialResources(Material *material);
+    void addTextureImage(Material *material, const QString &texturePath);
+    void releaseTextureImage(Material *material);
+    void addVirtualTexture(Material *material, const QString &texturePath);
+    void releaseVirtualTexture(Material *material);
+    void initVirtualTexturePipelines(VkRenderPass feedbackRenderPass);
+    void releaseFeedbackPassOwner();
+    void createVirtualTextureDescriptorSet(Material *material);
+    void initBindless();
+    void releaseBindless();
+    void initTextureAtlas();
+    void releaseTextureAtlas();
 };
 
 #endif // RENDERER_H
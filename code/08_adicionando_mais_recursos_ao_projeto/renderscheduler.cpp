@@ -0,0 +1,38 @@
+#include "renderscheduler.h"
+
+#include <QtGlobal>
+
+void RenderScheduler::invalidate(int frameCount) {
+    m_pendingFrames = qMax(m_pendingFrames, frameCount);
+}
+
+void RenderScheduler::beginFrame() {
+    if (!m_clock.isValid())
+        m_clock.start();
+
+    const qint64 now = m_clock.nsecsElapsed();
+    if (m_renderedFrames > 0) {
+        const qint64 interval = now - m_lastFrameTime;
+        if (m_idle) {
+            // Count the frames continuous rendering would have drawn while
+            // the scheduler was idle.
+            if (m_frameInterval > 0)
+                m_skippedFrames += quint64(qMax<qint64>(0, interval / m_frameInterval - 1));
+        } else {
+            m_frameInterval = m_frameInterval > 0
+                ? (m_frameInterval * 7 + interval) / 8
+                : interval;
+        }
+    }
+
+    m_lastFrameTime = now;
+    ++m_renderedFrames;
+
+    if (m_pendingFrames > 0)
+        --m_pendingFrames;
+}
+
+bool RenderScheduler::endFrame(bool busy) {
+    m_idle = !m_continuous && !busy && m_pendingFrames == 0;
+    return !m_idle;
+}
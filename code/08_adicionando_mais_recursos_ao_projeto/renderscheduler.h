@@ -0,0 +1,47 @@
+#ifndef RENDERSCHEDULER_H
+#define RENDERSCHEDULER_H
+
+#include <QElapsedTimer>
+
+class RenderScheduler
+{
+public:
+    void setContinuous(bool continuous) {
+        m_continuous = continuous;
+    }
+
+    bool isContinuous() const {
+        return m_continuous;
+    }
+
+    void invalidate(int frameCount = 1);
+
+    void beginFrame();
+    bool endFrame(bool busy);
+
+    quint64 renderedFrames() const {
+        return m_renderedFrames;
+    }
+
+    quint64 skippedFrames() const {
+        return m_skippedFrames;
+    }
+
+    qint64 frameInterval() const {
+        return m_frameInterval;
+    }
+
+private:
+    bool m_continuous = false;
+    int m_pendingFrames = 0;
+    bool m_idle = false;
+
+    QElapsedTimer m_clock;
+    qint64 m_lastFrameTime = 0;
+    qint64 m_frameInterval = 0;
+
+    quint64 m_renderedFrames = 0;
+    quint64 m_skippedFrames = 0;
+};
+
+#endif // RENDERSCHEDULER_H
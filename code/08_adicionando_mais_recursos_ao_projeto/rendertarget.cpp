@@ -0,0 +1,320 @@
+#include "rendertarget.h"
+
+#include <QVulkanFunctions>
+#include <array>
+
+#include "features.h"
+#include "vulkanwindow.h"
+
+static const VkDeviceSize COLOR_TEXEL_SIZE = 4;
+
+static bool hasStencil(VkFormat format) {
+    return format == VK_FORMAT_D16_UNORM_S8_UINT
+        || format == VK_FORMAT_D24_UNORM_S8_UINT
+        || format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+}
+
+static VkDeviceSize depthTexelSize(VkFormat format) {
+    switch (format) {
+    case VK_FORMAT_D16_UNORM:
+        return 2;
+    case VK_FORMAT_D16_UNORM_S8_UINT:
+        return 3;
+    case VK_FORMAT_D32_SFLOAT_S8_UINT:
+        return 5;
+    default:
+        return 4;
+    }
+}
+
+void RenderTarget::create(VulkanWindow *window,
+                          QVulkanDeviceFunctions *deviceFunctions,
+                          MemoryAllocator *memoryAllocator,
+                          int depthBits) {
+    m_window = window;
+    m_deviceFunctions = deviceFunctions;
+    m_memoryAllocator = memoryAllocator;
+
+    m_transient = isFeatureEnabled(Feature::TransientDepth);
+    m_depthFormat = chooseDepthFormat(depthBits);
+
+    createRenderPass();
+}
+
+VkFormat RenderTarget::chooseDepthFormat(int depthBits) const {
+    QVector<VkFormat> candidates;
+    switch (depthBits) {
+    case 16:
+        candidates << VK_FORMAT_D16_UNORM;
+        break;
+    case 24:
+        candidates << VK_FORMAT_X8_D24_UNORM_PACK32 << VK_FORMAT_D24_UNORM_S8_UINT;
+        break;
+    case 32:
+        candidates << VK_FORMAT_D32_SFLOAT << VK_FORMAT_D32_SFLOAT_S8_UINT;
+        break;
+    default:
+        return m_window->depthStencilFormat();
+    }
+
+    QVulkanFunctions *f = m_window->vulkanInstance()->functions();
+    for (VkFormat format : candidates) {
+        VkFormatProperties properties;
+        f->vkGetPhysicalDeviceFormatProperties(m_window->physicalDevice(), format, &properties);
+        if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+            return format;
+    }
+
+    qWarning("No supported %d-bit depth format, using the window default", depthBits);
+    return m_window->depthStencilFormat();
+}
+
+void RenderTarget::createRenderPass() {
+    std::array<VkAttachmentDescription, 2> attachments = {};
+
+    attachments[0].format = m_window->colorFormat();
+    attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    attachments[1].format = m_depthFormat;
+    attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[1].storeOp = m_transient
+        ? VK_ATTACHMENT_STORE_OP_DONT_CARE
+        : VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference colorReference = {};
+    colorReference.attachment = 0;
+    colorReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference depthReference = {};
+    depthReference.attachment = 1;
+    depthReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorReference;
+    subpass.pDepthStencilAttachment = &depthReference;
+
+    // The depth image is shared by all frames in flight, so the previous
+    // frame's depth tests must finish before this frame clears it.
+    std::array<VkSubpassDependency, 2> dependencies = {};
+
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[0].srcAccessMask = 0;
+    dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+    dependencies[1].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].dstSubpass = 0;
+    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT
+        | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT
+        | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT
+        | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    VkRenderPassCreateInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+    renderPassInfo.pAttachments = attachments.data();
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    renderPassInfo.pDependencies = dependencies.data();
+
+    VkResult result = m_deviceFunctions->vkCreateRenderPass(
+        m_window->device(),
+        &renderPassInfo,
+        nullptr,
+        &m_renderPass
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create render pass: %d", result);
+    }
+}
+
+void RenderTarget::createDepthImage() {
+    VkDevice device = m_window->device();
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = m_depthFormat;
+    imageInfo.extent.width = uint32_t(m_size.width());
+    imageInfo.extent.height = uint32_t(m_size.height());
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    if (m_transient)
+        imageInfo.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkResult result = m_deviceFunctions->vkCreateImage(device, &imageInfo, nullptr, &m_depthImage);
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create depth image: %d", result);
+    }
+
+    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    if (m_transient)
+        properties |= VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+
+    m_depthImageMemory = m_memoryAllocator->allocateForImage(
+        m_depthImage,
+        properties,
+        MemoryUsage::Attachment,
+        "depth buffer"
+    );
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = m_depthImage;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = m_depthFormat;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (hasStencil(m_depthFormat))
+        viewInfo.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    result = m_deviceFunctions->vkCreateImageView(device, &viewInfo, nullptr, &m_depthImageView);
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create depth image view: %d", result);
+    }
+}
+
+void RenderTarget::createFramebuffers() {
+    m_size = m_window->swapChainImageSize();
+    createDepthImage();
+
+    VkDevice device = m_window->device();
+
+    m_framebuffers.resize(m_window->swapChainImageCount());
+    for (int i = 0; i < m_framebuffers.size(); ++i) {
+        std::array<VkImageView, 2> views = {
+            m_window->swapChainImageView(i),
+            m_depthImageView
+        };
+
+        VkFramebufferCreateInfo framebufferInfo = {};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.renderPass = m_renderPass;
+        framebufferInfo.attachmentCount = static_cast<uint32_t>(views.size());
+        framebufferInfo.pAttachments = views.data();
+        framebufferInfo.width = uint32_t(m_size.width());
+        framebufferInfo.height = uint32_t(m_size.height());
+        framebufferInfo.layers = 1;
+
+        VkResult result = m_deviceFunctions->vkCreateFramebuffer(
+            device,
+            &framebufferInfo,
+            nullptr,
+            &m_framebuffers[i]
+        );
+        if (result != VK_SUCCESS) {
+            qFatal("Failed to create framebuffer: %d", result);
+        }
+    }
+
+    const RenderTargetTraffic frameTraffic = traffic();
+    qCDebug(lcStats, "Render target %dx%d, depth format %d%s: %lld attachment bytes stored per frame"
+            " (%lld depth bytes not stored), depth memory %lld bytes allocated, %lld committed",
+            m_size.width(),
+            m_size.height(),
+            int(m_depthFormat),
+            m_transient ? " (transient)" : "",
+            static_cast<long long>(frameTraffic.bytesPerFrame()),
+            static_cast<long long>(frameTraffic.depthStoreBytesAvoided),
+            static_cast<long long>(frameTraffic.depthAllocatedBytes),
+            static_cast<long long>(frameTraffic.depthCommittedBytes));
+}
+
+void RenderTarget::releaseFramebuffers() {
+    VkDevice device = m_window->device();
+
+    for (VkFramebuffer framebuffer : m_framebuffers)
+        m_deviceFunctions->vkDestroyFramebuffer(device, framebuffer, nullptr);
+    m_framebuffers.clear();
+
+    if (m_depthImage) {
+        m_deviceFunctions->vkDestroyImageView(device, m_depthImageView, nullptr);
+        m_deviceFunctions->vkDestroyImage(device, m_depthImage, nullptr);
+        m_memoryAllocator->free(m_depthImageMemory);
+        m_depthImageView = VK_NULL_HANDLE;
+        m_depthImage = VK_NULL_HANDLE;
+    }
+}
+
+void RenderTarget::release() {
+    releaseFramebuffers();
+
+    if (m_renderPass) {
+        m_deviceFunctions->vkDestroyRenderPass(m_window->device(), m_renderPass, nullptr);
+        m_renderPass = VK_NULL_HANDLE;
+    }
+}
+
+VkFramebuffer RenderTarget::currentFramebuffer() const {
+    return m_framebuffers[m_window->currentSwapChainImageIndex()];
+}
+
+RenderTargetTraffic RenderTarget::traffic() const {
+    const VkDeviceSize pixelCount = VkDeviceSize(m_size.width()) * VkDeviceSize(m_size.height());
+    const VkDeviceSize depthBytes = pixelCount * depthTexelSize(m_depthFormat);
+
+    RenderTargetTraffic traffic;
+    traffic.colorStoreBytes = pixelCount * COLOR_TEXEL_SIZE;
+    traffic.depthStoreBytes = m_transient ? 0 : depthBytes;
+    traffic.depthStoreBytesAvoided = m_transient ? depthBytes : 0;
+    traffic.depthAllocatedBytes = m_depthImageMemory.size;
+    traffic.depthCommittedBytes = m_depthImageMemory.size;
+
+    const VkMemoryPropertyFlags properties =
+        m_memoryAllocator->memoryTypeProperties(m_depthImageMemory.memoryTypeIndex);
+    if (!m_depthImageMemory.isNull() && (properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)) {
+        m_deviceFunctions->vkGetDeviceMemoryCommitment(
+            m_window->device(),
+            m_depthImageMemory.memory,
+            &traffic.depthCommittedBytes
+        );
+    }
+
+    return traffic;
+}
+
+QJsonObject RenderTarget::report() const {
+    const RenderTargetTraffic frameTraffic = traffic();
+
+    QJsonObject json;
+    json["width"] = m_size.width();
+    json["height"] = m_size.height();
+    json["depthFormat"] = int(m_depthFormat);
+    json["transientDepth"] = m_transient;
+    json["colorStoreBytes"] = double(frameTraffic.colorStoreBytes);
+    json["depthStoreBytes"] = double(frameTraffic.depthStoreBytes);
+    json["depthStoreBytesAvoided"] = double(frameTraffic.depthStoreBytesAvoided);
+    json["depthAllocatedBytes"] = double(frameTraffic.depthAllocatedBytes);
+    json["depthCommittedBytes"] = double(frameTraffic.depthCommittedBytes);
+    json["bytesPerFrame"] = double(frameTraffic.bytesPerFrame());
+
+    return json;
+}
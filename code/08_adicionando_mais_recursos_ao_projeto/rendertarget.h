@@ -0,0 +1,76 @@
+#ifndef RENDERTARGET_H
+#define RENDERTARGET_H
+
+#include <QJsonObject>
+#include <QSize>
+#include <QVulkanDeviceFunctions>
+#include <QVector>
+
+#include "memoryallocator.h"
+
+class VulkanWindow;
+
+struct RenderTargetTraffic
+{
+    VkDeviceSize colorStoreBytes = 0;
+    VkDeviceSize depthStoreBytes = 0;
+    VkDeviceSize depthStoreBytesAvoided = 0;
+    VkDeviceSize depthAllocatedBytes = 0;
+    VkDeviceSize depthCommittedBytes = 0;
+
+    VkDeviceSize bytesPerFrame() const {
+        return colorStoreBytes + depthStoreBytes;
+    }
+};
+
+class RenderTarget
+{
+public:
+    void create(VulkanWindow *window,
+                QVulkanDeviceFunctions *deviceFunctions,
+                MemoryAllocator *memoryAllocator,
+                int depthBits);
+    void release();
+
+    void createFramebuffers();
+    void releaseFramebuffers();
+
+    VkRenderPass renderPass() const {
+        return m_renderPass;
+    }
+
+    VkFramebuffer currentFramebuffer() const;
+
+    VkFormat depthFormat() const {
+        return m_depthFormat;
+    }
+
+    bool isTransient() const {
+        return m_transient;
+    }
+
+    RenderTargetTraffic traffic() const;
+    QJsonObject report() const;
+
+private:
+    VulkanWindow *m_window = nullptr;
+    QVulkanDeviceFunctions *m_deviceFunctions = nullptr;
+    MemoryAllocator *m_memoryAllocator = nullptr;
+
+    VkFormat m_depthFormat = VK_FORMAT_UNDEFINED;
+    bool m_transient = true;
+    VkRenderPass m_renderPass = VK_NULL_HANDLE;
+
+    QSize m_size;
+    VkImage m_depthImage = VK_NULL_HANDLE;
+    MemoryAllocation m_depthImageMemory;
+    VkImageView m_depthImageView = VK_NULL_HANDLE;
+    QVector<VkFramebuffer> m_framebuffers;
+
+private:
+    VkFormat chooseDepthFormat(int depthBits) const;
+    void createRenderPass();
+    void createDepthImage();
+};
+
+#endif // RENDERTARGET_H
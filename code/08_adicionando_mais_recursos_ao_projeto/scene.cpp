@@ -0,0 +1,124 @@
+#include "scene.h"
+
+ObjectHandle Scene::add(int mesh, int material, const QMatrix4x4 &transform, const QVector4D &bounds) {
+    quint32 slot;
+    if (!m_freeSlots.isEmpty()) {
+        slot = m_freeSlots.takeLast();
+    } else {
+        slot = static_cast<quint32>(m_indices.size());
+        m_indices.append(-1);
+        m_generations.append(0);
+    }
+
+    m_indices[slot] = m_transforms.size();
+
+    m_transforms.append(transform);
+    m_bounds.append(bounds);
+    m_meshes.append(mesh);
+    m_materials.append(material);
+    m_dirty.append(ALL_FRAMES);
+    m_slots.append(slot);
+
+    ObjectHandle handle;
+    handle.slot = slot;
+    handle.generation = m_generations[slot];
+    return handle;
+}
+
+bool Scene::remove(ObjectHandle handle) {
+    const int index = indexOf(handle);
+    if (index < 0)
+        return false;
+
+    // Move the last object into the hole so the arrays stay contiguous.
+    const int last = m_transforms.size() - 1;
+    if (index != last) {
+        m_transforms[index] = m_transforms[last];
+        m_bounds[index] = m_bounds[last];
+        m_meshes[index] = m_meshes[last];
+        m_materials[index] = m_materials[last];
+        m_slots[index] = m_slots[last];
+        m_dirty[index] = ALL_FRAMES;
+        m_indices[m_slots[index]] = index;
+    }
+
+    m_transforms.removeLast();
+    m_bounds.removeLast();
+    m_meshes.removeLast();
+    m_materials.removeLast();
+    m_dirty.removeLast();
+    m_slots.removeLast();
+
+    m_indices[handle.slot] = -1;
+    ++m_generations[handle.slot];
+    m_freeSlots.append(handle.slot);
+
+    return true;
+}
+
+void Scene::clear() {
+    for (quint32 slot : m_slots) {
+        m_indices[slot] = -1;
+        ++m_generations[slot];
+        m_freeSlots.append(slot);
+    }
+
+    m_transforms.clear();
+    m_bounds.clear();
+    m_meshes.clear();
+    m_materials.clear();
+    m_dirty.clear();
+    m_slots.clear();
+}
+
+int Scene::indexOf(ObjectHandle handle) const {
+    if (handle.slot >= static_cast<quint32>(m_indices.size())
+        || m_generations[handle.slot] != handle.generation)
+        return -1;
+
+    return m_indices[handle.slot];
+}
+
+ObjectHandle Scene::handleAt(int index) const {
+    ObjectHandle handle;
+    handle.slot = m_slots[index];
+    handle.generation = m_generations[handle.slot];
+    return handle;
+}
+
+void Scene::setTransform(ObjectHandle handle, const QMatrix4x4 &transform, const QVector4D &bounds) {
+    const int index = indexOf(handle);
+    if (index < 0)
+        return;
+
+    m_transforms[index] = transform;
+    m_bounds[index] = bounds;
+    m_dirty[index] = ALL_FRAMES;
+}
+
+void Scene::setMaterial(ObjectHandle handle, int material) {
+    const int index = indexOf(handle);
+    if (index < 0)
+        return;
+
+    m_materials[index] = material;
+    m_dirty[index] = ALL_FRAMES;
+}
+
+void Scene::markAllDirty() {
+    m_dirty.fill(ALL_FRAMES);
+}
+
+bool Scene::hasDirty(quint8 frameMask) const {
+    for (quint8 dirty : m_dirty) {
+        if (dirty & frameMask)
+            return true;
+    }
+    return false;
+}
+
+void Scene::clearDirty(quint8 frameMask) {
+    const quint8 keep = quint8(~frameMask);
+    for (quint8 &dirty : m_dirty)
+        dirty &= keep;
+}
@@ -0,0 +1,87 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <QMatrix4x4>
+#include <QVector>
+#include <QVector4D>
+
+struct ObjectHandle
+{
+    quint32 slot = 0xffffffffu;
+    quint32 generation = 0;
+
+    bool isNull() const {
+        return slot == 0xffffffffu;
+    }
+};
+
+class Scene
+{
+public:
+    ObjectHandle add(int mesh, int material, const QMatrix4x4 &transform, const QVector4D &bounds);
+    bool remove(ObjectHandle handle);
+    void clear();
+
+    bool contains(ObjectHandle handle) const {
+        return indexOf(handle) >= 0;
+    }
+
+    int indexOf(ObjectHandle handle) const;
+    ObjectHandle handleAt(int index) const;
+
+    void setTransform(ObjectHandle handle, const QMatrix4x4 &transform, const QVector4D &bounds);
+    void setMaterial(ObjectHandle handle, int material);
+
+    void markDirty(int index) {
+        m_dirty[index] = ALL_FRAMES;
+    }
+
+    void markAllDirty();
+    bool hasDirty(quint8 frameMask) const;
+    void clearDirty(quint8 frameMask);
+
+    int size() const {
+        return m_transforms.size();
+    }
+
+    bool isEmpty() const {
+        return m_transforms.isEmpty();
+    }
+
+    const QVector<QMatrix4x4> &transforms() const {
+        return m_transforms;
+    }
+
+    const QVector<QVector4D> &bounds() const {
+        return m_bounds;
+    }
+
+    const QVector<int> &meshes() const {
+        return m_meshes;
+    }
+
+    const QVector<int> &materials() const {
+        return m_materials;
+    }
+
+private:
+    // One bit per frame in flight. Model matrices are pushed while recording,
+    // so the bits only keep the render scheduler drawing and the streamed
+    // texture levels refreshed for each frame after a change.
+    enum : quint8 { ALL_FRAMES = 0xff };
+
+    // Dense arrays, indexed by object index and compacted on removal.
+    QVector<QMatrix4x4> m_transforms;
+    QVector<QVector4D> m_bounds;
+    QVector<int> m_meshes;
+    QVector<int> m_materials;
+    QVector<quint8> m_dirty;
+    QVector<quint32> m_slots;
+
+    // Sparse handle slots pointing into the dense arrays.
+    QVector<int> m_indices;
+    QVector<quint32> m_generations;
+    QVector<quint32> m_freeSlots;
+};
+
+#endif // SCENE_H
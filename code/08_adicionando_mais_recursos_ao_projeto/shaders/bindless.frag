@@ -0,0 +1,62 @@
+#version 450
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) in vec3 fragNormal;
+layout(location = 3) in vec3 fragViewVec;
+layout(location = 4) in vec3 fragLightVec;
+
+layout(constant_id = 0) const uint TEXTURE_COUNT = 1;
+layout(constant_id = 1) const bool LIT = true;
+layout(constant_id = 2) const bool TEXTURED = true;
+layout(constant_id = 3) const bool VERTEX_COLOR = false;
+layout(constant_id = 4) const uint DEBUG_VIEW = 0;
+
+const uint DEBUG_VIEW_NORMALS = 1;
+const uint DEBUG_VIEW_TEXCOORDS = 2;
+
+layout(set = 1, binding = 0) uniform sampler2D textures[TEXTURE_COUNT];
+
+layout(push_constant) uniform ObjectParams {
+    layout(offset = 64) uint textureIndex;
+} object;
+
+layout(location = 0) out vec4 outColor;
+
+
+const vec3 ambientLightColor = vec3(0.1);
+const vec3 diffuseLightColor = vec3(1.0);
+const vec3 specularLightColor = vec3(1.0);
+const float shininess = 16.0;
+
+void main() {
+    if (DEBUG_VIEW == DEBUG_VIEW_NORMALS) {
+        outColor = vec4(normalize(fragNormal) * 0.5 + 0.5, 1.0);
+        return;
+    }
+    if (DEBUG_VIEW == DEBUG_VIEW_TEXCOORDS) {
+        outColor = vec4(fract(fragTexCoord), 0.0, 1.0);
+        return;
+    }
+
+    vec4 color = vec4(1.0);
+    if (TEXTURED)
+        color = texture(textures[object.textureIndex], fragTexCoord);
+    if (VERTEX_COLOR)
+        color.rgb *= fragColor;
+
+    if (LIT) {
+        vec3 n = normalize(fragNormal);
+        vec3 l = normalize(fragLightVec);
+        vec3 v = normalize(fragViewVec);
+        vec3 r = reflect(l, n);
+
+        vec3 ambient = ambientLightColor;
+        vec3 diffuse = diffuseLightColor * max(dot(n, l), 0.0);
+        vec3 specular = specularLightColor * pow(max(dot(r, v), 0.0), shininess);
+
+        color.rgb *= ambient + diffuse + specular;
+    }
+
+    outColor = color;
+}
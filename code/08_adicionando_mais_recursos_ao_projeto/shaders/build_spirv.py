@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+#
+# Compiles a GLSL shader to SPIR-V, optimizes and validates it, and writes a
+# header embedding the words as a constexpr array.
+#
+#   build_spirv.py <input> <output.h> [spirv-opt flags...]
+#
+# The default optimization is -O; pass -Os to favor size instead.
+
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+
+SPIRV_MAGIC = 0x07230203
+SPIRV_HEADER_WORDS = 5
+
+
+def run(command):
+    result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                            universal_newlines=True)
+    if result.returncode != 0:
+        sys.stderr.write(result.stdout)
+        sys.exit("%s failed for %s" % (command[0], command[-1]))
+
+
+def read_words(path):
+    with open(path, 'rb') as file:
+        data = file.read()
+    if len(data) % 4 != 0:
+        sys.exit("%s is not a whole number of SPIR-V words" % path)
+    words = struct.unpack('<%dI' % (len(data) // 4), data)
+    if not words or words[0] != SPIRV_MAGIC:
+        sys.exit("%s is not little-endian SPIR-V" % path)
+    return words
+
+
+def instruction_count(words):
+    count = 0
+    offset = SPIRV_HEADER_WORDS
+    while offset < len(words):
+        length = words[offset] >> 16
+        if length == 0:
+            sys.exit("Malformed SPIR-V instruction at word %d" % offset)
+        offset += length
+        count += 1
+    return count
+
+
+def identifier(file_name):
+    # shader.vert -> shaderVert, virtualtexture.frag -> virtualtextureFrag
+    base, stage = file_name.split('.', 1)
+    return base + stage[0].upper() + stage[1:]
+
+
+def write_header(path, source_name, words):
+    name = identifier(source_name)
+    lines = [
+        "// Generated from %s by build_spirv.py; do not edit." % source_name,
+        "",
+        "constexpr uint32_t %sCode[] = {" % name,
+    ]
+    for offset in range(0, len(words), 8):
+        lines.append("    " + ", ".join("0x%08x" % word for word in words[offset:offset + 8]) + ",")
+    lines += [
+        "};",
+        "",
+        "constexpr SpirvModule %s = {%sCode, sizeof(%sCode)};" % (name, name, name),
+        "",
+    ]
+
+    with open(path, 'w') as file:
+        file.write("\n".join(lines))
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit("usage: build_spirv.py <input> <output.h> [spirv-opt flags...]")
+
+    source = sys.argv[1]
+    output = sys.argv[2]
+    optimization = sys.argv[3:] or ['-O']
+    source_name = os.path.basename(source)
+
+    os.makedirs(os.path.dirname(os.path.abspath(output)), exist_ok=True)
+
+    with tempfile.TemporaryDirectory() as directory:
+        compiled = os.path.join(directory, source_name + '.spv')
+        optimized = os.path.join(directory, source_name + '.opt.spv')
+
+        run(['glslangValidator', '-V', '-o', compiled, source])
+        run(['spirv-opt'] + optimization + ['-o', optimized, compiled])
+        run(['spirv-val', optimized])
+
+        before = instruction_count(read_words(compiled))
+        words = read_words(optimized)
+        after = instruction_count(words)
+
+    write_header(output, source_name, words)
+
+    change = 100.0 * (after - before) / before if before else 0.0
+    print("%s: %d -> %d instructions (%+.1f%%), %d bytes"
+          % (source_name, before, after, change, len(words) * 4))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,23 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform FrameUniforms {
+    mat4 scene;
+    mat4 view;
+    mat4 proj;
+    vec3 lightPosition;
+} frame;
+
+layout(push_constant) uniform ObjectParams {
+    mat4 model;
+} object;
+
+layout(location = 0) in vec3 inPosition;
+
+// Must match shader.vert bit for bit for the depth prepass EQUAL test.
+invariant gl_Position;
+
+void main() {
+    mat4 model = frame.scene * object.model;
+    vec4 worldPos = model * vec4(inPosition, 1.0);
+    gl_Position = frame.proj * frame.view * worldPos;
+}
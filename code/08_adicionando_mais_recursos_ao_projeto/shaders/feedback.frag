@@ -0,0 +1,29 @@
+#version 450
+
+layout(location = 1) in vec2 fragTexCoord;
+
+layout(push_constant) uniform VirtualTextureParams {
+    layout(offset = 64) vec2 uvScale;
+    vec2 physicalScale;
+    float pageCount;
+    float maxLevel;
+    float lodBias;
+} vt;
+
+layout(location = 0) out uint outPage;
+
+const float PAGE_SIZE = 128.0;
+
+void main() {
+    vec2 texelCoord = fragTexCoord * vt.uvScale * vt.pageCount * PAGE_SIZE;
+    vec2 dx = dFdx(texelCoord);
+    vec2 dy = dFdy(texelCoord);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + vt.lodBias;
+    uint level = uint(clamp(floor(lod), 0.0, vt.maxLevel));
+
+    float pagesAtLevel = max(1.0, vt.pageCount / exp2(float(level)));
+    vec2 uv = fract(fragTexCoord) * vt.uvScale;
+    uvec2 page = uvec2(min(floor(uv * pagesAtLevel), vec2(pagesAtLevel - 1.0)));
+
+    outPage = 0x80000000u | (level << 24) | (page.y << 12) | page.x;
+}
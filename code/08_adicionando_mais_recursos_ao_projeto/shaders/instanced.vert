@@ -0,0 +1,37 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform FrameUniforms {
+    mat4 scene;
+    mat4 view;
+    mat4 proj;
+    vec3 lightPosition;
+} frame;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inTexCoord;
+layout(location = 3) in vec3 inNormal;
+
+layout(location = 4) in mat4 instanceModel;
+layout(location = 8) in vec4 instanceTint;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) out vec3 fragNormal;
+layout(location = 3) out vec3 fragViewVec;
+layout(location = 4) out vec3 fragLightVec;
+
+void main() {
+    mat4 model = frame.scene * instanceModel;
+    vec4 worldPos = model * vec4(inPosition, 1.0);
+    gl_Position = frame.proj * frame.view * worldPos;
+
+    fragColor = inColor * instanceTint.rgb;
+    fragTexCoord = inTexCoord;
+
+    // Instances are placed with uniform scale, so the normal matrix is the
+    // model matrix itself and no per-vertex inverse is needed.
+    fragNormal = mat3(model) * inNormal;
+    fragViewVec = (frame.view * worldPos).xyz;
+    fragLightVec = frame.lightPosition - vec3(worldPos);
+}
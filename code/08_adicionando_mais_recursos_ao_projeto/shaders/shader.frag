@@ -6,7 +6,15 @@ layout(location = 2) in vec3 fragNormal;
 layout(location = 3) in vec3 fragViewVec;
 layout(location = 4) in vec3 fragLightVec;
 
-layout(set = 0, binding = 0) uniform sampler2D texSampler;
+layout(set = 1, binding = 0) uniform sampler2D texSampler;
+
+layout(constant_id = 1) const bool LIT = true;
+layout(constant_id = 2) const bool TEXTURED = true;
+layout(constant_id = 3) const bool VERTEX_COLOR = false;
+layout(constant_id = 4) const uint DEBUG_VIEW = 0;
+
+const uint DEBUG_VIEW_NORMALS = 1;
+const uint DEBUG_VIEW_TEXCOORDS = 2;
 
 layout(location = 0) out vec4 outColor;
 
@@ -17,16 +25,33 @@ const vec3 specularLightColor = vec3(1.0);
 const float shininess = 16.0;
 
 void main() {
-    
-    vec3 n = normalize(fragNormal);
-    vec3 l = normalize(fragLightVec);
-    vec3 v = normalize(fragViewVec);
-    vec3 r = reflect(l, n);
-    
-    vec3 ambient = ambientLightColor;
-    vec3 diffuse = diffuseLightColor * max(dot(n, l), 0.0);
-    vec3 specular = specularLightColor * pow(max(dot(r, v), 0.0), shininess);
-    
-    outColor = texture(texSampler, fragTexCoord) *
-    vec4(ambient + diffuse + specular, 1.0);
+    if (DEBUG_VIEW == DEBUG_VIEW_NORMALS) {
+        outColor = vec4(normalize(fragNormal) * 0.5 + 0.5, 1.0);
+        return;
+    }
+    if (DEBUG_VIEW == DEBUG_VIEW_TEXCOORDS) {
+        outColor = vec4(fract(fragTexCoord), 0.0, 1.0);
+        return;
+    }
+
+    vec4 color = vec4(1.0);
+    if (TEXTURED)
+        color = texture(texSampler, fragTexCoord);
+    if (VERTEX_COLOR)
+        color.rgb *= fragColor;
+
+    if (LIT) {
+        vec3 n = normalize(fragNormal);
+        vec3 l = normalize(fragLightVec);
+        vec3 v = normalize(fragViewVec);
+        vec3 r = reflect(l, n);
+
+        vec3 ambient = ambientLightColor;
+        vec3 diffuse = diffuseLightColor * max(dot(n, l), 0.0);
+        vec3 specular = specularLightColor * pow(max(dot(r, v), 0.0), shininess);
+
+        color.rgb *= ambient + diffuse + specular;
+    }
+
+    outColor = color;
 }
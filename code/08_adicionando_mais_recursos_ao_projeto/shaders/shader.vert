@@ -1,11 +1,20 @@
 #version 450
 
-layout(set = 0, binding = 1) uniform UniformBufferObject {
-    mat4 model;
+layout(set = 0, binding = 0) uniform FrameUniforms {
+    mat4 scene;
     mat4 view;
     mat4 proj;
     vec3 lightPosition;
-} ubo;
+} frame;
+
+layout(push_constant) uniform ObjectParams {
+    mat4 model;
+} object;
+
+layout(constant_id = 1) const bool LIT = true;
+layout(constant_id = 4) const uint DEBUG_VIEW = 0;
+
+const uint DEBUG_VIEW_NORMALS = 1;
 
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
@@ -18,15 +27,27 @@ layout(location = 2) out vec3 fragNormal;
 layout(location = 3) out vec3 fragViewVec;
 layout(location = 4) out vec3 fragLightVec;
 
+// Must match depth.vert bit for bit for the depth prepass EQUAL test.
+invariant gl_Position;
+
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model *
-    vec4(inPosition, 1.0);
+    mat4 model = frame.scene * object.model;
+    vec4 worldPos = model * vec4(inPosition, 1.0);
+    gl_Position = frame.proj * frame.view * worldPos;
     
     fragColor = inColor;
     fragTexCoord = inTexCoord;
     
-    vec4 worldPos = ubo.model * vec4(inPosition, 1.0);
-    fragNormal = mat3(inverse(transpose(ubo.model))) * inNormal;
-    fragViewVec = (ubo.view * worldPos).xyz;
-    fragLightVec = ubo.lightPosition - vec3(worldPos);
+    fragNormal = vec3(0.0);
+    fragViewVec = vec3(0.0);
+    fragLightVec = vec3(0.0);
+
+    // The normal matrix is the expensive part, so unlit variants skip it.
+    if (LIT || DEBUG_VIEW == DEBUG_VIEW_NORMALS)
+        fragNormal = mat3(inverse(transpose(model))) * inNormal;
+
+    if (LIT) {
+        fragViewVec = (frame.view * worldPos).xyz;
+        fragLightVec = frame.lightPosition - vec3(worldPos);
+    }
 }
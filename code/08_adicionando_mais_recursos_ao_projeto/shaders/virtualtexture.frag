@@ -0,0 +1,90 @@
+#version 450
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) in vec3 fragNormal;
+layout(location = 3) in vec3 fragViewVec;
+layout(location = 4) in vec3 fragLightVec;
+
+layout(set = 1, binding = 0) uniform sampler2D physicalCache;
+layout(set = 1, binding = 1) uniform sampler2D indirection;
+
+layout(constant_id = 1) const bool LIT = true;
+layout(constant_id = 2) const bool TEXTURED = true;
+layout(constant_id = 3) const bool VERTEX_COLOR = false;
+layout(constant_id = 4) const uint DEBUG_VIEW = 0;
+
+const uint DEBUG_VIEW_NORMALS = 1;
+const uint DEBUG_VIEW_TEXCOORDS = 2;
+
+layout(push_constant) uniform VirtualTextureParams {
+    layout(offset = 64) vec2 uvScale;
+    vec2 physicalScale;
+    float pageCount;
+    float maxLevel;
+    float lodBias;
+} vt;
+
+layout(location = 0) out vec4 outColor;
+
+const float PAGE_SIZE = 128.0;
+const float PAGE_BORDER = 4.0;
+const float PAGE_SLOT_SIZE = PAGE_SIZE + 2.0 * PAGE_BORDER;
+
+const vec4 missingPageColor = vec4(0.5, 0.5, 0.5, 1.0);
+
+const vec3 ambientLightColor = vec3(0.1);
+const vec3 diffuseLightColor = vec3(1.0);
+const vec3 specularLightColor = vec3(1.0);
+const float shininess = 16.0;
+
+vec4 sampleVirtualTexture(vec2 texCoord) {
+    vec2 texelCoord = texCoord * vt.uvScale * vt.pageCount * PAGE_SIZE;
+    vec2 dx = dFdx(texelCoord);
+    vec2 dy = dFdy(texelCoord);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + vt.lodBias;
+    float level = clamp(floor(lod), 0.0, vt.maxLevel);
+
+    vec2 uv = fract(texCoord) * vt.uvScale;
+    vec4 entry = textureLod(indirection, uv, level) * 255.0;
+    if (entry.a < 0.5)
+        return missingPageColor;
+
+    float pagesAtLevel = max(1.0, vt.pageCount / exp2(entry.b));
+    vec2 inPage = fract(uv * pagesAtLevel) * PAGE_SIZE;
+    vec2 physical = floor(entry.rg + 0.5) * PAGE_SLOT_SIZE + PAGE_BORDER + inPage;
+
+    return textureLod(physicalCache, physical * vt.physicalScale, 0.0);
+}
+
+void main() {
+    if (DEBUG_VIEW == DEBUG_VIEW_NORMALS) {
+        outColor = vec4(normalize(fragNormal) * 0.5 + 0.5, 1.0);
+        return;
+    }
+    if (DEBUG_VIEW == DEBUG_VIEW_TEXCOORDS) {
+        outColor = vec4(fract(fragTexCoord), 0.0, 1.0);
+        return;
+    }
+
+    vec4 color = vec4(1.0);
+    if (TEXTURED)
+        color = sampleVirtualTexture(fragTexCoord);
+    if (VERTEX_COLOR)
+        color.rgb *= fragColor;
+
+    if (LIT) {
+        vec3 n = normalize(fragNormal);
+        vec3 l = normalize(fragLightVec);
+        vec3 v = normalize(fragViewVec);
+        vec3 r = reflect(l, n);
+
+        vec3 ambient = ambientLightColor;
+        vec3 diffuse = diffuseLightColor * max(dot(n, l), 0.0);
+        vec3 specular = specularLightColor * pow(max(dot(r, v), 0.0), shininess);
+
+        color.rgb *= ambient + diffuse + specular;
+    }
+
+    outColor = color;
+}
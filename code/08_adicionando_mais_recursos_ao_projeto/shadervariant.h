@@ -0,0 +1,55 @@
+#ifndef SHADERVARIANT_H
+#define SHADERVARIANT_H
+
+#include "pipelinecompiler.h"
+
+enum class MaterialShader : quint32 {
+    Descriptor,
+    Bindless,
+    Atlas,
+    VirtualTexture
+};
+
+enum ShaderFeature : quint32 {
+    ShaderLit = 0x1,
+    ShaderTextured = 0x2,
+    ShaderVertexColor = 0x4
+};
+
+enum class ShaderDebugView : quint32 {
+    None,
+    Normals,
+    TexCoords,
+    Count
+};
+
+// Every shading field maps to a specialization constant shared by shader.vert
+// and the material fragment shaders, so the driver drops the disabled paths.
+struct ShaderVariant
+{
+    MaterialShader material = MaterialShader::Descriptor;
+    quint32 features = 0;
+    ShaderDebugView debugView = ShaderDebugView::None;
+
+    // Shades only the fragments whose depth the prepass already laid down.
+    bool depthEqual = false;
+
+    quint32 key() const {
+        return (quint32(depthEqual) << 24) | (quint32(material) << 16)
+            | (quint32(debugView) << 8) | features;
+    }
+
+    void specialize(GraphicsPipelineDescription &description) const {
+        description.addConstant(1, (features & ShaderLit) ? 1 : 0);
+        description.addConstant(2, (features & ShaderTextured) ? 1 : 0);
+        description.addConstant(3, (features & ShaderVertexColor) ? 1 : 0);
+        description.addConstant(4, quint32(debugView));
+
+        if (depthEqual) {
+            description.depthCompareOp = VK_COMPARE_OP_EQUAL;
+            description.depthWrite = false;
+        }
+    }
+};
+
+#endif // SHADERVARIANT_H
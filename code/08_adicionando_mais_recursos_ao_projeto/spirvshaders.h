@@ -0,0 +1,26 @@
+#ifndef SPIRVSHADERS_H
+#define SPIRVSHADERS_H
+
+#include <cstddef>
+#include <cstdint>
+
+struct SpirvModule
+{
+    const uint32_t *code;
+    size_t size;
+};
+
+// Compiled, optimized and validated by shaders/build_spirv.py during the
+// build; see the Shaders list in myqtvkproject.pro.
+#include "shader.vert.spv.h"
+#include "shader.frag.spv.h"
+#include "virtualtexture.frag.spv.h"
+#include "feedback.frag.spv.h"
+#include "bindless.frag.spv.h"
+#include "atlas.frag.spv.h"
+#include "instanced.vert.spv.h"
+#include "instanced.frag.spv.h"
+#include "cull.comp.spv.h"
+#include "depth.vert.spv.h"
+
+#endif // SPIRVSHADERS_H
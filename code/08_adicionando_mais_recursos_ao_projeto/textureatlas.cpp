@@ -0,0 +1,477 @@
+#include "textureatlas.h"
+
+#include <QVector>
+#include <algorithm>
+
+#include "renderer.h"
+#include "uploadbatch.h"
+#include "vulkanwindow.h"
+
+void TextureAtlas::create(Renderer *renderer,
+                          VulkanWindow *window,
+                          QVulkanDeviceFunctions *deviceFunctions,
+                          UploadBatch *uploadBatch) {
+    m_renderer = renderer;
+    m_window = window;
+    m_deviceFunctions = deviceFunctions;
+    m_uploadBatch = uploadBatch;
+
+    VkDevice device = m_window->device();
+
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerInfo.mipLodBias = 0.0f;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = float(ATLAS_LEVEL_COUNT - 1);
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.anisotropyEnable = VK_FALSE;
+    samplerInfo.maxAnisotropy = 1.0;
+    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+    samplerInfo.compareEnable = VK_FALSE;
+    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+
+    VkResult result = m_deviceFunctions->vkCreateSampler(
+        device,
+        &samplerInfo,
+        nullptr,
+        &m_sampler
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create texture atlas sampler: %d", result);
+    }
+
+    VkDescriptorSetLayoutBinding binding = {};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    binding.pImmutableSamplers = nullptr;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &binding;
+
+    result = m_deviceFunctions->vkCreateDescriptorSetLayout(
+        device,
+        &layoutInfo,
+        nullptr,
+        &m_descriptorSetLayout
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create texture atlas descriptor set layout: %d", result);
+    }
+
+    createDescriptorSet();
+}
+
+void TextureAtlas::createDescriptorSet() {
+    VkDevice device = m_window->device();
+
+    VkDescriptorPoolSize poolSize = {};
+    poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSize.descriptorCount = 1;
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = 1;
+
+    VkResult result = m_deviceFunctions->vkCreateDescriptorPool(
+        device,
+        &poolInfo,
+        nullptr,
+        &m_descriptorPool
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create texture atlas descriptor pool: %d", result);
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = m_descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &m_descriptorSetLayout;
+
+    result = m_deviceFunctions->vkAllocateDescriptorSets(
+        device,
+        &allocInfo,
+        &m_descriptorSet
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to allocate texture atlas descriptor set: %d", result);
+    }
+}
+
+bool TextureAtlas::load(const QString &directory) {
+    if (!m_builder.load(directory))
+        return false;
+
+    m_dirty = true;
+    return true;
+}
+
+int TextureAtlas::findTexture(const QString &key) const {
+    return m_builder.find(key);
+}
+
+int TextureAtlas::addTexture(const QString &key, const QImage &image) {
+    const int entryCount = m_builder.entryCount();
+    const int entry = m_builder.add(key, image);
+
+    if (m_builder.entryCount() != entryCount)
+        m_dirty = true;
+
+    return entry;
+}
+
+TextureAtlasParams TextureAtlas::params(int entry) const {
+    const TextureAtlasEntry &atlasEntry = m_builder.entry(entry);
+    const float layerSize = float(ATLAS_LAYER_SIZE);
+
+    TextureAtlasParams params = {};
+    params.uvTransform[0] = atlasEntry.rect.width() / layerSize;
+    params.uvTransform[1] = atlasEntry.rect.height() / layerSize;
+    params.uvTransform[2] = atlasEntry.rect.x() / layerSize;
+    params.uvTransform[3] = atlasEntry.rect.y() / layerSize;
+    params.layer = uint32_t(atlasEntry.layer);
+
+    return params;
+}
+
+// Returns true when the descriptor set was replaced. The image is only
+// reallocated when the layer count changes; entries added to existing
+// layers are uploaded into it in place by the frame's command buffer.
+bool TextureAtlas::update(VkCommandBuffer commandBuffer) {
+    if (!m_dirty || m_builder.layerCount() == 0)
+        return false;
+
+    const uint32_t layerCount = uint32_t(m_builder.layerCount());
+    const bool reallocate = !m_image || layerCount != m_layerCount;
+
+    if (!reallocate) {
+        updateLayers(commandBuffer);
+        m_builder.clearDirtyLayers();
+        m_dirty = false;
+        return false;
+    }
+
+    if (m_image) {
+        DeletionQueue *deletionQueue = m_renderer->deletionQueue();
+        deletionQueue->destroyImage(m_image, m_imageView, m_imageMemory);
+        deletionQueue->destroyDescriptorPool(m_descriptorPool);
+        m_image = VK_NULL_HANDLE;
+        m_imageView = VK_NULL_HANDLE;
+
+        createDescriptorSet();
+    }
+
+    createImage(layerCount);
+    uploadLayers(layerCount);
+
+    VkDescriptorImageInfo imageInfo = {};
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfo.imageView = m_imageView;
+    imageInfo.sampler = m_sampler;
+
+    VkWriteDescriptorSet descriptorWrite = {};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = m_descriptorSet;
+    descriptorWrite.dstBinding = 0;
+    descriptorWrite.dstArrayElement = 0;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pImageInfo = &imageInfo;
+
+    m_deviceFunctions->vkUpdateDescriptorSets(
+        m_window->device(),
+        1,
+        &descriptorWrite,
+        0,
+        nullptr
+    );
+
+    m_builder.clearDirtyLayers();
+    m_dirty = false;
+    return true;
+}
+
+void TextureAtlas::createImage(uint32_t layerCount) {
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    imageInfo.extent.width = ATLAS_LAYER_SIZE;
+    imageInfo.extent.height = ATLAS_LAYER_SIZE;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = ATLAS_LEVEL_COUNT;
+    imageInfo.arrayLayers = layerCount;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkDevice device = m_window->device();
+    VkResult result = m_deviceFunctions->vkCreateImage(device, &imageInfo, nullptr, &m_image);
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create texture atlas image: %d", result);
+    }
+    m_layerCount = layerCount;
+
+    m_imageMemory = m_renderer->memoryAllocator()->allocateForImage(
+        m_image,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        MemoryUsage::Texture,
+        "texture atlas"
+    );
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = m_image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    viewInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    viewInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+    viewInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+    viewInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+    viewInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = ATLAS_LEVEL_COUNT;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = layerCount;
+
+    result = m_deviceFunctions->vkCreateImageView(device, &viewInfo, nullptr, &m_imageView);
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create texture atlas image view: %d", result);
+    }
+}
+
+void TextureAtlas::stageLayers(const QVector<uint32_t> &layers,
+                               VkBuffer &stagingBuffer,
+                               MemoryAllocation &stagingBufferMemory,
+                               QVector<VkBufferImageCopy> &regions) {
+    VkDeviceSize layerBytes = 0;
+    for (int level = 0; level < ATLAS_LEVEL_COUNT; ++level) {
+        const VkDeviceSize size = VkDeviceSize(ATLAS_LAYER_SIZE >> level);
+        layerBytes += size * size * 4;
+    }
+    const VkDeviceSize bufferSize = layerBytes * VkDeviceSize(layers.size());
+
+    m_renderer->createBuffer(
+        bufferSize,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        stagingBuffer,
+        stagingBufferMemory,
+        MemoryUsage::Staging,
+        "texture atlas"
+    );
+
+    quint8 *data = stagingBufferMemory.mapped;
+
+    VkDeviceSize offset = 0;
+    for (uint32_t layer : layers) {
+        for (int level = 0; level < ATLAS_LEVEL_COUNT; ++level) {
+            const QImage image = m_builder.layerLevel(int(layer), level);
+            const size_t imageBytes = size_t(image.sizeInBytes());
+            memcpy(data + offset, image.constBits(), imageBytes);
+
+            VkBufferImageCopy region = {};
+            region.bufferOffset = offset;
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.mipLevel = uint32_t(level);
+            region.imageSubresource.baseArrayLayer = layer;
+            region.imageSubresource.layerCount = 1;
+            region.imageExtent.width = uint32_t(image.width());
+            region.imageExtent.height = uint32_t(image.height());
+            region.imageExtent.depth = 1;
+            regions.append(region);
+
+            offset += imageBytes;
+        }
+    }
+}
+
+void TextureAtlas::uploadLayers(uint32_t layerCount) {
+    QVector<uint32_t> layers;
+    for (uint32_t layer = 0; layer < layerCount; ++layer)
+        layers.append(layer);
+
+    VkBuffer stagingBuffer;
+    MemoryAllocation stagingBufferMemory;
+    QVector<VkBufferImageCopy> regions;
+    stageLayers(layers, stagingBuffer, stagingBufferMemory, regions);
+
+    VkCommandBuffer commandBuffer = m_uploadBatch->commandBuffer();
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = m_image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = ATLAS_LEVEL_COUNT;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = layerCount;
+
+    m_deviceFunctions->vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        0,
+        nullptr,
+        0,
+        nullptr,
+        1,
+        &barrier
+    );
+
+    m_deviceFunctions->vkCmdCopyBufferToImage(
+        commandBuffer,
+        stagingBuffer,
+        m_image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        static_cast<uint32_t>(regions.size()),
+        regions.constData()
+    );
+
+    m_uploadBatch->releaseImageToGraphics(
+        m_image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+    );
+
+    m_uploadBatch->retainStagingBuffer(stagingBuffer, stagingBufferMemory);
+}
+
+// Recorded on the graphics queue so the barriers also wait for earlier
+// frames that may still be sampling the layers being rewritten.
+void TextureAtlas::updateLayers(VkCommandBuffer commandBuffer) {
+    QVector<uint32_t> layers;
+    for (int layer : m_builder.dirtyLayers())
+        layers.append(uint32_t(layer));
+    std::sort(layers.begin(), layers.end());
+    if (layers.isEmpty())
+        return;
+
+    VkBuffer stagingBuffer;
+    MemoryAllocation stagingBufferMemory;
+    QVector<VkBufferImageCopy> regions;
+    stageLayers(layers, stagingBuffer, stagingBufferMemory, regions);
+
+    QVector<VkImageMemoryBarrier> barriers;
+    for (uint32_t layer : layers) {
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = m_image;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = ATLAS_LEVEL_COUNT;
+        barrier.subresourceRange.baseArrayLayer = layer;
+        barrier.subresourceRange.layerCount = 1;
+        barriers.append(barrier);
+    }
+
+    m_deviceFunctions->vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        0,
+        nullptr,
+        0,
+        nullptr,
+        uint32_t(barriers.size()),
+        barriers.constData()
+    );
+
+    m_deviceFunctions->vkCmdCopyBufferToImage(
+        commandBuffer,
+        stagingBuffer,
+        m_image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        static_cast<uint32_t>(regions.size()),
+        regions.constData()
+    );
+
+    for (VkImageMemoryBarrier &barrier : barriers) {
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    }
+
+    m_deviceFunctions->vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        0,
+        0,
+        nullptr,
+        0,
+        nullptr,
+        uint32_t(barriers.size()),
+        barriers.constData()
+    );
+
+    m_renderer->deletionQueue()->destroyBuffer(stagingBuffer, stagingBufferMemory);
+}
+
+void TextureAtlas::releaseImage() {
+    VkDevice device = m_window->device();
+
+    if (m_imageView) {
+        m_deviceFunctions->vkDestroyImageView(device, m_imageView, nullptr);
+        m_imageView = VK_NULL_HANDLE;
+    }
+
+    if (m_image) {
+        m_deviceFunctions->vkDestroyImage(device, m_image, nullptr);
+        m_image = VK_NULL_HANDLE;
+    }
+
+    m_renderer->memoryAllocator()->free(m_imageMemory);
+    m_layerCount = 0;
+}
+
+void TextureAtlas::release() {
+    if (!m_descriptorSetLayout) {
+        return;
+    }
+
+    VkDevice device = m_window->device();
+
+    releaseImage();
+
+    m_deviceFunctions->vkDestroyDescriptorPool(device, m_descriptorPool, nullptr);
+    m_deviceFunctions->vkDestroyDescriptorSetLayout(device, m_descriptorSetLayout, nullptr);
+    m_deviceFunctions->vkDestroySampler(device, m_sampler, nullptr);
+    m_descriptorPool = VK_NULL_HANDLE;
+    m_descriptorSet = VK_NULL_HANDLE;
+    m_descriptorSetLayout = VK_NULL_HANDLE;
+    m_sampler = VK_NULL_HANDLE;
+
+    m_dirty = m_builder.layerCount() > 0;
+}
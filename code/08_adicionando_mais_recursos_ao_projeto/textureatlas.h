@@ -0,0 +1,77 @@
+#ifndef TEXTUREATLAS_H
+#define TEXTUREATLAS_H
+
+#include <QVulkanDeviceFunctions>
+
+#include "memoryallocator.h"
+#include "textureatlasbuilder.h"
+
+class VulkanWindow;
+class Renderer;
+class UploadBatch;
+
+struct TextureAtlasParams {
+    float uvTransform[4];
+    uint32_t layer;
+};
+
+class TextureAtlas
+{
+public:
+    void create(Renderer *renderer,
+                VulkanWindow *window,
+                QVulkanDeviceFunctions *deviceFunctions,
+                UploadBatch *uploadBatch);
+    void release();
+
+    bool load(const QString &directory);
+    int findTexture(const QString &key) const;
+    int addTexture(const QString &key, const QImage &image);
+    bool update(VkCommandBuffer commandBuffer);
+
+    TextureAtlasParams params(int entry) const;
+
+    VkDescriptorSetLayout descriptorSetLayout() const {
+        return m_descriptorSetLayout;
+    }
+
+    VkDescriptorSet descriptorSet() const {
+        return m_descriptorSet;
+    }
+
+    bool isCreated() const {
+        return m_descriptorSetLayout != VK_NULL_HANDLE;
+    }
+
+private:
+    Renderer *m_renderer = nullptr;
+    VulkanWindow *m_window = nullptr;
+    QVulkanDeviceFunctions *m_deviceFunctions = nullptr;
+    UploadBatch *m_uploadBatch = nullptr;
+
+    TextureAtlasBuilder m_builder;
+    bool m_dirty = false;
+
+    VkImage m_image = VK_NULL_HANDLE;
+    MemoryAllocation m_imageMemory;
+    uint32_t m_layerCount = 0;
+    VkImageView m_imageView = VK_NULL_HANDLE;
+    VkSampler m_sampler = VK_NULL_HANDLE;
+
+    VkDescriptorSetLayout m_descriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool m_descriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSet m_descriptorSet = VK_NULL_HANDLE;
+
+private:
+    void createDescriptorSet();
+    void createImage(uint32_t layerCount);
+    void releaseImage();
+    void uploadLayers(uint32_t layerCount);
+    void updateLayers(VkCommandBuffer commandBuffer);
+    void stageLayers(const QVector<uint32_t> &layers,
+                     VkBuffer &stagingBuffer,
+                     MemoryAllocation &stagingBufferMemory,
+                     QVector<VkBufferImageCopy> &regions);
+};
+
+#endif // TEXTUREATLAS_H
@@ -0,0 +1,295 @@
+#include "textureatlasbuilder.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <algorithm>
+
+static const QString ATLAS_FILE_NAME = "atlas.json";
+
+static int alignToPadding(int value) {
+    return (value + ATLAS_PADDING - 1) / ATLAS_PADDING * ATLAS_PADDING;
+}
+
+static QString layerFileName(const QString &directory, int layer) {
+    return directory + QString("/layer%1.png").arg(layer);
+}
+
+bool TextureAtlasBuilder::fits(const QSize &imageSize) {
+    return imageSize.isValid()
+        && imageSize.width() <= ATLAS_MAX_TEXTURE_SIZE
+        && imageSize.height() <= ATLAS_MAX_TEXTURE_SIZE;
+}
+
+QString TextureAtlasBuilder::keyForPath(const QString &sourcePath) {
+    const QString canonicalPath = QFileInfo(sourcePath).canonicalFilePath();
+    return canonicalPath.isEmpty() ? sourcePath : canonicalPath;
+}
+
+int TextureAtlasBuilder::find(const QString &key) const {
+    return m_entryIndices.value(key, -1);
+}
+
+QPoint TextureAtlasBuilder::place(const QSize &cellSize, int &layer) {
+    int bestLayer = -1;
+    int bestShelf = -1;
+    int bestWaste = ATLAS_LAYER_SIZE;
+
+    for (int i = 0; i < m_shelves.size(); ++i) {
+        const QVector<Shelf> &shelves = m_shelves[i];
+        for (int j = 0; j < shelves.size(); ++j) {
+            const Shelf &shelf = shelves[j];
+            if (shelf.height < cellSize.height()
+                || shelf.x + cellSize.width() > ATLAS_LAYER_SIZE)
+                continue;
+
+            const int waste = shelf.height - cellSize.height();
+            if (waste < bestWaste) {
+                bestLayer = i;
+                bestShelf = j;
+                bestWaste = waste;
+            }
+        }
+    }
+
+    if (bestShelf < 0 || bestWaste > cellSize.height()) {
+        for (int i = 0; i < m_shelves.size(); ++i) {
+            QVector<Shelf> &shelves = m_shelves[i];
+            const int top = shelves.isEmpty() ? 0 : shelves.last().y + shelves.last().height;
+            if (top + cellSize.height() > ATLAS_LAYER_SIZE)
+                continue;
+
+            Shelf shelf;
+            shelf.y = top;
+            shelf.height = cellSize.height();
+            shelves.append(shelf);
+
+            bestLayer = i;
+            bestShelf = shelves.size() - 1;
+            break;
+        }
+    }
+
+    if (bestShelf < 0) {
+        Shelf shelf;
+        shelf.height = cellSize.height();
+        m_shelves.append(QVector<Shelf>() << shelf);
+
+        bestLayer = m_shelves.size() - 1;
+        bestShelf = 0;
+    }
+
+    Shelf &shelf = m_shelves[bestLayer][bestShelf];
+    const QPoint origin(shelf.x, shelf.y);
+    shelf.x += cellSize.width();
+
+    layer = bestLayer;
+    return origin;
+}
+
+int TextureAtlasBuilder::add(const QString &key, const QImage &image) {
+    const int existing = find(key);
+    if (existing >= 0)
+        return existing;
+
+    if (!fits(image.size()))
+        return -1;
+
+    const QSize cellSize(
+        alignToPadding(image.width() + 2 * ATLAS_PADDING),
+        alignToPadding(image.height() + 2 * ATLAS_PADDING)
+    );
+
+    TextureAtlasEntry entry;
+    entry.key = key;
+    const QPoint origin = place(cellSize, entry.layer);
+    entry.rect = QRect(
+        origin + QPoint(ATLAS_PADDING, ATLAS_PADDING),
+        image.size()
+    );
+
+    m_entries.append(entry);
+    m_images.append(image.convertToFormat(QImage::Format_RGBA8888));
+    m_entryIndices.insert(key, m_entries.size() - 1);
+    m_dirtyLayers.insert(entry.layer);
+
+    return m_entries.size() - 1;
+}
+
+void TextureAtlasBuilder::clear() {
+    m_entries.clear();
+    m_images.clear();
+    m_entryIndices.clear();
+    m_shelves.clear();
+    m_dirtyLayers.clear();
+}
+
+QImage TextureAtlasBuilder::layerLevel(int layer, int level) const {
+    const int size = ATLAS_LAYER_SIZE >> level;
+    const int gutter = ATLAS_PADDING >> level;
+    const int scale = 1 << level;
+
+    QImage result(size, size, QImage::Format_RGBA8888);
+    result.fill(Qt::transparent);
+
+    for (int i = 0; i < m_entries.size(); ++i) {
+        const TextureAtlasEntry &entry = m_entries[i];
+        if (entry.layer != layer)
+            continue;
+
+        const QSize levelSize(
+            (entry.rect.width() + scale - 1) / scale,
+            (entry.rect.height() + scale - 1) / scale
+        );
+        const QImage source = level == 0
+            ? m_images[i]
+            : m_images[i].scaled(levelSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+        const int originX = entry.rect.x() / scale;
+        const int originY = entry.rect.y() / scale;
+
+        for (int y = -gutter; y < levelSize.height() + gutter; ++y) {
+            const quint32 *sourceRow = reinterpret_cast<const quint32 *>(
+                source.constScanLine(qBound(0, y, levelSize.height() - 1))
+            );
+            quint32 *targetRow = reinterpret_cast<quint32 *>(result.scanLine(originY + y));
+
+            for (int x = -gutter; x < levelSize.width() + gutter; ++x)
+                targetRow[originX + x] = sourceRow[qBound(0, x, levelSize.width() - 1)];
+        }
+    }
+
+    return result;
+}
+
+bool TextureAtlasBuilder::save(const QString &directory) const {
+    if (!QDir().mkpath(directory)) {
+        qWarning("Failed to create atlas directory: %s", directory.toStdString().c_str());
+        return false;
+    }
+
+    for (int layer = 0; layer < layerCount(); ++layer) {
+        if (!layerLevel(layer, 0).save(layerFileName(directory, layer))) {
+            qWarning("Failed to write atlas layer %d", layer);
+            return false;
+        }
+    }
+
+    QJsonArray entries;
+    for (const TextureAtlasEntry &entry : m_entries) {
+        QJsonObject object;
+        object.insert("key", entry.key);
+        object.insert("layer", entry.layer);
+        object.insert("x", entry.rect.x());
+        object.insert("y", entry.rect.y());
+        object.insert("width", entry.rect.width());
+        object.insert("height", entry.rect.height());
+        entries.append(object);
+    }
+
+    QJsonObject root;
+    root.insert("layerSize", ATLAS_LAYER_SIZE);
+    root.insert("padding", ATLAS_PADDING);
+    root.insert("layerCount", layerCount());
+    root.insert("entries", entries);
+
+    QFile file(directory + "/" + ATLAS_FILE_NAME);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    file.write(QJsonDocument(root).toJson());
+
+    return true;
+}
+
+bool TextureAtlasBuilder::load(const QString &directory) {
+    QFile file(directory + "/" + ATLAS_FILE_NAME);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    const QJsonObject root = QJsonDocument::fromJson(file.readAll()).object();
+    if (root.value("layerSize").toInt() != ATLAS_LAYER_SIZE
+        || root.value("padding").toInt() != ATLAS_PADDING)
+        return false;
+
+    clear();
+
+    QVector<QImage> layers;
+    for (int layer = 0; layer < root.value("layerCount").toInt(); ++layer) {
+        QImage image(layerFileName(directory, layer));
+        if (image.size() != QSize(ATLAS_LAYER_SIZE, ATLAS_LAYER_SIZE)) {
+            qWarning("Failed to read atlas layer %d", layer);
+            return false;
+        }
+        layers.append(image.convertToFormat(QImage::Format_RGBA8888));
+
+        Shelf full;
+        full.height = ATLAS_LAYER_SIZE;
+        full.x = ATLAS_LAYER_SIZE;
+        m_shelves.append(QVector<Shelf>() << full);
+    }
+
+    for (const QJsonValue &value : root.value("entries").toArray()) {
+        const QJsonObject object = value.toObject();
+
+        TextureAtlasEntry entry;
+        entry.key = object.value("key").toString();
+        entry.layer = object.value("layer").toInt();
+        entry.rect = QRect(
+            object.value("x").toInt(),
+            object.value("y").toInt(),
+            object.value("width").toInt(),
+            object.value("height").toInt()
+        );
+
+        if (entry.layer < 0 || entry.layer >= layers.size()
+            || !QRect(0, 0, ATLAS_LAYER_SIZE, ATLAS_LAYER_SIZE).contains(entry.rect)) {
+            clear();
+            return false;
+        }
+
+        m_entries.append(entry);
+        m_images.append(layers[entry.layer].copy(entry.rect));
+        m_entryIndices.insert(entry.key, m_entries.size() - 1);
+    }
+
+    for (int layer = 0; layer < layers.size(); ++layer)
+        m_dirtyLayers.insert(layer);
+
+    return true;
+}
+
+bool TextureAtlasBuilder::build(const QStringList &sourcePaths, const QString &directory) {
+    QVector<QImage> images;
+    QStringList keys;
+
+    for (const QString &sourcePath : sourcePaths) {
+        QImage image(sourcePath);
+        if (image.isNull()) {
+            qWarning("Failed to load atlas texture: %s", sourcePath.toStdString().c_str());
+            continue;
+        }
+        if (!fits(image.size())) {
+            qWarning("Skipping %s: larger than %d pixels", sourcePath.toStdString().c_str(), ATLAS_MAX_TEXTURE_SIZE);
+            continue;
+        }
+
+        images.append(image);
+        keys.append(keyForPath(sourcePath));
+    }
+
+    QVector<int> order(images.size());
+    for (int i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&images](int a, int b) {
+        return images[a].height() > images[b].height();
+    });
+
+    TextureAtlasBuilder builder;
+    for (int i : order)
+        builder.add(keys[i], images[i]);
+
+    return builder.save(directory);
+}
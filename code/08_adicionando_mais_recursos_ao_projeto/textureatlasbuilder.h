@@ -0,0 +1,78 @@
+#ifndef TEXTUREATLASBUILDER_H
+#define TEXTUREATLASBUILDER_H
+
+#include <QHash>
+#include <QImage>
+#include <QRect>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+static const int ATLAS_LAYER_SIZE = 2048;
+static const int ATLAS_MAX_TEXTURE_SIZE = 512;
+static const int ATLAS_LEVEL_COUNT = 5;
+static const int ATLAS_PADDING = 1 << (ATLAS_LEVEL_COUNT - 1);
+
+struct TextureAtlasEntry
+{
+    QString key;
+    int layer = 0;
+    QRect rect;
+};
+
+class TextureAtlasBuilder
+{
+public:
+    static bool fits(const QSize &imageSize);
+    static QString keyForPath(const QString &sourcePath);
+    static bool build(const QStringList &sourcePaths, const QString &directory);
+
+    int find(const QString &key) const;
+    int add(const QString &key, const QImage &image);
+    void clear();
+
+    bool save(const QString &directory) const;
+    bool load(const QString &directory);
+
+    QImage layerLevel(int layer, int level) const;
+
+    const TextureAtlasEntry &entry(int index) const {
+        return m_entries[index];
+    }
+
+    int entryCount() const {
+        return m_entries.size();
+    }
+
+    int layerCount() const {
+        return m_shelves.size();
+    }
+
+    // Layers that gained entries since the last clearDirtyLayers().
+    const QSet<int> &dirtyLayers() const {
+        return m_dirtyLayers;
+    }
+
+    void clearDirtyLayers() {
+        m_dirtyLayers.clear();
+    }
+
+private:
+    struct Shelf {
+        int y = 0;
+        int height = 0;
+        int x = 0;
+    };
+
+    QVector<TextureAtlasEntry> m_entries;
+    QVector<QImage> m_images;
+    QHash<QString, int> m_entryIndices;
+    QVector<QVector<Shelf>> m_shelves;
+    QSet<int> m_dirtyLayers;
+
+private:
+    QPoint place(const QSize &cellSize, int &layer);
+};
+
+#endif // TEXTUREATLASBUILDER_H
@@ -0,0 +1,481 @@
+#include "texturestreamer.h"
+
+#include <cmath>
+
+#include "renderer.h"
+#include "uploadbatch.h"
+#include "vulkanwindow.h"
+
+static const int STREAMING_TAIL_SIZE = 128;
+static const VkDeviceSize MAX_STREAMED_BYTES_PER_FRAME = 16 * 1024 * 1024;
+static const int EVICTION_DELAY_FRAMES = 120;
+
+VkDeviceSize StreamedTexture::residentBytes(int firstLevel) const {
+    VkDeviceSize bytes = 0;
+    for (int level = firstLevel; level < m_levels.size(); ++level)
+        bytes += VkDeviceSize(m_levels[level].sizeInBytes());
+
+    return bytes;
+}
+
+void TextureStreamer::init(Renderer *renderer,
+                           VulkanWindow *window,
+                           QVulkanDeviceFunctions *deviceFunctions,
+                           UploadBatch *uploadBatch) {
+    m_renderer = renderer;
+    m_window = window;
+    m_deviceFunctions = deviceFunctions;
+    m_uploadBatch = uploadBatch;
+}
+
+StreamedTexture *TextureStreamer::createTexture(const QImage &image,
+                                                bool streamable,
+                                                const QString &name) {
+    StreamedTexture *texture = new StreamedTexture;
+    texture->m_name = name;
+
+    QImage level = image.convertToFormat(QImage::Format_RGBA8888);
+    texture->m_levels.append(level);
+    while (level.width() > 1 || level.height() > 1) {
+        level = level.scaled(
+            qMax(1, level.width() / 2),
+            qMax(1, level.height() / 2),
+            Qt::IgnoreAspectRatio,
+            Qt::SmoothTransformation
+        );
+        texture->m_levels.append(level);
+    }
+
+    texture->m_tailLevel = texture->m_levels.size() - 1;
+    for (int i = 0; i < texture->m_levels.size(); ++i) {
+        const QSize size = texture->m_levels[i].size();
+        if (qMax(size.width(), size.height()) <= STREAMING_TAIL_SIZE) {
+            texture->m_tailLevel = i;
+            break;
+        }
+    }
+
+    texture->m_streamable = streamable && texture->m_tailLevel > 0;
+    texture->m_targetLevel = texture->m_streamable ? texture->m_tailLevel : 0;
+    texture->m_requestedLevel = float(texture->m_targetLevel);
+
+    makeResident(texture, texture->m_targetLevel, VK_NULL_HANDLE);
+    m_textures.append(texture);
+
+    return texture;
+}
+
+void TextureStreamer::destroyTexture(StreamedTexture *texture) {
+    retireImage(texture);
+    m_textures.removeOne(texture);
+    m_movedTextures.removeOne(texture);
+    delete texture;
+}
+
+VkDeviceSize TextureStreamer::residentBytes() const {
+    VkDeviceSize bytes = 0;
+    for (const StreamedTexture *texture : m_textures)
+        bytes += texture->residentBytes(texture->m_residentLevel);
+
+    return bytes;
+}
+
+bool TextureStreamer::isStreaming() const {
+    for (const StreamedTexture *texture : m_textures) {
+        if (texture->m_streamable && texture->m_targetLevel < texture->m_residentLevel)
+            return true;
+    }
+
+    return false;
+}
+
+void TextureStreamer::assignTargets() {
+    VkDeviceSize total = 0;
+    for (StreamedTexture *texture : m_textures) {
+        if (texture->m_streamable) {
+            const float requested = std::floor(texture->m_requestedLevel);
+            texture->m_targetLevel = qBound(0, int(requested), texture->m_tailLevel);
+        }
+        total += texture->residentBytes(texture->m_targetLevel);
+    }
+
+    while (total > m_budget) {
+        StreamedTexture *largest = nullptr;
+        VkDeviceSize largestBytes = 0;
+
+        for (StreamedTexture *texture : m_textures) {
+            if (!texture->m_streamable || texture->m_targetLevel >= texture->m_tailLevel)
+                continue;
+
+            const VkDeviceSize bytes = texture->residentBytes(texture->m_targetLevel);
+            if (bytes > largestBytes) {
+                largest = texture;
+                largestBytes = bytes;
+            }
+        }
+
+        if (!largest)
+            break;
+
+        total -= largestBytes - largest->residentBytes(largest->m_targetLevel + 1);
+        ++largest->m_targetLevel;
+    }
+}
+
+QVector<StreamedTexture *> TextureStreamer::update(VkCommandBuffer commandBuffer) {
+    assignTargets();
+
+    const bool overBudget = residentBytes() > m_budget;
+    VkDeviceSize uploadedBytes = 0;
+    QVector<StreamedTexture *> changed = m_movedTextures;
+    m_movedTextures.clear();
+
+    for (StreamedTexture *texture : m_textures) {
+        if (!texture->m_streamable)
+            continue;
+
+        if (texture->m_targetLevel < texture->m_residentLevel) {
+            texture->m_evictionFrames = 0;
+
+            // Only the new level is staged; the rest is copied on the GPU.
+            const int level = texture->m_residentLevel - 1;
+            const VkDeviceSize bytes = VkDeviceSize(texture->m_levels[level].sizeInBytes());
+            if (uploadedBytes > 0 && uploadedBytes + bytes > MAX_STREAMED_BYTES_PER_FRAME)
+                continue;
+
+            makeResident(texture, level, commandBuffer);
+            uploadedBytes += bytes;
+            if (!changed.contains(texture))
+                changed.append(texture);
+        } else if (texture->m_targetLevel > texture->m_residentLevel) {
+            if (!overBudget && ++texture->m_evictionFrames < EVICTION_DELAY_FRAMES)
+                continue;
+
+            texture->m_evictionFrames = 0;
+            makeResident(texture, texture->m_targetLevel, commandBuffer);
+            if (!changed.contains(texture))
+                changed.append(texture);
+        } else {
+            texture->m_evictionFrames = 0;
+        }
+    }
+
+    return changed;
+}
+
+// Levels the old image already holds are copied across on the GPU in the
+// frame's command buffer; only the levels it lacks are staged from memory.
+void TextureStreamer::makeResident(StreamedTexture *texture, int firstLevel, VkCommandBuffer commandBuffer) {
+    const VkImage oldImage = texture->m_image;
+    const int oldFirstLevel = texture->m_residentLevel;
+    const int levelCount = texture->m_levels.size();
+    const int copyFirstLevel = oldImage && commandBuffer
+        ? qMax(firstLevel, oldFirstLevel)
+        : levelCount;
+
+    retireImage(texture);
+
+    const QSize size = texture->m_levels[firstLevel].size();
+    const uint32_t mipLevels = uint32_t(levelCount - firstLevel);
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    imageInfo.extent.width = uint32_t(size.width());
+    imageInfo.extent.height = uint32_t(size.height());
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = mipLevels;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkDevice device = m_window->device();
+    VkResult result = m_deviceFunctions->vkCreateImage(device, &imageInfo, nullptr, &texture->m_image);
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create streamed texture image: %d", result);
+    }
+
+    texture->m_imageMemory = m_renderer->memoryAllocator()->allocateForImage(
+        texture->m_image,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        MemoryUsage::Texture,
+        texture->m_name
+    );
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = texture->m_image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    viewInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+    viewInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+    viewInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+    viewInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = mipLevels;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    result = m_deviceFunctions->vkCreateImageView(device, &viewInfo, nullptr, &texture->m_imageView);
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create streamed texture image view: %d", result);
+    }
+
+    m_renderer->memoryDefragmenter()->addImage(
+        &texture->m_image,
+        &texture->m_imageView,
+        &texture->m_imageMemory,
+        imageInfo,
+        viewInfo,
+        MemoryUsage::Texture,
+        texture->m_name,
+        [this, texture]() { m_movedTextures.append(texture); }
+    );
+
+    const bool staged = firstLevel < copyFirstLevel;
+    const bool copied = copyFirstLevel < levelCount;
+
+    if (staged) {
+        stageLevels(texture, firstLevel, copyFirstLevel, copied);
+    }
+    if (copied) {
+        copyLevels(commandBuffer, texture, oldImage, oldFirstLevel, firstLevel, copyFirstLevel, staged);
+    }
+
+    texture->m_residentLevel = firstLevel;
+}
+
+void TextureStreamer::stageLevels(StreamedTexture *texture, int firstLevel, int lastLevel, bool copyFollows) {
+    VkDeviceSize bufferSize = 0;
+    for (int level = firstLevel; level < lastLevel; ++level)
+        bufferSize += VkDeviceSize(texture->m_levels[level].sizeInBytes());
+
+    VkBuffer stagingBuffer;
+    MemoryAllocation stagingBufferMemory;
+    m_renderer->createBuffer(
+        bufferSize,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        stagingBuffer,
+        stagingBufferMemory,
+        MemoryUsage::Staging,
+        texture->m_name
+    );
+
+    quint8 *data = stagingBufferMemory.mapped;
+
+    QVector<VkBufferImageCopy> regions;
+    VkDeviceSize offset = 0;
+    for (int level = firstLevel; level < lastLevel; ++level) {
+        const QImage &image = texture->m_levels[level];
+        const size_t imageBytes = size_t(image.sizeInBytes());
+        memcpy(data + offset, image.constBits(), imageBytes);
+
+        VkBufferImageCopy region = {};
+        region.bufferOffset = offset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = uint32_t(level - firstLevel);
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent.width = uint32_t(image.width());
+        region.imageExtent.height = uint32_t(image.height());
+        region.imageExtent.depth = 1;
+        regions.append(region);
+
+        offset += imageBytes;
+    }
+
+    VkCommandBuffer commandBuffer = m_uploadBatch->commandBuffer();
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = texture->m_image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    m_deviceFunctions->vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        0,
+        nullptr,
+        0,
+        nullptr,
+        1,
+        &barrier
+    );
+
+    m_deviceFunctions->vkCmdCopyBufferToImage(
+        commandBuffer,
+        stagingBuffer,
+        texture->m_image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        static_cast<uint32_t>(regions.size()),
+        regions.constData()
+    );
+
+    // When the frame still has to copy the resident levels in, the image
+    // stays a transfer destination until copyLevels() finishes it.
+    if (copyFollows) {
+        m_uploadBatch->releaseImageToGraphics(
+            texture->m_image,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT
+        );
+    } else {
+        m_uploadBatch->releaseImageToGraphics(
+            texture->m_image,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+        );
+    }
+
+    m_uploadBatch->retainStagingBuffer(stagingBuffer, stagingBufferMemory);
+}
+
+// Recorded into the frame's command buffer, which the upload batch is
+// submitted ahead of, so any staged levels have landed by the time it runs.
+// The old image is already queued for deletion and outlives this frame.
+void TextureStreamer::copyLevels(VkCommandBuffer commandBuffer,
+                                 StreamedTexture *texture,
+                                 VkImage oldImage,
+                                 int oldFirstLevel,
+                                 int firstLevel,
+                                 int copyFirstLevel,
+                                 bool staged) {
+    const int levelCount = texture->m_levels.size();
+
+    VkImageMemoryBarrier barriers[2] = {};
+    barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[0].image = oldImage;
+    barriers[0].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barriers[0].subresourceRange.baseMipLevel = 0;
+    barriers[0].subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    barriers[0].subresourceRange.baseArrayLayer = 0;
+    barriers[0].subresourceRange.layerCount = 1;
+
+    // Staged levels were transitioned by the upload batch and are disjoint
+    // from the copied ones, so only an unstaged image needs a transition.
+    barriers[1] = barriers[0];
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].srcAccessMask = 0;
+    barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barriers[1].image = texture->m_image;
+
+    m_deviceFunctions->vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        0,
+        nullptr,
+        0,
+        nullptr,
+        staged ? 1 : 2,
+        barriers
+    );
+
+    QVector<VkImageCopy> regions;
+    for (int level = copyFirstLevel; level < levelCount; ++level) {
+        const QSize size = texture->m_levels[level].size();
+
+        VkImageCopy region = {};
+        region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.srcSubresource.mipLevel = uint32_t(level - oldFirstLevel);
+        region.srcSubresource.baseArrayLayer = 0;
+        region.srcSubresource.layerCount = 1;
+        region.dstSubresource = region.srcSubresource;
+        region.dstSubresource.mipLevel = uint32_t(level - firstLevel);
+        region.extent.width = uint32_t(size.width());
+        region.extent.height = uint32_t(size.height());
+        region.extent.depth = 1;
+        regions.append(region);
+    }
+
+    m_deviceFunctions->vkCmdCopyImage(
+        commandBuffer,
+        oldImage,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        texture->m_image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        uint32_t(regions.size()),
+        regions.constData()
+    );
+
+    // Both images end up shader-readable; descriptors still naming the old
+    // one are replaced this frame, but must not see a transfer layout.
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    m_deviceFunctions->vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        0,
+        0,
+        nullptr,
+        0,
+        nullptr,
+        2,
+        barriers
+    );
+}
+
+void TextureStreamer::retireImage(StreamedTexture *texture) {
+    if (!texture->m_image) {
+        return;
+    }
+
+    m_renderer->memoryDefragmenter()->remove(&texture->m_imageMemory);
+
+    m_renderer->deletionQueue()->destroyImage(
+        texture->m_image,
+        texture->m_imageView,
+        texture->m_imageMemory
+    );
+
+    texture->m_image = VK_NULL_HANDLE;
+    texture->m_imageView = VK_NULL_HANDLE;
+}
+
+void TextureStreamer::release() {
+    for (StreamedTexture *texture : m_textures) {
+        retireImage(texture);
+        delete texture;
+    }
+    m_textures.clear();
+    m_movedTextures.clear();
+}
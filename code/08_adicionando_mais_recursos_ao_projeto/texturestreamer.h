@@ -0,0 +1,119 @@
+#ifndef TEXTURESTREAMER_H
+#define TEXTURESTREAMER_H
+
+#include <QVulkanDeviceFunctions>
+#include <QImage>
+#include <QVector>
+
+#include "memoryallocator.h"
+
+class VulkanWindow;
+class Renderer;
+class UploadBatch;
+class TextureStreamer;
+
+class StreamedTexture
+{
+public:
+    QSize size() const {
+        return m_levels.first().size();
+    }
+
+    int levelCount() const {
+        return m_levels.size();
+    }
+
+    int residentLevel() const {
+        return m_residentLevel;
+    }
+
+    int tailLevel() const {
+        return m_tailLevel;
+    }
+
+    bool isStreamable() const {
+        return m_streamable;
+    }
+
+    VkImageView imageView() const {
+        return m_imageView;
+    }
+
+    void setRequestedLevel(float level) {
+        m_requestedLevel = level;
+    }
+
+    QString name() const {
+        return m_name;
+    }
+
+    VkDeviceSize residentBytes(int firstLevel) const;
+
+private:
+    QString m_name;
+    QVector<QImage> m_levels;
+    int m_tailLevel = 0;
+    int m_residentLevel = 0;
+    int m_targetLevel = 0;
+    float m_requestedLevel = 0.0f;
+    int m_evictionFrames = 0;
+    bool m_streamable = false;
+
+    VkImage m_image = VK_NULL_HANDLE;
+    MemoryAllocation m_imageMemory;
+    VkImageView m_imageView = VK_NULL_HANDLE;
+
+    friend class TextureStreamer;
+};
+
+class TextureStreamer
+{
+public:
+    void init(Renderer *renderer,
+              VulkanWindow *window,
+              QVulkanDeviceFunctions *deviceFunctions,
+              UploadBatch *uploadBatch);
+    void release();
+
+    StreamedTexture *createTexture(const QImage &image, bool streamable, const QString &name);
+    void destroyTexture(StreamedTexture *texture);
+
+    QVector<StreamedTexture *> update(VkCommandBuffer commandBuffer);
+
+    void setBudget(VkDeviceSize budget) {
+        m_budget = budget;
+    }
+
+    VkDeviceSize budget() const {
+        return m_budget;
+    }
+
+    VkDeviceSize residentBytes() const;
+    bool isStreaming() const;
+
+private:
+    Renderer *m_renderer = nullptr;
+    VulkanWindow *m_window = nullptr;
+    QVulkanDeviceFunctions *m_deviceFunctions = nullptr;
+    UploadBatch *m_uploadBatch = nullptr;
+
+    VkDeviceSize m_budget = 256 * 1024 * 1024;
+
+    QVector<StreamedTexture *> m_textures;
+    QVector<StreamedTexture *> m_movedTextures;
+
+private:
+    void assignTargets();
+    void makeResident(StreamedTexture *texture, int firstLevel, VkCommandBuffer commandBuffer);
+    void stageLevels(StreamedTexture *texture, int firstLevel, int lastLevel, bool copyFollows);
+    void copyLevels(VkCommandBuffer commandBuffer,
+                    StreamedTexture *texture,
+                    VkImage oldImage,
+                    int oldFirstLevel,
+                    int firstLevel,
+                    int copyFirstLevel,
+                    bool staged);
+    void retireImage(StreamedTexture *texture);
+};
+
+#endif // TEXTURESTREAMER_H
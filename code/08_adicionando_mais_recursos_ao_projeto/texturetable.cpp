@@ -0,0 +1,210 @@
+#include "texturetable.h"
+
+#include "vulkanwindow.h"
+
+static const uint32_t MAX_TABLE_TEXTURES = 4096;
+
+uint32_t TextureTable::maxCapacity(const VkPhysicalDeviceLimits &limits) {
+    uint32_t capacity = MAX_TABLE_TEXTURES;
+    capacity = qMin(capacity, limits.maxPerStageDescriptorSamplers);
+    capacity = qMin(capacity, limits.maxPerStageDescriptorSampledImages);
+    capacity = qMin(capacity, limits.maxDescriptorSetSamplers);
+    capacity = qMin(capacity, limits.maxDescriptorSetSampledImages);
+    return capacity;
+}
+
+void TextureTable::create(VulkanWindow *window,
+                          QVulkanDeviceFunctions *deviceFunctions,
+                          VkSampler sampler,
+                          VkImageView defaultImageView,
+                          bool partiallyBound) {
+    m_window = window;
+    m_deviceFunctions = deviceFunctions;
+    m_sampler = sampler;
+    m_defaultImageView = defaultImageView;
+    m_partiallyBound = partiallyBound;
+    m_capacity = maxCapacity(m_window->physicalDeviceProperties()->limits);
+
+    VkDevice device = m_window->device();
+    const int frameCount = m_window->concurrentFrameCount();
+
+    VkDescriptorSetLayoutBinding binding = {};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    binding.descriptorCount = m_capacity;
+    binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    binding.pImmutableSamplers = nullptr;
+
+    VkDescriptorBindingFlagsEXT bindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT;
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = {};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    bindingFlagsInfo.bindingCount = 1;
+    bindingFlagsInfo.pBindingFlags = &bindingFlags;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = m_partiallyBound ? &bindingFlagsInfo : nullptr;
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &binding;
+
+    VkResult result = m_deviceFunctions->vkCreateDescriptorSetLayout(
+        device,
+        &layoutInfo,
+        nullptr,
+        &m_descriptorSetLayout
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create texture table descriptor set layout: %d", result);
+    }
+
+    VkDescriptorPoolSize poolSize = {};
+    poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSize.descriptorCount = m_capacity * uint32_t(frameCount);
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = uint32_t(frameCount);
+
+    result = m_deviceFunctions->vkCreateDescriptorPool(
+        device,
+        &poolInfo,
+        nullptr,
+        &m_descriptorPool
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create texture table descriptor pool: %d", result);
+    }
+
+    QVector<VkDescriptorSetLayout> layouts(frameCount, m_descriptorSetLayout);
+    m_descriptorSets.resize(frameCount);
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = m_descriptorPool;
+    allocInfo.descriptorSetCount = uint32_t(frameCount);
+    allocInfo.pSetLayouts = layouts.constData();
+
+    result = m_deviceFunctions->vkAllocateDescriptorSets(
+        device,
+        &allocInfo,
+        m_descriptorSets.data()
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to allocate texture table descriptor sets: %d", result);
+    }
+
+    m_imageViews.fill(VK_NULL_HANDLE, int(m_capacity));
+    m_freeSlots.clear();
+    for (int i = int(m_capacity) - 1; i >= 0; --i) {
+        m_freeSlots.append(i);
+    }
+
+    m_dirtySlots.fill(QSet<int>(), frameCount);
+    if (!m_partiallyBound) {
+        for (int i = 0; i < int(m_capacity); ++i) {
+            markDirty(i);
+        }
+    }
+}
+
+void TextureTable::markDirty(int index) {
+    for (QSet<int> &dirtySlots : m_dirtySlots) {
+        dirtySlots.insert(index);
+    }
+}
+
+int TextureTable::addTexture(VkImageView imageView) {
+    if (m_freeSlots.isEmpty()) {
+        qWarning("Texture table is full (%u textures)", m_capacity);
+        return -1;
+    }
+
+    const int index = m_freeSlots.takeLast();
+    setTexture(index, imageView);
+
+    return index;
+}
+
+void TextureTable::setTexture(int index, VkImageView imageView) {
+    m_imageViews[index] = imageView;
+    markDirty(index);
+}
+
+void TextureTable::removeTexture(int index) {
+    if (index < 0) {
+        return;
+    }
+
+    m_imageViews[index] = VK_NULL_HANDLE;
+    m_freeSlots.append(index);
+
+    if (!m_partiallyBound) {
+        markDirty(index);
+    } else {
+        for (QSet<int> &dirtySlots : m_dirtySlots) {
+            dirtySlots.remove(index);
+        }
+    }
+}
+
+VkDescriptorSet TextureTable::currentDescriptorSet() {
+    const int frame = m_window->currentFrame();
+    QSet<int> &dirtySlots = m_dirtySlots[frame];
+
+    if (!dirtySlots.isEmpty()) {
+        QVector<VkDescriptorImageInfo> imageInfos(dirtySlots.size());
+        QVector<VkWriteDescriptorSet> descriptorWrites(dirtySlots.size());
+
+        int i = 0;
+        for (int index : dirtySlots) {
+            VkDescriptorImageInfo &imageInfo = imageInfos[i];
+            imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            imageInfo.imageView = m_imageViews[index] ? m_imageViews[index] : m_defaultImageView;
+            imageInfo.sampler = m_sampler;
+
+            VkWriteDescriptorSet &descriptorWrite = descriptorWrites[i];
+            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrite.dstSet = m_descriptorSets[frame];
+            descriptorWrite.dstBinding = 0;
+            descriptorWrite.dstArrayElement = uint32_t(index);
+            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            descriptorWrite.descriptorCount = 1;
+            descriptorWrite.pImageInfo = &imageInfo;
+
+            ++i;
+        }
+
+        m_deviceFunctions->vkUpdateDescriptorSets(
+            m_window->device(),
+            static_cast<uint32_t>(descriptorWrites.size()),
+            descriptorWrites.constData(),
+            0,
+            nullptr
+        );
+
+        dirtySlots.clear();
+    }
+
+    return m_descriptorSets[frame];
+}
+
+void TextureTable::release() {
+    if (!m_descriptorPool) {
+        return;
+    }
+
+    VkDevice device = m_window->device();
+
+    m_deviceFunctions->vkDestroyDescriptorPool(device, m_descriptorPool, nullptr);
+    m_deviceFunctions->vkDestroyDescriptorSetLayout(device, m_descriptorSetLayout, nullptr);
+    m_descriptorPool = VK_NULL_HANDLE;
+    m_descriptorSetLayout = VK_NULL_HANDLE;
+
+    m_descriptorSets.clear();
+    m_dirtySlots.clear();
+    m_imageViews.clear();
+    m_freeSlots.clear();
+}
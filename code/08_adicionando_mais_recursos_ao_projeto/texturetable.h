@@ -0,0 +1,65 @@
+#ifndef TEXTURETABLE_H
+#define TEXTURETABLE_H
+
+#include <QVulkanDeviceFunctions>
+#include <QSet>
+#include <QVector>
+
+class VulkanWindow;
+
+class TextureTable
+{
+public:
+    void create(VulkanWindow *window,
+                QVulkanDeviceFunctions *deviceFunctions,
+                VkSampler sampler,
+                VkImageView defaultImageView,
+                bool partiallyBound);
+    void release();
+
+    int addTexture(VkImageView imageView);
+    void setTexture(int index, VkImageView imageView);
+    void removeTexture(int index);
+
+    VkDescriptorSet currentDescriptorSet();
+
+    VkDescriptorSetLayout descriptorSetLayout() const {
+        return m_descriptorSetLayout;
+    }
+
+    uint32_t capacity() const {
+        return m_capacity;
+    }
+
+    bool isFull() const {
+        return m_freeSlots.isEmpty();
+    }
+
+    bool isPartiallyBound() const {
+        return m_partiallyBound;
+    }
+
+    static uint32_t maxCapacity(const VkPhysicalDeviceLimits &limits);
+
+private:
+    VulkanWindow *m_window = nullptr;
+    QVulkanDeviceFunctions *m_deviceFunctions = nullptr;
+
+    VkSampler m_sampler = VK_NULL_HANDLE;
+    VkImageView m_defaultImageView = VK_NULL_HANDLE;
+    bool m_partiallyBound = false;
+    uint32_t m_capacity = 0;
+
+    VkDescriptorSetLayout m_descriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool m_descriptorPool = VK_NULL_HANDLE;
+    QVector<VkDescriptorSet> m_descriptorSets;
+    QVector<QSet<int>> m_dirtySlots;
+
+    QVector<VkImageView> m_imageViews;
+    QVector<int> m_freeSlots;
+
+private:
+    void markDirty(int index);
+};
+
+#endif // TEXTURETABLE_H
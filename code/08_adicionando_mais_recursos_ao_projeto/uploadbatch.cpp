@@ -0,0 +1,443 @@
+#include "uploadbatch.h"
+
+#include "vulkanwindow.h"
+
+void UploadBatch::init(VulkanWindow *window,
+                       QVulkanDeviceFunctions *deviceFunctions,
+                       MemoryAllocator *memoryAllocator) {
+    m_window = window;
+    m_deviceFunctions = deviceFunctions;
+    m_memoryAllocator = memoryAllocator;
+
+    m_graphicsQueueFamilyIndex = m_window->graphicsQueueFamilyIndex();
+    m_transferQueueFamilyIndex = m_window->transferQueueFamilyIndex();
+
+    if (m_transferQueueFamilyIndex == VK_QUEUE_FAMILY_IGNORED) {
+        m_transferQueueFamilyIndex = m_graphicsQueueFamilyIndex;
+        m_transferQueue = m_window->graphicsQueue();
+    } else {
+        m_deviceFunctions->vkGetDeviceQueue(
+            m_window->device(),
+            m_transferQueueFamilyIndex,
+            0,
+            &m_transferQueue
+        );
+    }
+
+    m_commandPool = createCommandPool(m_transferQueueFamilyIndex);
+
+    if (usesDedicatedTransferQueue()) {
+        m_acquireCommandPool = createCommandPool(m_graphicsQueueFamilyIndex);
+    }
+}
+
+VkCommandPool UploadBatch::createCommandPool(uint32_t queueFamilyIndex) {
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT
+        | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+    VkCommandPool commandPool;
+    VkResult result = m_deviceFunctions->vkCreateCommandPool(
+        m_window->device(),
+        &poolInfo,
+        nullptr,
+        &commandPool
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create upload command pool: %d", result);
+    }
+
+    return commandPool;
+}
+
+VkCommandBuffer UploadBatch::beginCommandBuffer(
+        VkCommandPool commandPool,
+        QVector<VkCommandBuffer> &freeCommandBuffers) {
+
+    VkCommandBuffer commandBuffer;
+
+    if (!freeCommandBuffers.isEmpty()) {
+        commandBuffer = freeCommandBuffers.takeLast();
+    } else {
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.commandBufferCount = 1;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+        VkResult result = m_deviceFunctions->vkAllocateCommandBuffers(
+            m_window->device(),
+            &allocInfo,
+            &commandBuffer
+        );
+        if (result != VK_SUCCESS) {
+            qFatal("Failed to allocate upload command buffer: %d", result);
+        }
+    }
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = nullptr;
+
+    m_deviceFunctions->vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    return commandBuffer;
+}
+
+VkCommandBuffer UploadBatch::commandBuffer() {
+    if (m_recording.commandBuffer == VK_NULL_HANDLE) {
+        m_recording.commandBuffer = beginCommandBuffer(
+            m_commandPool,
+            m_freeCommandBuffers
+        );
+    }
+
+    return m_recording.commandBuffer;
+}
+
+VkCommandBuffer UploadBatch::acquireCommandBuffer() {
+    if (m_recording.acquireCommandBuffer == VK_NULL_HANDLE) {
+        m_recording.acquireCommandBuffer = beginCommandBuffer(
+            m_acquireCommandPool,
+            m_freeAcquireCommandBuffers
+        );
+    }
+
+    return m_recording.acquireCommandBuffer;
+}
+
+void UploadBatch::retainStagingBuffer(VkBuffer buffer, const MemoryAllocation &memory) {
+    StagingBuffer staging;
+    staging.buffer = buffer;
+    staging.memory = memory;
+    m_recording.stagingBuffers.append(staging);
+}
+
+void UploadBatch::releaseBufferToGraphics(
+        VkBuffer buffer,
+        VkDeviceSize size,
+        VkAccessFlags dstAccessMask,
+        VkPipelineStageFlags dstStageMask) {
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = dstAccessMask;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = buffer;
+    barrier.offset = 0;
+    barrier.size = size;
+
+    if (!usesDedicatedTransferQueue()) {
+        m_deviceFunctions->vkCmdPipelineBarrier(
+            commandBuffer(),
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            dstStageMask,
+            0,
+            0,
+            nullptr,
+            1,
+            &barrier,
+            0,
+            nullptr
+        );
+        return;
+    }
+
+    barrier.srcQueueFamilyIndex = m_transferQueueFamilyIndex;
+    barrier.dstQueueFamilyIndex = m_graphicsQueueFamilyIndex;
+
+    barrier.dstAccessMask = 0;
+    m_deviceFunctions->vkCmdPipelineBarrier(
+        commandBuffer(),
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        0,
+        0,
+        nullptr,
+        1,
+        &barrier,
+        0,
+        nullptr
+    );
+
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = dstAccessMask;
+    m_deviceFunctions->vkCmdPipelineBarrier(
+        acquireCommandBuffer(),
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        dstStageMask,
+        0,
+        0,
+        nullptr,
+        1,
+        &barrier,
+        0,
+        nullptr
+    );
+}
+
+void UploadBatch::releaseImageToGraphics(
+        VkImage image,
+        VkImageLayout oldLayout,
+        VkImageLayout newLayout,
+        VkAccessFlags dstAccessMask,
+        VkPipelineStageFlags dstStageMask) {
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = dstAccessMask;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+
+    if (!usesDedicatedTransferQueue()) {
+        m_deviceFunctions->vkCmdPipelineBarrier(
+            commandBuffer(),
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            dstStageMask,
+            0,
+            0,
+            nullptr,
+            0,
+            nullptr,
+            1,
+            &barrier
+        );
+        return;
+    }
+
+    barrier.srcQueueFamilyIndex = m_transferQueueFamilyIndex;
+    barrier.dstQueueFamilyIndex = m_graphicsQueueFamilyIndex;
+
+    barrier.dstAccessMask = 0;
+    m_deviceFunctions->vkCmdPipelineBarrier(
+        commandBuffer(),
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        0,
+        0,
+        nullptr,
+        0,
+        nullptr,
+        1,
+        &barrier
+    );
+
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = dstAccessMask;
+    m_deviceFunctions->vkCmdPipelineBarrier(
+        acquireCommandBuffer(),
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        dstStageMask,
+        0,
+        0,
+        nullptr,
+        0,
+        nullptr,
+        1,
+        &barrier
+    );
+}
+
+VkSemaphore UploadBatch::takeSemaphore() {
+    if (!m_freeSemaphores.isEmpty()) {
+        return m_freeSemaphores.takeLast();
+    }
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    VkSemaphore semaphore;
+    VkResult result = m_deviceFunctions->vkCreateSemaphore(
+        m_window->device(),
+        &semaphoreInfo,
+        nullptr,
+        &semaphore
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create upload semaphore: %d", result);
+    }
+
+    return semaphore;
+}
+
+VkFence UploadBatch::takeFence() {
+    if (!m_freeFences.isEmpty()) {
+        return m_freeFences.takeLast();
+    }
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    VkFence fence;
+    VkResult result = m_deviceFunctions->vkCreateFence(
+        m_window->device(),
+        &fenceInfo,
+        nullptr,
+        &fence
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create upload fence: %d", result);
+    }
+
+    return fence;
+}
+
+void UploadBatch::submit() {
+    if (m_recording.commandBuffer == VK_NULL_HANDLE) {
+        return;
+    }
+
+    m_deviceFunctions->vkEndCommandBuffer(m_recording.commandBuffer);
+
+    m_recording.fence = takeFence();
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &m_recording.commandBuffer;
+
+    if (m_recording.acquireCommandBuffer == VK_NULL_HANDLE) {
+        VkResult result = m_deviceFunctions->vkQueueSubmit(
+            m_transferQueue,
+            1,
+            &submitInfo,
+            m_recording.fence
+        );
+        if (result != VK_SUCCESS) {
+            qFatal("Failed to submit upload batch: %d", result);
+        }
+    } else {
+        m_deviceFunctions->vkEndCommandBuffer(m_recording.acquireCommandBuffer);
+
+        m_recording.semaphore = takeSemaphore();
+
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &m_recording.semaphore;
+
+        VkResult result = m_deviceFunctions->vkQueueSubmit(
+            m_transferQueue,
+            1,
+            &submitInfo,
+            VK_NULL_HANDLE
+        );
+        if (result != VK_SUCCESS) {
+            qFatal("Failed to submit upload batch: %d", result);
+        }
+
+        VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+        VkSubmitInfo acquireInfo = {};
+        acquireInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        acquireInfo.waitSemaphoreCount = 1;
+        acquireInfo.pWaitSemaphores = &m_recording.semaphore;
+        acquireInfo.pWaitDstStageMask = &waitStage;
+        acquireInfo.commandBufferCount = 1;
+        acquireInfo.pCommandBuffers = &m_recording.acquireCommandBuffer;
+
+        result = m_deviceFunctions->vkQueueSubmit(
+            m_window->graphicsQueue(),
+            1,
+            &acquireInfo,
+            m_recording.fence
+        );
+        if (result != VK_SUCCESS) {
+            qFatal("Failed to submit upload ownership acquire: %d", result);
+        }
+    }
+
+    m_inFlight.append(m_recording);
+    m_recording = Submission();
+}
+
+void UploadBatch::retire(Submission &submission) {
+    VkDevice device = m_window->device();
+
+    for (StagingBuffer &staging : submission.stagingBuffers) {
+        m_deviceFunctions->vkDestroyBuffer(device, staging.buffer, nullptr);
+        m_memoryAllocator->free(staging.memory);
+    }
+    submission.stagingBuffers.clear();
+
+    m_deviceFunctions->vkResetFences(device, 1, &submission.fence);
+    m_freeFences.append(submission.fence);
+    m_freeCommandBuffers.append(submission.commandBuffer);
+
+    if (submission.acquireCommandBuffer != VK_NULL_HANDLE) {
+        m_freeAcquireCommandBuffers.append(submission.acquireCommandBuffer);
+        m_freeSemaphores.append(submission.semaphore);
+    }
+}
+
+void UploadBatch::collectRetired() {
+    VkDevice device = m_window->device();
+
+    for (int i = 0; i < m_inFlight.size(); ) {
+        VkResult status = m_deviceFunctions->vkGetFenceStatus(
+            device,
+            m_inFlight[i].fence
+        );
+        if (status == VK_SUCCESS) {
+            retire(m_inFlight[i]);
+            m_inFlight.removeAt(i);
+        } else {
+            ++i;
+        }
+    }
+}
+
+void UploadBatch::release() {
+    if (m_commandPool == VK_NULL_HANDLE) {
+        return;
+    }
+
+    VkDevice device = m_window->device();
+
+    submit();
+
+    for (Submission &submission : m_inFlight) {
+        m_deviceFunctions->vkWaitForFences(
+            device,
+            1,
+            &submission.fence,
+            VK_TRUE,
+            UINT64_MAX
+        );
+        retire(submission);
+    }
+    m_inFlight.clear();
+
+    for (VkFence fence : m_freeFences) {
+        m_deviceFunctions->vkDestroyFence(device, fence, nullptr);
+    }
+    m_freeFences.clear();
+
+    for (VkSemaphore semaphore : m_freeSemaphores) {
+        m_deviceFunctions->vkDestroySemaphore(device, semaphore, nullptr);
+    }
+    m_freeSemaphores.clear();
+
+    m_freeCommandBuffers.clear();
+    m_freeAcquireCommandBuffers.clear();
+
+    m_deviceFunctions->vkDestroyCommandPool(device, m_commandPool, nullptr);
+    m_commandPool = VK_NULL_HANDLE;
+
+    if (m_acquireCommandPool != VK_NULL_HANDLE) {
+        m_deviceFunctions->vkDestroyCommandPool(device, m_acquireCommandPool, nullptr);
+        m_acquireCommandPool = VK_NULL_HANDLE;
+    }
+}
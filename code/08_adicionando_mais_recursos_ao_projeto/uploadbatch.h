@@ -0,0 +1,76 @@
+#ifndef UPLOADBATCH_H
+#define UPLOADBATCH_H
+
+#include <QVulkanDeviceFunctions>
+#include <QVector>
+
+#include "memoryallocator.h"
+
+class VulkanWindow;
+
+class UploadBatch
+{
+public:
+    void init(VulkanWindow *window, QVulkanDeviceFunctions *deviceFunctions, MemoryAllocator *memoryAllocator);
+    void release();
+
+    VkCommandBuffer commandBuffer();
+    void retainStagingBuffer(VkBuffer buffer, const MemoryAllocation &memory);
+    void releaseBufferToGraphics(VkBuffer buffer, VkDeviceSize size, VkAccessFlags dstAccessMask, VkPipelineStageFlags dstStageMask);
+    void releaseImageToGraphics(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags dstAccessMask, VkPipelineStageFlags dstStageMask);
+    void submit();
+    void collectRetired();
+
+    bool usesDedicatedTransferQueue() const {
+        return m_transferQueueFamilyIndex != m_graphicsQueueFamilyIndex;
+    }
+
+    bool isRecording() const {
+        return m_recording.commandBuffer != VK_NULL_HANDLE;
+    }
+
+    int submissionsInFlight() const {
+        return m_inFlight.size();
+    }
+
+private:
+    struct StagingBuffer {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        MemoryAllocation memory;
+    };
+
+    struct Submission {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkCommandBuffer acquireCommandBuffer = VK_NULL_HANDLE;
+        VkSemaphore semaphore = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        QVector<StagingBuffer> stagingBuffers;
+    };
+
+    VulkanWindow *m_window = nullptr;
+    QVulkanDeviceFunctions *m_deviceFunctions = nullptr;
+    MemoryAllocator *m_memoryAllocator = nullptr;
+
+    uint32_t m_graphicsQueueFamilyIndex = 0;
+    uint32_t m_transferQueueFamilyIndex = 0;
+    VkQueue m_transferQueue = VK_NULL_HANDLE;
+    VkCommandPool m_commandPool = VK_NULL_HANDLE;
+    VkCommandPool m_acquireCommandPool = VK_NULL_HANDLE;
+
+    Submission m_recording;
+    QVector<Submission> m_inFlight;
+    QVector<VkCommandBuffer> m_freeCommandBuffers;
+    QVector<VkCommandBuffer> m_freeAcquireCommandBuffers;
+    QVector<VkSemaphore> m_freeSemaphores;
+    QVector<VkFence> m_freeFences;
+
+private:
+    VkCommandPool createCommandPool(uint32_t queueFamilyIndex);
+    VkCommandBuffer beginCommandBuffer(VkCommandPool commandPool, QVector<VkCommandBuffer> &freeCommandBuffers);
+    VkCommandBuffer acquireCommandBuffer();
+    VkSemaphore takeSemaphore();
+    VkFence takeFence();
+    void retire(Submission &submission);
+};
+
+#endif // UPLOADBATCH_H
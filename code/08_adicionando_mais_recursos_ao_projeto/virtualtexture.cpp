@@ -0,0 +1,1002 @@
+#include "virtualtexture.h"
+
+#include <QFile>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include "features.h"
+#include "renderer.h"
+#include "vulkanwindow.h"
+
+static const int MAX_UPLOADS_PER_FRAME = 16;
+static const int MAX_PENDING_PAGES = 64;
+static const int PINNED_LEVELS = 2;
+static const int FEEDBACK_SCALE = 8;
+static const int MIN_SLOTS_PER_SIDE = 4;
+static const int MAX_SLOTS_PER_SIDE = 255;
+static const quint32 FEEDBACK_VALID_BIT = 0x80000000u;
+
+class PageLoadTask : public QRunnable
+{
+public:
+    PageLoadTask(VirtualTexture *texture, quint32 key)
+        : m_texture(texture)
+        , m_key(key) {}
+
+    void run() override {
+        m_texture->completePageLoad(m_key, m_texture->readPage(m_key));
+    }
+
+private:
+    VirtualTexture *m_texture;
+    quint32 m_key;
+};
+
+VirtualTexture::VirtualTexture(Renderer *renderer, VulkanWindow *window, QVulkanDeviceFunctions *deviceFunctions)
+    : m_renderer(renderer)
+    , m_window(window)
+    , m_deviceFunctions(deviceFunctions) {}
+
+VirtualTexture::~VirtualTexture() {
+    m_loaderPool.waitForDone();
+}
+
+quint32 VirtualTexture::pageKey(int level, int x, int y) {
+    return (quint32(level) << 24) | (quint32(y) << 12) | quint32(x);
+}
+
+int VirtualTexture::pageLevel(quint32 key) {
+    return int((key >> 24) & 0x7f);
+}
+
+int VirtualTexture::pageX(quint32 key) {
+    return int(key & 0xfff);
+}
+
+int VirtualTexture::pageY(quint32 key) {
+    return int((key >> 12) & 0xfff);
+}
+
+bool VirtualTexture::open(const QString &pageDirectory) {
+    m_pageDirectory = pageDirectory;
+    return VirtualTextureBuilder::readInfo(pageDirectory, m_info);
+}
+
+QByteArray VirtualTexture::readPage(quint32 key) const {
+    const int level = pageLevel(key);
+    const qint64 offset = qint64(pageY(key) * m_info.pagesAtLevel(level) + pageX(key))
+        * VIRTUAL_PAGE_BYTES;
+
+    QByteArray data;
+    QFile file(VirtualTextureBuilder::levelFileName(m_pageDirectory, level));
+    if (file.open(QIODevice::ReadOnly) && file.seek(offset)) {
+        data = file.read(VIRTUAL_PAGE_BYTES);
+    }
+
+    if (data.size() != VIRTUAL_PAGE_BYTES) {
+        data.resize(VIRTUAL_PAGE_BYTES);
+        data.fill(0);
+    }
+
+    return data;
+}
+
+void VirtualTexture::completePageLoad(quint32 key, const QByteArray &data) {
+    LoadedPage page;
+    page.key = key;
+    page.data = data;
+
+    QMutexLocker locker(&m_loadedMutex);
+    m_loadedPages.append(page);
+}
+
+void VirtualTexture::requestPage(quint32 key) {
+    m_requestedPages.insert(key);
+    m_loaderPool.start(new PageLoadTask(this, key));
+}
+
+void VirtualTexture::createImage(uint32_t width,
+                                 uint32_t height,
+                                 uint32_t mipLevels,
+                                 VkFormat format,
+                                 VkImageUsageFlags usage,
+                                 VkImage &image,
+                                 MemoryAllocation &imageMemory,
+                                 MemoryUsage memoryUsage,
+                                 const QString &name) {
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = format;
+    imageInfo.extent.width = width;
+    imageInfo.extent.height = height;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = mipLevels;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = usage;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkDevice device = m_window->device();
+    VkResult result = m_deviceFunctions->vkCreateImage(device, &imageInfo, nullptr, &image);
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create virtual texture image: %d", result);
+    }
+
+    imageMemory = m_renderer->memoryAllocator()->allocateForImage(
+        image,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        memoryUsage,
+        name
+    );
+}
+
+VkImageView VirtualTexture::createImageView(VkImage image,
+                                            VkFormat format,
+                                            VkImageAspectFlags aspectMask,
+                                            uint32_t mipLevels) {
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = format;
+    viewInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+    viewInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+    viewInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+    viewInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+    viewInfo.subresourceRange.aspectMask = aspectMask;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = mipLevels;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    VkImageView imageView;
+    VkResult result = m_deviceFunctions->vkCreateImageView(
+        m_window->device(),
+        &viewInfo,
+        nullptr,
+        &imageView
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create virtual texture image view: %d", result);
+    }
+
+    return imageView;
+}
+
+VkSampler VirtualTexture::createSampler(VkFilter filter, VkSamplerMipmapMode mipmapMode, float maxLod) {
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = filter;
+    samplerInfo.minFilter = filter;
+    samplerInfo.mipmapMode = mipmapMode;
+    samplerInfo.mipLodBias = 0.0f;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = maxLod;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.anisotropyEnable = VK_FALSE;
+    samplerInfo.maxAnisotropy = 1.0;
+    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+    samplerInfo.compareEnable = VK_FALSE;
+    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+
+    VkSampler sampler;
+    VkResult result = m_deviceFunctions->vkCreateSampler(
+        m_window->device(),
+        &samplerInfo,
+        nullptr,
+        &sampler
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create virtual texture sampler: %d", result);
+    }
+
+    return sampler;
+}
+
+void VirtualTexture::create(VkDeviceSize memoryBudget) {
+    VkDevice device = m_window->device();
+    const int frameCount = m_window->concurrentFrameCount();
+
+    m_indirectionEntries.resize(m_info.levelCount);
+    m_indirectionBytes = 0;
+    for (int level = 0; level < m_info.levelCount; ++level) {
+        const int pages = m_info.pagesAtLevel(level);
+        m_indirectionEntries[level].fill(0, pages * pages);
+        m_indirectionBytes += VkDeviceSize(pages) * pages * sizeof(quint32);
+    }
+
+    m_stagingBytesPerFrame = VkDeviceSize(MAX_UPLOADS_PER_FRAME) * VIRTUAL_PAGE_BYTES
+        + m_indirectionBytes;
+    m_maxPendingPages = MAX_PENDING_PAGES;
+
+    const VkDeviceSize streamingBytes = VkDeviceSize(frameCount) * m_stagingBytesPerFrame
+        + VkDeviceSize(m_maxPendingPages) * VIRTUAL_PAGE_BYTES;
+    const VkDeviceSize cacheBytes = memoryBudget > streamingBytes
+        ? memoryBudget - streamingBytes
+        : 0;
+
+    const int maxImageSide = int(m_window->physicalDeviceProperties()->limits.maxImageDimension2D);
+    m_slotsPerSide = int(std::sqrt(double(cacheBytes / VIRTUAL_PAGE_BYTES)));
+    m_slotsPerSide = qMin(m_slotsPerSide, maxImageSide / VIRTUAL_PAGE_SLOT_SIZE);
+    m_slotsPerSide = qMin(m_slotsPerSide, MAX_SLOTS_PER_SIDE);
+    if (m_slotsPerSide < MIN_SLOTS_PER_SIDE) {
+        qWarning("Virtual texture budget of %llu bytes is too small, using %d pages",
+                 static_cast<unsigned long long>(memoryBudget),
+                 MIN_SLOTS_PER_SIDE * MIN_SLOTS_PER_SIDE);
+        m_slotsPerSide = MIN_SLOTS_PER_SIDE;
+    }
+    m_slots.fill(PageSlot(), m_slotsPerSide * m_slotsPerSide);
+
+    const uint32_t physicalSize = uint32_t(m_slotsPerSide * VIRTUAL_PAGE_SLOT_SIZE);
+    createImage(
+        physicalSize,
+        physicalSize,
+        1,
+        VK_FORMAT_R8G8B8A8_UNORM,
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        m_physicalCache,
+        m_physicalCacheMemory,
+        MemoryUsage::Texture,
+        "virtual texture cache"
+    );
+    m_physicalCacheView = createImageView(
+        m_physicalCache,
+        VK_FORMAT_R8G8B8A8_UNORM,
+        VK_IMAGE_ASPECT_COLOR_BIT,
+        1
+    );
+    m_physicalCacheSampler = createSampler(VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST, 0.0f);
+
+    createImage(
+        uint32_t(m_info.pageCount),
+        uint32_t(m_info.pageCount),
+        uint32_t(m_info.levelCount),
+        VK_FORMAT_R8G8B8A8_UNORM,
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        m_indirection,
+        m_indirectionMemory,
+        MemoryUsage::Texture,
+        "virtual texture indirection"
+    );
+    m_indirectionView = createImageView(
+        m_indirection,
+        VK_FORMAT_R8G8B8A8_UNORM,
+        VK_IMAGE_ASPECT_COLOR_BIT,
+        uint32_t(m_info.levelCount)
+    );
+    m_indirectionSampler = createSampler(
+        VK_FILTER_NEAREST,
+        VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        float(m_info.levelCount - 1)
+    );
+
+    m_stagingBuffers.resize(frameCount);
+    m_stagingMemory.resize(frameCount);
+    m_stagingData.resize(frameCount);
+    for (int i = 0; i < frameCount; ++i) {
+        m_renderer->createBuffer(
+            m_stagingBytesPerFrame,
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            m_stagingBuffers[i],
+            m_stagingMemory[i],
+            MemoryUsage::Staging,
+            "virtual texture pages"
+        );
+        m_stagingData[i] = m_stagingMemory[i].mapped;
+    }
+
+    createFeedbackRenderPass();
+
+    m_loaderPool.setMaxThreadCount(qBound(1, QThread::idealThreadCount() - 1, 4));
+
+    const int firstPinnedLevel = qMax(0, m_info.levelCount - PINNED_LEVELS);
+    for (int level = m_info.levelCount - 1; level >= firstPinnedLevel; --level) {
+        const int pages = m_info.pagesAtLevel(level);
+        for (int y = 0; y < pages; ++y) {
+            for (int x = 0; x < pages; ++x) {
+                const quint32 key = pageKey(level, x, y);
+                m_pinnedPages.insert(key);
+                m_requestedPages.insert(key);
+                completePageLoad(key, readPage(key));
+            }
+        }
+    }
+
+    qCDebug(lcStats, "Virtual texture %dx%d: %d levels, %d cache pages",
+            m_info.imageSize.width(),
+            m_info.imageSize.height(),
+            m_info.levelCount,
+            m_slots.size());
+}
+
+void VirtualTexture::createFeedbackRenderPass() {
+    VkAttachmentDescription colorAttachment = {};
+    colorAttachment.format = VK_FORMAT_R32_UINT;
+    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+    VkAttachmentDescription depthAttachment = {};
+    depthAttachment.format = m_window->depthStencilFormat();
+    depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference colorReference = {};
+    colorReference.attachment = 0;
+    colorReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference depthReference = {};
+    depthReference.attachment = 1;
+    depthReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorReference;
+    subpass.pDepthStencilAttachment = &depthReference;
+
+    std::array<VkSubpassDependency, 2> dependencies = {};
+
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT
+        | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+        | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+        | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    std::array<VkAttachmentDescription, 2> attachments = {colorAttachment, depthAttachment};
+
+    VkRenderPassCreateInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+    renderPassInfo.pAttachments = attachments.data();
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    renderPassInfo.pDependencies = dependencies.data();
+
+    VkResult result = m_deviceFunctions->vkCreateRenderPass(
+        m_window->device(),
+        &renderPassInfo,
+        nullptr,
+        &m_feedbackRenderPass
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create feedback render pass: %d", result);
+    }
+}
+
+void VirtualTexture::createFeedbackTarget(const QSize &swapChainImageSize) {
+    VkDevice device = m_window->device();
+
+    m_feedbackSize = QSize(
+        qMax(1, (swapChainImageSize.width() + FEEDBACK_SCALE - 1) / FEEDBACK_SCALE),
+        qMax(1, (swapChainImageSize.height() + FEEDBACK_SCALE - 1) / FEEDBACK_SCALE)
+    );
+
+    createImage(
+        uint32_t(m_feedbackSize.width()),
+        uint32_t(m_feedbackSize.height()),
+        1,
+        VK_FORMAT_R32_UINT,
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        m_feedbackImage,
+        m_feedbackImageMemory,
+        MemoryUsage::Attachment,
+        "virtual texture feedback"
+    );
+    m_feedbackImageView = createImageView(
+        m_feedbackImage,
+        VK_FORMAT_R32_UINT,
+        VK_IMAGE_ASPECT_COLOR_BIT,
+        1
+    );
+
+    const VkFormat depthFormat = m_window->depthStencilFormat();
+    VkImageAspectFlags depthAspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (depthFormat == VK_FORMAT_D16_UNORM_S8_UINT
+        || depthFormat == VK_FORMAT_D24_UNORM_S8_UINT
+        || depthFormat == VK_FORMAT_D32_SFLOAT_S8_UINT) {
+        depthAspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    }
+
+    createImage(
+        uint32_t(m_feedbackSize.width()),
+        uint32_t(m_feedbackSize.height()),
+        1,
+        depthFormat,
+        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+        m_feedbackDepthImage,
+        m_feedbackDepthImageMemory,
+        MemoryUsage::Attachment,
+        "virtual texture feedback depth"
+    );
+    m_feedbackDepthImageView = createImageView(m_feedbackDepthImage, depthFormat, depthAspect, 1);
+
+    std::array<VkImageView, 2> attachments = {m_feedbackImageView, m_feedbackDepthImageView};
+
+    VkFramebufferCreateInfo framebufferInfo = {};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = m_feedbackRenderPass;
+    framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+    framebufferInfo.pAttachments = attachments.data();
+    framebufferInfo.width = uint32_t(m_feedbackSize.width());
+    framebufferInfo.height = uint32_t(m_feedbackSize.height());
+    framebufferInfo.layers = 1;
+
+    VkResult result = m_deviceFunctions->vkCreateFramebuffer(
+        device,
+        &framebufferInfo,
+        nullptr,
+        &m_feedbackFramebuffer
+    );
+    if (result != VK_SUCCESS) {
+        qFatal("Failed to create feedback framebuffer: %d", result);
+    }
+
+    const int frameCount = m_window->concurrentFrameCount();
+    const VkDeviceSize readbackSize =
+        VkDeviceSize(m_feedbackSize.width()) * m_feedbackSize.height() * sizeof(quint32);
+
+    m_readbackBuffers.resize(frameCount);
+    m_readbackMemory.resize(frameCount);
+    m_readbackData.resize(frameCount);
+    m_readbackPending.fill(false, frameCount);
+
+    for (int i = 0; i < frameCount; ++i) {
+        m_renderer->createBuffer(
+            readbackSize,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            m_readbackBuffers[i],
+            m_readbackMemory[i],
+            MemoryUsage::Readback,
+            "virtual texture feedback"
+        );
+
+        m_readbackData[i] = reinterpret_cast<const quint32 *>(m_readbackMemory[i].mapped);
+    }
+}
+
+void VirtualTexture::releaseFeedbackTarget() {
+    VkDevice device = m_window->device();
+
+    for (int i = 0; i < m_readbackBuffers.size(); ++i) {
+        m_deviceFunctions->vkDestroyBuffer(device, m_readbackBuffers[i], nullptr);
+        m_renderer->memoryAllocator()->free(m_readbackMemory[i]);
+    }
+    m_readbackBuffers.clear();
+    m_readbackMemory.clear();
+    m_readbackData.clear();
+    m_readbackPending.clear();
+
+    if (m_feedbackFramebuffer) {
+        m_deviceFunctions->vkDestroyFramebuffer(device, m_feedbackFramebuffer, nullptr);
+        m_feedbackFramebuffer = VK_NULL_HANDLE;
+    }
+
+    if (m_feedbackImageView) {
+        m_deviceFunctions->vkDestroyImageView(device, m_feedbackImageView, nullptr);
+        m_deviceFunctions->vkDestroyImage(device, m_feedbackImage, nullptr);
+        m_renderer->memoryAllocator()->free(m_feedbackImageMemory);
+        m_feedbackImageView = VK_NULL_HANDLE;
+        m_feedbackImage = VK_NULL_HANDLE;
+    }
+
+    if (m_feedbackDepthImageView) {
+        m_deviceFunctions->vkDestroyImageView(device, m_feedbackDepthImageView, nullptr);
+        m_deviceFunctions->vkDestroyImage(device, m_feedbackDepthImage, nullptr);
+        m_renderer->memoryAllocator()->free(m_feedbackDepthImageMemory);
+        m_feedbackDepthImageView = VK_NULL_HANDLE;
+        m_feedbackDepthImage = VK_NULL_HANDLE;
+    }
+}
+
+void VirtualTexture::processFeedback(int frameSlot) {
+    const quint32 *data = m_readbackData[frameSlot];
+    const int count = m_feedbackSize.width() * m_feedbackSize.height();
+
+    QSet<quint32> visiblePages;
+    for (int i = 0; i < count; ++i) {
+        if (data[i] & FEEDBACK_VALID_BIT) {
+            visiblePages.insert(data[i] & ~FEEDBACK_VALID_BIT);
+        }
+    }
+
+    QSet<quint32> missingPages;
+    for (quint32 key : visiblePages) {
+        int level = pageLevel(key);
+        int x = pageX(key);
+        int y = pageY(key);
+
+        if (level >= m_info.levelCount
+            || x >= m_info.pagesAtLevel(level)
+            || y >= m_info.pagesAtLevel(level)) {
+            continue;
+        }
+
+        for (; level < m_info.levelCount; ++level, x /= 2, y /= 2) {
+            const quint32 ancestor = pageKey(level, x, y);
+            auto resident = m_residentPages.constFind(ancestor);
+            if (resident != m_residentPages.constEnd()) {
+                m_slots[resident.value()].lastUsedFrame = m_frameCounter;
+            } else if (!m_requestedPages.contains(ancestor)) {
+                missingPages.insert(ancestor);
+            }
+        }
+    }
+
+    // Pages dropped for lack of cache space are not requested again until
+    // they have left the view.
+    m_rejectedPages.intersect(missingPages);
+    missingPages.subtract(m_rejectedPages);
+
+    QVector<quint32> requests = missingPages.values().toVector();
+    std::sort(requests.begin(), requests.end(), [](quint32 a, quint32 b) {
+        return pageLevel(a) > pageLevel(b);
+    });
+
+    for (quint32 key : requests) {
+        if (m_requestedPages.size() >= m_maxPendingPages) {
+            break;
+        }
+        requestPage(key);
+    }
+}
+
+int VirtualTexture::allocateSlot() {
+    int victim = -1;
+
+    for (int i = 0; i < m_slots.size(); ++i) {
+        const PageSlot &slot = m_slots[i];
+        if (!slot.occupied) {
+            return i;
+        }
+        if (slot.pinned || slot.lastUsedFrame >= m_frameCounter) {
+            continue;
+        }
+        if (victim < 0 || slot.lastUsedFrame < m_slots[victim].lastUsedFrame) {
+            victim = i;
+        }
+    }
+
+    if (victim >= 0) {
+        m_residentPages.remove(m_slots[victim].key);
+        m_slots[victim] = PageSlot();
+        m_indirectionDirty = true;
+    }
+
+    return victim;
+}
+
+void VirtualTexture::rebuildIndirection() {
+    for (int level = m_info.levelCount - 1; level >= 0; --level) {
+        const int pages = m_info.pagesAtLevel(level);
+        const int parentPages = m_info.pagesAtLevel(level + 1);
+        QVector<quint32> &entries = m_indirectionEntries[level];
+
+        for (int y = 0; y < pages; ++y) {
+            for (int x = 0; x < pages; ++x) {
+                quint32 entry = 0;
+
+                auto resident = m_residentPages.constFind(pageKey(level, x, y));
+                if (resident != m_residentPages.constEnd()) {
+                    const int slot = resident.value();
+                    entry = quint32(slot % m_slotsPerSide)
+                        | (quint32(slot / m_slotsPerSide) << 8)
+                        | (quint32(level) << 16)
+                        | (0xffu << 24);
+                } else if (level + 1 < m_info.levelCount) {
+                    entry = m_indirectionEntries[level + 1][(y / 2) * parentPages + x / 2];
+                }
+
+                entries[y * pages + x] = entry;
+            }
+        }
+    }
+}
+
+void VirtualTexture::update(VkCommandBuffer commandBuffer) {
+    const int frameSlot = m_window->currentFrame();
+    ++m_frameCounter;
+
+    if (frameSlot < m_readbackPending.size() && m_readbackPending[frameSlot]) {
+        processFeedback(frameSlot);
+        m_readbackPending[frameSlot] = false;
+    }
+
+    // Feedback lags the frame that produced it, so keep drawing until the
+    // pages requested by the last view have arrived and been re-sampled.
+    if (!m_requestedPages.isEmpty())
+        m_settleFrames = m_window->concurrentFrameCount() + 1;
+    else if (m_settleFrames > 0)
+        --m_settleFrames;
+
+    QVector<LoadedPage> loadedPages;
+    {
+        QMutexLocker locker(&m_loadedMutex);
+        const int count = qMin(m_loadedPages.size(), MAX_UPLOADS_PER_FRAME);
+        loadedPages = m_loadedPages.mid(0, count);
+        m_loadedPages.remove(0, count);
+    }
+
+    quint8 *staging = m_stagingData[frameSlot];
+    QVector<VkBufferImageCopy> pageRegions;
+
+    for (int i = 0; i < loadedPages.size(); ++i) {
+        const LoadedPage &page = loadedPages[i];
+
+        if (m_residentPages.contains(page.key)) {
+            m_requestedPages.remove(page.key);
+            continue;
+        }
+
+        // Every slot is pinned or sampled this frame, so the cache cannot
+        // hold the visible pages. Retrying every frame would keep the
+        // scheduler drawing forever, so the rest are dropped.
+        const int slot = allocateSlot();
+        if (slot < 0) {
+            if (!m_cacheTooSmallReported) {
+                qWarning("Virtual texture cache of %d pages is too small for the visible pages",
+                         m_slots.size());
+                m_cacheTooSmallReported = true;
+            }
+            for (int j = i; j < loadedPages.size(); ++j) {
+                m_requestedPages.remove(loadedPages[j].key);
+                m_rejectedPages.insert(loadedPages[j].key);
+            }
+            break;
+        }
+
+        m_requestedPages.remove(page.key);
+
+        PageSlot &pageSlot = m_slots[slot];
+        pageSlot.key = page.key;
+        pageSlot.lastUsedFrame = m_frameCounter;
+        pageSlot.occupied = true;
+        pageSlot.pinned = m_pinnedPages.contains(page.key);
+        m_residentPages.insert(page.key, slot);
+        m_indirectionDirty = true;
+
+        const VkDeviceSize offset = VkDeviceSize(pageRegions.size()) * VIRTUAL_PAGE_BYTES;
+        memcpy(staging + offset, page.data.constData(), VIRTUAL_PAGE_BYTES);
+
+        VkBufferImageCopy region = {};
+        region.bufferOffset = offset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset.x = (slot % m_slotsPerSide) * VIRTUAL_PAGE_SLOT_SIZE;
+        region.imageOffset.y = (slot / m_slotsPerSide) * VIRTUAL_PAGE_SLOT_SIZE;
+        region.imageExtent.width = VIRTUAL_PAGE_SLOT_SIZE;
+        region.imageExtent.height = VIRTUAL_PAGE_SLOT_SIZE;
+        region.imageExtent.depth = 1;
+        pageRegions.append(region);
+    }
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    if (!pageRegions.isEmpty() || !m_physicalCacheInitialized) {
+        barrier.image = m_physicalCache;
+        barrier.oldLayout = m_physicalCacheInitialized
+            ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+            : VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        m_deviceFunctions->vkCmdPipelineBarrier(
+            commandBuffer,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0,
+            0,
+            nullptr,
+            0,
+            nullptr,
+            1,
+            &barrier
+        );
+
+        if (!pageRegions.isEmpty()) {
+            m_deviceFunctions->vkCmdCopyBufferToImage(
+                commandBuffer,
+                m_stagingBuffers[frameSlot],
+                m_physicalCache,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                static_cast<uint32_t>(pageRegions.size()),
+                pageRegions.constData()
+            );
+        }
+
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        m_deviceFunctions->vkCmdPipelineBarrier(
+            commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            0,
+            0,
+            nullptr,
+            0,
+            nullptr,
+            1,
+            &barrier
+        );
+
+        m_physicalCacheInitialized = true;
+    }
+
+    if (!m_indirectionDirty) {
+        return;
+    }
+
+    rebuildIndirection();
+
+    QVector<VkBufferImageCopy> levelRegions;
+    VkDeviceSize offset = VkDeviceSize(MAX_UPLOADS_PER_FRAME) * VIRTUAL_PAGE_BYTES;
+
+    for (int level = 0; level < m_info.levelCount; ++level) {
+        const int pages = m_info.pagesAtLevel(level);
+        const VkDeviceSize levelBytes = VkDeviceSize(pages) * pages * sizeof(quint32);
+        memcpy(staging + offset, m_indirectionEntries[level].constData(), levelBytes);
+
+        VkBufferImageCopy region = {};
+        region.bufferOffset = offset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = uint32_t(level);
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent.width = uint32_t(pages);
+        region.imageExtent.height = uint32_t(pages);
+        region.imageExtent.depth = 1;
+        levelRegions.append(region);
+
+        offset += levelBytes;
+    }
+
+    barrier.image = m_indirection;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    m_deviceFunctions->vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        0,
+        nullptr,
+        0,
+        nullptr,
+        1,
+        &barrier
+    );
+
+    m_deviceFunctions->vkCmdCopyBufferToImage(
+        commandBuffer,
+        m_stagingBuffers[frameSlot],
+        m_indirection,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        static_cast<uint32_t>(levelRegions.size()),
+        levelRegions.constData()
+    );
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    m_deviceFunctions->vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        0,
+        0,
+        nullptr,
+        0,
+        nullptr,
+        1,
+        &barrier
+    );
+
+    m_indirectionDirty = false;
+}
+
+void VirtualTexture::beginFeedbackPass(VkCommandBuffer commandBuffer) {
+    std::array<VkClearValue, 2> clearValues = {};
+    clearValues[0].color.uint32[0] = 0;
+    clearValues[1].depthStencil = {1.0f, 0};
+
+    VkRenderPassBeginInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = m_feedbackRenderPass;
+    renderPassInfo.framebuffer = m_feedbackFramebuffer;
+    renderPassInfo.renderArea.offset.x = 0;
+    renderPassInfo.renderArea.offset.y = 0;
+    renderPassInfo.renderArea.extent.width = uint32_t(m_feedbackSize.width());
+    renderPassInfo.renderArea.extent.height = uint32_t(m_feedbackSize.height());
+    renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+    renderPassInfo.pClearValues = clearValues.data();
+
+    m_deviceFunctions->vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+    VkViewport viewport;
+    viewport.x = 0;
+    viewport.y = 0;
+    viewport.width = m_feedbackSize.width();
+    viewport.height = m_feedbackSize.height();
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    m_deviceFunctions->vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+    VkRect2D scissor;
+    scissor.offset.x = 0;
+    scissor.offset.y = 0;
+    scissor.extent.width = uint32_t(m_feedbackSize.width());
+    scissor.extent.height = uint32_t(m_feedbackSize.height());
+    m_deviceFunctions->vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+
+void VirtualTexture::endFeedbackPass(VkCommandBuffer commandBuffer) {
+    const int frameSlot = m_window->currentFrame();
+
+    m_deviceFunctions->vkCmdEndRenderPass(commandBuffer);
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent.width = uint32_t(m_feedbackSize.width());
+    region.imageExtent.height = uint32_t(m_feedbackSize.height());
+    region.imageExtent.depth = 1;
+
+    m_deviceFunctions->vkCmdCopyImageToBuffer(
+        commandBuffer,
+        m_feedbackImage,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        m_readbackBuffers[frameSlot],
+        1,
+        &region
+    );
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = m_readbackBuffers[frameSlot];
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+
+    m_deviceFunctions->vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_HOST_BIT,
+        0,
+        0,
+        nullptr,
+        1,
+        &barrier,
+        0,
+        nullptr
+    );
+
+    m_readbackPending[frameSlot] = true;
+}
+
+VirtualTextureParams VirtualTexture::params(bool feedbackPass) const {
+    const float virtualSize = float(m_info.pageCount * VIRTUAL_PAGE_SIZE);
+    const float physicalSize = float(m_slotsPerSide * VIRTUAL_PAGE_SLOT_SIZE);
+
+    VirtualTextureParams params = {};
+    params.uvScale[0] = float(m_info.imageSize.width()) / virtualSize;
+    params.uvScale[1] = float(m_info.imageSize.height()) / virtualSize;
+    params.physicalScale[0] = 1.0f / physicalSize;
+    params.physicalScale[1] = 1.0f / physicalSize;
+    params.pageCount = float(m_info.pageCount);
+    params.maxLevel = float(m_info.levelCount - 1);
+    params.lodBias = feedbackPass ? -std::log2(float(FEEDBACK_SCALE)) : 0.0f;
+
+    return params;
+}
+
+void VirtualTexture::release() {
+    m_loaderPool.waitForDone();
+
+    {
+        QMutexLocker locker(&m_loadedMutex);
+        m_loadedPages.clear();
+    }
+    m_requestedPages.clear();
+    m_residentPages.clear();
+    m_pinnedPages.clear();
+    m_rejectedPages.clear();
+    m_slots.clear();
+
+    if (!m_physicalCache) {
+        return;
+    }
+
+    VkDevice device = m_window->device();
+
+    releaseFeedbackTarget();
+
+    if (m_feedbackRenderPass) {
+        m_deviceFunctions->vkDestroyRenderPass(device, m_feedbackRenderPass, nullptr);
+        m_feedbackRenderPass = VK_NULL_HANDLE;
+    }
+
+    for (int i = 0; i < m_stagingBuffers.size(); ++i) {
+        m_deviceFunctions->vkDestroyBuffer(device, m_stagingBuffers[i], nullptr);
+        m_renderer->memoryAllocator()->free(m_stagingMemory[i]);
+    }
+    m_stagingBuffers.clear();
+    m_stagingMemory.clear();
+    m_stagingData.clear();
+
+    m_deviceFunctions->vkDestroySampler(device, m_indirectionSampler, nullptr);
+    m_deviceFunctions->vkDestroyImageView(device, m_indirectionView, nullptr);
+    m_deviceFunctions->vkDestroyImage(device, m_indirection, nullptr);
+    m_renderer->memoryAllocator()->free(m_indirectionMemory);
+    m_indirectionSampler = VK_NULL_HANDLE;
+    m_indirectionView = VK_NULL_HANDLE;
+    m_indirection = VK_NULL_HANDLE;
+
+    m_deviceFunctions->vkDestroySampler(device, m_physicalCacheSampler, nullptr);
+    m_deviceFunctions->vkDestroyImageView(device, m_physicalCacheView, nullptr);
+    m_deviceFunctions->vkDestroyImage(device, m_physicalCache, nullptr);
+    m_renderer->memoryAllocator()->free(m_physicalCacheMemory);
+    m_physicalCacheSampler = VK_NULL_HANDLE;
+    m_physicalCacheView = VK_NULL_HANDLE;
+    m_physicalCache = VK_NULL_HANDLE;
+    m_physicalCacheInitialized = false;
+    m_indirectionDirty = true;
+}
@@ -0,0 +1,165 @@
+#ifndef VIRTUALTEXTURE_H
+#define VIRTUALTEXTURE_H
+
+#include <QVulkanDeviceFunctions>
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QSize>
+#include <QThreadPool>
+#include <QVector>
+
+#include "memoryallocator.h"
+#include "virtualtexturebuilder.h"
+
+class VulkanWindow;
+class Renderer;
+
+struct VirtualTextureParams {
+    float uvScale[2];
+    float physicalScale[2];
+    float pageCount;
+    float maxLevel;
+    float lodBias;
+};
+
+class VirtualTexture
+{
+public:
+    VirtualTexture(Renderer *renderer, VulkanWindow *window, QVulkanDeviceFunctions *deviceFunctions);
+    ~VirtualTexture();
+
+    bool open(const QString &pageDirectory);
+    void create(VkDeviceSize memoryBudget);
+    void release();
+
+    void createFeedbackTarget(const QSize &swapChainImageSize);
+    void releaseFeedbackTarget();
+
+    void update(VkCommandBuffer commandBuffer);
+    void beginFeedbackPass(VkCommandBuffer commandBuffer);
+    void endFeedbackPass(VkCommandBuffer commandBuffer);
+
+    VirtualTextureParams params(bool feedbackPass) const;
+
+    VkRenderPass feedbackRenderPass() const {
+        return m_feedbackRenderPass;
+    }
+
+    VkImageView physicalCacheView() const {
+        return m_physicalCacheView;
+    }
+
+    VkSampler physicalCacheSampler() const {
+        return m_physicalCacheSampler;
+    }
+
+    VkImageView indirectionView() const {
+        return m_indirectionView;
+    }
+
+    VkSampler indirectionSampler() const {
+        return m_indirectionSampler;
+    }
+
+    int residentPageCount() const {
+        return m_residentPages.size();
+    }
+
+    bool isStreaming() const {
+        return !m_requestedPages.isEmpty() || m_settleFrames > 0;
+    }
+
+    void completePageLoad(quint32 key, const QByteArray &data);
+
+private:
+    struct PageSlot {
+        quint32 key = 0;
+        quint64 lastUsedFrame = 0;
+        bool occupied = false;
+        bool pinned = false;
+    };
+
+    struct LoadedPage {
+        quint32 key = 0;
+        QByteArray data;
+    };
+
+    Renderer *m_renderer = nullptr;
+    VulkanWindow *m_window = nullptr;
+    QVulkanDeviceFunctions *m_deviceFunctions = nullptr;
+
+    QString m_pageDirectory;
+    VirtualTextureInfo m_info;
+
+    int m_slotsPerSide = 0;
+    int m_maxPendingPages = 0;
+    quint64 m_frameCounter = 0;
+    int m_settleFrames = 0;
+
+    VkImage m_physicalCache = VK_NULL_HANDLE;
+    MemoryAllocation m_physicalCacheMemory;
+    VkImageView m_physicalCacheView = VK_NULL_HANDLE;
+    VkSampler m_physicalCacheSampler = VK_NULL_HANDLE;
+    bool m_physicalCacheInitialized = false;
+
+    VkImage m_indirection = VK_NULL_HANDLE;
+    MemoryAllocation m_indirectionMemory;
+    VkImageView m_indirectionView = VK_NULL_HANDLE;
+    VkSampler m_indirectionSampler = VK_NULL_HANDLE;
+    QVector<QVector<quint32>> m_indirectionEntries;
+    VkDeviceSize m_indirectionBytes = 0;
+    bool m_indirectionDirty = true;
+
+    VkDeviceSize m_stagingBytesPerFrame = 0;
+    QVector<VkBuffer> m_stagingBuffers;
+    QVector<MemoryAllocation> m_stagingMemory;
+    QVector<quint8 *> m_stagingData;
+
+    VkRenderPass m_feedbackRenderPass = VK_NULL_HANDLE;
+    QSize m_feedbackSize;
+    VkImage m_feedbackImage = VK_NULL_HANDLE;
+    MemoryAllocation m_feedbackImageMemory;
+    VkImageView m_feedbackImageView = VK_NULL_HANDLE;
+    VkImage m_feedbackDepthImage = VK_NULL_HANDLE;
+    MemoryAllocation m_feedbackDepthImageMemory;
+    VkImageView m_feedbackDepthImageView = VK_NULL_HANDLE;
+    VkFramebuffer m_feedbackFramebuffer = VK_NULL_HANDLE;
+    QVector<VkBuffer> m_readbackBuffers;
+    QVector<MemoryAllocation> m_readbackMemory;
+    QVector<const quint32 *> m_readbackData;
+    QVector<bool> m_readbackPending;
+
+    QVector<PageSlot> m_slots;
+    QHash<quint32, int> m_residentPages;
+    QSet<quint32> m_requestedPages;
+    QSet<quint32> m_pinnedPages;
+    QSet<quint32> m_rejectedPages;
+    bool m_cacheTooSmallReported = false;
+
+    QThreadPool m_loaderPool;
+    QMutex m_loadedMutex;
+    QVector<LoadedPage> m_loadedPages;
+
+private:
+    static quint32 pageKey(int level, int x, int y);
+    static int pageLevel(quint32 key);
+    static int pageX(quint32 key);
+    static int pageY(quint32 key);
+
+    QByteArray readPage(quint32 key) const;
+    void requestPage(quint32 key);
+    void processFeedback(int frameSlot);
+    int allocateSlot();
+    void rebuildIndirection();
+
+    void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageUsageFlags usage, VkImage &image, MemoryAllocation &imageMemory, MemoryUsage memoryUsage, const QString &name);
+    VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectMask, uint32_t mipLevels);
+    VkSampler createSampler(VkFilter filter, VkSamplerMipmapMode mipmapMode, float maxLod);
+    void createFeedbackRenderPass();
+
+    friend class PageLoadTask;
+};
+
+#endif // VIRTUALTEXTURE_H
@@ -0,0 +1,297 @@
+#include "virtualtexturebuilder.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageReader>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStandardPaths>
+#include <memory>
+#include <vector>
+
+static const QString INFO_FILE_NAME = "virtualtexture.json";
+
+class LevelWriter
+{
+public:
+    LevelWriter(const QString &fileName, int width, int height, int pagesPerSide, LevelWriter *next)
+        : m_file(fileName)
+        , m_width(width)
+        , m_height(height)
+        , m_pagesPerSide(pagesPerSide)
+        , m_next(next) {}
+
+    bool open() {
+        return m_file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+    }
+
+    void append(const QImage &rows);
+    bool finish();
+
+private:
+    QFile m_file;
+    int m_width;
+    int m_height;
+    int m_pagesPerSide;
+    LevelWriter *m_next;
+
+    QImage m_rows;
+    int m_firstRow = 0;
+    int m_nextPageRow = 0;
+    QImage m_oddRow;
+    bool m_failed = false;
+
+private:
+    void writeReadyPages(bool final);
+    void writePage(int pageX, int pageY);
+    QImage downsample(const QImage &rows) const;
+};
+
+static QImage concatenateRows(const QImage &top, const QImage &bottom) {
+    if (top.isNull())
+        return bottom;
+    if (bottom.isNull())
+        return top;
+
+    QImage result(top.width(), top.height() + bottom.height(), QImage::Format_RGBA8888);
+    const size_t rowBytes = static_cast<size_t>(top.width()) * 4;
+    for (int y = 0; y < top.height(); ++y)
+        memcpy(result.scanLine(y), top.constScanLine(y), rowBytes);
+    for (int y = 0; y < bottom.height(); ++y)
+        memcpy(result.scanLine(top.height() + y), bottom.constScanLine(y), rowBytes);
+
+    return result;
+}
+
+void LevelWriter::append(const QImage &rows) {
+    m_rows = concatenateRows(m_rows, rows);
+
+    if (m_next) {
+        QImage pairs = concatenateRows(m_oddRow, rows);
+        m_oddRow = QImage();
+
+        if (pairs.height() % 2) {
+            m_oddRow = pairs.copy(0, pairs.height() - 1, pairs.width(), 1);
+            pairs = pairs.height() > 1
+                ? pairs.copy(0, 0, pairs.width(), pairs.height() - 1)
+                : QImage();
+        }
+
+        if (!pairs.isNull())
+            m_next->append(downsample(pairs));
+    }
+
+    writeReadyPages(false);
+}
+
+bool LevelWriter::finish() {
+    if (m_next && !m_oddRow.isNull()) {
+        m_next->append(downsample(concatenateRows(m_oddRow, m_oddRow)));
+        m_oddRow = QImage();
+    }
+
+    writeReadyPages(true);
+    m_file.close();
+
+    bool result = !m_failed;
+    if (m_next)
+        result = m_next->finish() && result;
+
+    return result;
+}
+
+void LevelWriter::writeReadyPages(bool final) {
+    const int bufferEnd = m_firstRow + m_rows.height();
+
+    while (m_nextPageRow * VIRTUAL_PAGE_SIZE < m_height) {
+        const int needed = qMin(
+            m_height,
+            (m_nextPageRow + 1) * VIRTUAL_PAGE_SIZE + VIRTUAL_PAGE_BORDER
+        );
+        if (bufferEnd < needed && !final)
+            break;
+
+        for (int pageX = 0; pageX * VIRTUAL_PAGE_SIZE < m_width; ++pageX)
+            writePage(pageX, m_nextPageRow);
+
+        ++m_nextPageRow;
+
+        const int keepFrom = m_nextPageRow * VIRTUAL_PAGE_SIZE - VIRTUAL_PAGE_BORDER;
+        if (keepFrom > m_firstRow && keepFrom < bufferEnd) {
+            m_rows = m_rows.copy(0, keepFrom - m_firstRow, m_width, bufferEnd - keepFrom);
+            m_firstRow = keepFrom;
+        }
+    }
+}
+
+void LevelWriter::writePage(int pageX, int pageY) {
+    QImage page(VIRTUAL_PAGE_SLOT_SIZE, VIRTUAL_PAGE_SLOT_SIZE, QImage::Format_RGBA8888);
+
+    const int originX = pageX * VIRTUAL_PAGE_SIZE - VIRTUAL_PAGE_BORDER;
+    const int originY = pageY * VIRTUAL_PAGE_SIZE - VIRTUAL_PAGE_BORDER;
+    const int lastRow = m_firstRow + m_rows.height() - 1;
+
+    for (int y = 0; y < VIRTUAL_PAGE_SLOT_SIZE; ++y) {
+        const int sourceY = qBound(m_firstRow, qBound(0, originY + y, m_height - 1), lastRow);
+        const quint32 *source = reinterpret_cast<const quint32 *>(
+            m_rows.constScanLine(sourceY - m_firstRow)
+        );
+        quint32 *target = reinterpret_cast<quint32 *>(page.scanLine(y));
+
+        for (int x = 0; x < VIRTUAL_PAGE_SLOT_SIZE; ++x)
+            target[x] = source[qBound(0, originX + x, m_width - 1)];
+    }
+
+    const qint64 offset = qint64(pageY * m_pagesPerSide + pageX) * VIRTUAL_PAGE_BYTES;
+    if (!m_file.seek(offset)
+        || m_file.write(reinterpret_cast<const char *>(page.constBits()), VIRTUAL_PAGE_BYTES) != VIRTUAL_PAGE_BYTES)
+        m_failed = true;
+}
+
+QImage LevelWriter::downsample(const QImage &rows) const {
+    const int width = (rows.width() + 1) / 2;
+    const int height = rows.height() / 2;
+    QImage result(width, height, QImage::Format_RGBA8888);
+
+    for (int y = 0; y < height; ++y) {
+        const uchar *row0 = rows.constScanLine(2 * y);
+        const uchar *row1 = rows.constScanLine(2 * y + 1);
+        uchar *target = result.scanLine(y);
+
+        for (int x = 0; x < width; ++x) {
+            const int x0 = 2 * x * 4;
+            const int x1 = qMin(2 * x + 1, rows.width() - 1) * 4;
+            for (int c = 0; c < 4; ++c) {
+                const int sum = row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c];
+                target[x * 4 + c] = static_cast<uchar>((sum + 2) / 4);
+            }
+        }
+    }
+
+    return result;
+}
+
+QString VirtualTextureBuilder::pageDirectory(const QString &sourcePath) {
+    QFileInfo fileInfo(sourcePath);
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(fileInfo.canonicalFilePath().toUtf8());
+    hash.addData(QByteArray::number(fileInfo.size()));
+    hash.addData(QByteArray::number(fileInfo.lastModified().toMSecsSinceEpoch()));
+
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+        + "/virtualtextures/" + QString::fromLatin1(hash.result().toHex());
+}
+
+QString VirtualTextureBuilder::levelFileName(const QString &pageDirectory, int level) {
+    return pageDirectory + QString("/level%1.pages").arg(level);
+}
+
+VirtualTextureInfo VirtualTextureBuilder::infoForImageSize(const QSize &imageSize) {
+    VirtualTextureInfo info;
+    info.imageSize = imageSize;
+
+    const int largestSide = qMax(imageSize.width(), imageSize.height());
+    const int pagesNeeded = (largestSide + VIRTUAL_PAGE_SIZE - 1) / VIRTUAL_PAGE_SIZE;
+
+    info.pageCount = 1;
+    info.levelCount = 1;
+    while (info.pageCount < pagesNeeded) {
+        info.pageCount *= 2;
+        ++info.levelCount;
+    }
+
+    return info;
+}
+
+bool VirtualTextureBuilder::readInfo(const QString &pageDirectory, VirtualTextureInfo &info) {
+    QFile file(pageDirectory + "/" + INFO_FILE_NAME);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    const QJsonObject root = QJsonDocument::fromJson(file.readAll()).object();
+    if (root.value("pageSize").toInt() != VIRTUAL_PAGE_SIZE
+        || root.value("pageBorder").toInt() != VIRTUAL_PAGE_BORDER)
+        return false;
+
+    info = infoForImageSize(QSize(root.value("width").toInt(), root.value("height").toInt()));
+
+    return info.imageSize.isValid()
+        && root.value("levelCount").toInt() == info.levelCount;
+}
+
+bool VirtualTextureBuilder::build(const QString &sourcePath, const QString &pageDirectory) {
+    QImageReader probe(sourcePath);
+    const QSize imageSize = probe.size();
+    if (!imageSize.isValid()) {
+        qWarning("Failed to read virtual texture size: %s", sourcePath.toStdString().c_str());
+        return false;
+    }
+
+    if (!QDir().mkpath(pageDirectory)) {
+        qWarning("Failed to create page directory: %s", pageDirectory.toStdString().c_str());
+        return false;
+    }
+    QFile::remove(pageDirectory + "/" + INFO_FILE_NAME);
+
+    const VirtualTextureInfo info = infoForImageSize(imageSize);
+
+    std::vector<std::unique_ptr<LevelWriter>> writers(info.levelCount);
+    LevelWriter *next = nullptr;
+    for (int level = info.levelCount - 1; level >= 0; --level) {
+        const int width = qMax(1, ((imageSize.width() - 1) >> level) + 1);
+        const int height = qMax(1, ((imageSize.height() - 1) >> level) + 1);
+
+        writers[level].reset(new LevelWriter(
+            levelFileName(pageDirectory, level),
+            width,
+            height,
+            info.pagesAtLevel(level),
+            next
+        ));
+        if (!writers[level]->open()) {
+            qWarning("Failed to open page file for level %d", level);
+            return false;
+        }
+        next = writers[level].get();
+    }
+
+    for (int y = 0; y < imageSize.height(); y += VIRTUAL_PAGE_SIZE) {
+        const int rows = qMin(VIRTUAL_PAGE_SIZE, imageSize.height() - y);
+
+        QImageReader reader(sourcePath);
+        reader.setClipRect(QRect(0, y, imageSize.width(), rows));
+
+        QImage strip = reader.read();
+        if (strip.isNull()) {
+            qWarning("Failed to read rows %d-%d of %s", y, y + rows, sourcePath.toStdString().c_str());
+            return false;
+        }
+
+        writers[0]->append(strip.convertToFormat(QImage::Format_RGBA8888));
+    }
+
+    if (!writers[0]->finish()) {
+        qWarning("Failed to write virtual texture pages to %s", pageDirectory.toStdString().c_str());
+        return false;
+    }
+
+    QJsonObject root;
+    root.insert("source", QFileInfo(sourcePath).canonicalFilePath());
+    root.insert("width", imageSize.width());
+    root.insert("height", imageSize.height());
+    root.insert("pageSize", VIRTUAL_PAGE_SIZE);
+    root.insert("pageBorder", VIRTUAL_PAGE_BORDER);
+    root.insert("levelCount", info.levelCount);
+
+    QFile file(pageDirectory + "/" + INFO_FILE_NAME);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    file.write(QJsonDocument(root).toJson());
+
+    return true;
+}
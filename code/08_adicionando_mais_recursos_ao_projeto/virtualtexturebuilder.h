@@ -0,0 +1,33 @@
+#ifndef VIRTUALTEXTUREBUILDER_H
+#define VIRTUALTEXTUREBUILDER_H
+
+#include <QSize>
+#include <QString>
+
+static const int VIRTUAL_PAGE_SIZE = 128;
+static const int VIRTUAL_PAGE_BORDER = 4;
+static const int VIRTUAL_PAGE_SLOT_SIZE = VIRTUAL_PAGE_SIZE + 2 * VIRTUAL_PAGE_BORDER;
+static const int VIRTUAL_PAGE_BYTES = VIRTUAL_PAGE_SLOT_SIZE * VIRTUAL_PAGE_SLOT_SIZE * 4;
+
+struct VirtualTextureInfo
+{
+    QSize imageSize;
+    int pageCount = 0;
+    int levelCount = 0;
+
+    int pagesAtLevel(int level) const {
+        return qMax(1, pageCount >> level);
+    }
+};
+
+class VirtualTextureBuilder
+{
+public:
+    static QString pageDirectory(const QString &sourcePath);
+    static QString levelFileName(const QString &pageDirectory, int level);
+    static VirtualTextureInfo infoForImageSize(const QSize &imageSize);
+    static bool readInfo(const QString &pageDirectory, VirtualTextureInfo &info);
+    static bool build(const QString &sourcePath, const QString &pageDirectory);
+};
+
+#endif // VIRTUALTEXTUREBUILDER_H
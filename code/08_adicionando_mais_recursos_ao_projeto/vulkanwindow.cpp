@@ -1,14 +1,27 @@
 #include "vulkanwindow.h"
 
+#include "features.h"
 #include "renderer.h"
 
+#include <QKeyEvent>
 #include <QMouseEvent>
 
+static const QString DEFAULT_MEMORY_REPORT_PATH = "memory-report.json";
+
 VulkanWindow::VulkanWindow(QWindow *parentWindow) : QVulkanWindow(parentWindow) {
+#if QT_VERSION >= QT_VERSION_CHECK(6, 7, 0)
+    m_instance.setApiVersion(QVersionNumber(1, 2));
+#endif
+    if (m_instance.supportedExtensions().contains(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME))
+        m_instance.setExtensions(QByteArrayList() << VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
     if (!m_instance.create())
         qFatal("Failed to create Vulkan instance: %d", m_instance.errorCode());
     setVulkanInstance(&m_instance);
     pickPhysicalDevice();
+    requestTransferQueue();
+    requestDescriptorIndexing();
+    requestMemoryBudget();
+    requestDrawIndirectCount();
 
     m_trackball = Trackball(-0.05f, QVector3D(0, 1, 0));
 }
@@ -22,6 +35,7 @@ void VulkanWindow::mousePressEvent(QMouseEvent *event) {
 void VulkanWindow::mouseMoveEvent(QMouseEvent *event) {
     if (event->buttons() & Qt::LeftButton) {
         m_trackball.move(pixelPosToViewPos(event->localPos()));
+        requestUpdate();
     } else {
         m_trackball.release(pixelPosToViewPos(event->localPos()));
     }
@@ -30,11 +44,36 @@ void VulkanWindow::mouseMoveEvent(QMouseEvent *event) {
 void VulkanWindow::mouseReleaseEvent(QMouseEvent *event) {
     if (event->button() == Qt::LeftButton) {
         m_trackball.release(pixelPosToViewPos(event->localPos()));
+        requestUpdate();
     }
 }
 
 void VulkanWindow::wheelEvent(QWheelEvent *event) {
     m_zoom += 0.001 * event->delta();
+    requestUpdate();
+}
+
+void VulkanWindow::keyPressEvent(QKeyEvent *event) {
+    if (event->key() == Qt::Key_F12 && m_renderer) {
+        const QString path = m_memoryReportPath.isEmpty()
+            ? DEFAULT_MEMORY_REPORT_PATH
+            : m_memoryReportPath;
+        m_renderer->writeMemoryReport(path);
+        return;
+    }
+
+    if (event->key() == Qt::Key_F11 && m_renderer) {
+        m_renderer->cycleDebugView();
+        return;
+    }
+
+    if (event->key() == Qt::Key_F10 && m_renderer) {
+        m_depthPrepass = !m_depthPrepass;
+        m_renderer->setDepthPrepass(m_depthPrepass);
+        return;
+    }
+
+    QVulkanWindow::keyPressEvent(event);
 }
 
 void VulkanWindow::pickPhysicalDevice() {
@@ -57,6 +96,89 @@ void VulkanWindow::pickPhysicalDevice() {
         qFatal("No Vulkan capable GPU found.");
 }
 
+void VulkanWindow::requestTransferQueue() {
+    if (!isFeatureEnabled(Feature::TransferQueue))
+        return;
+
+    setQueueCreateInfoModifier([this](const VkQueueFamilyProperties *properties,
+                                      uint32_t queueFamilyCount,
+                                      QVector<VkDeviceQueueCreateInfo> &createInfos) {
+        static const float queuePriority = 0.0f;
+
+        m_transferQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+        for (uint32_t i = 0; i < queueFamilyCount; ++i) {
+            const VkQueueFlags flags = properties[i].queueFlags;
+            if (!(flags & VK_QUEUE_TRANSFER_BIT)
+                || (flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))
+                || properties[i].queueCount == 0)
+                continue;
+
+            m_transferQueueFamilyIndex = i;
+
+            for (const VkDeviceQueueCreateInfo &info : createInfos) {
+                if (info.queueFamilyIndex == i)
+                    return;
+            }
+
+            VkDeviceQueueCreateInfo queueInfo = {};
+            queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+            queueInfo.queueFamilyIndex = i;
+            queueInfo.queueCount = 1;
+            queueInfo.pQueuePriorities = &queuePriority;
+            createInfos.append(queueInfo);
+            return;
+        }
+    });
+}
+
+void VulkanWindow::requestDescriptorIndexing() {
+    if (!isFeatureEnabled(Feature::Bindless))
+        return;
+
+#if QT_VERSION >= QT_VERSION_CHECK(6, 7, 0)
+    setEnabledFeaturesModifier([this](VkPhysicalDeviceFeatures2 &features) {
+        m_descriptorIndexingEnabled = false;
+
+        auto *next = static_cast<VkBaseOutStructure *>(features.pNext);
+        for (; next; next = next->pNext) {
+            if (next->sType != VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES)
+                continue;
+
+            auto *features12 = reinterpret_cast<VkPhysicalDeviceVulkan12Features *>(next);
+            m_descriptorIndexingEnabled = features12->descriptorIndexing
+                && features12->descriptorBindingPartiallyBound;
+            return;
+        }
+    });
+#endif
+}
+
+void VulkanWindow::requestMemoryBudget() {
+    if (!m_instance.extensions().contains(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)
+        && m_instance.apiVersion() < QVersionNumber(1, 1))
+        return;
+
+    if (!supportedDeviceExtensions().contains(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+        return;
+
+    m_deviceExtensions << VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+    setDeviceExtensions(m_deviceExtensions);
+    m_memoryBudgetEnabled = true;
+}
+
+void VulkanWindow::requestDrawIndirectCount() {
+    if (!isFeatureEnabled(Feature::DrawIndirectCount))
+        return;
+
+    if (!supportedDeviceExtensions().contains(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME))
+        return;
+
+    m_deviceExtensions << VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME;
+    setDeviceExtensions(m_deviceExtensions);
+    m_drawIndirectCountEnabled = true;
+}
+
 QPointF VulkanWindow::pixelPosToViewPos(const QPointF& p) {
     float x = ((float) p.x()) / (width() / 2);
     float y = ((float)p.y()) / (height() / 2);
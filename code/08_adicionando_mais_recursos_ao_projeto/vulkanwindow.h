@@ -25,20 +25,91 @@ public:
         return m_zoom;
     }
 
+    uint32_t transferQueueFamilyIndex() const {
+        return m_transferQueueFamilyIndex;
+    }
+
+    bool descriptorIndexingEnabled() const {
+        return m_descriptorIndexingEnabled;
+    }
+
+    void setTextureAtlasDirectory(const QString &directory) {
+        m_textureAtlasDirectory = directory;
+    }
+
+    QString textureAtlasDirectory() const {
+        return m_textureAtlasDirectory;
+    }
+
+    bool memoryBudgetEnabled() const {
+        return m_memoryBudgetEnabled;
+    }
+
+    bool drawIndirectCountEnabled() const {
+        return m_drawIndirectCountEnabled;
+    }
+
+    void setMemoryReportPath(const QString &path) {
+        m_memoryReportPath = path;
+    }
+
+    QString memoryReportPath() const {
+        return m_memoryReportPath;
+    }
+
+    void setDepthBits(int bits) {
+        m_depthBits = bits;
+    }
+
+    int depthBits() const {
+        return m_depthBits;
+    }
+
+    void setContinuousRendering(bool continuous) {
+        m_continuousRendering = continuous;
+    }
+
+    bool continuousRendering() const {
+        return m_continuousRendering;
+    }
+
+    void setDepthPrepass(bool enabled) {
+        m_depthPrepass = enabled;
+    }
+
+    bool depthPrepass() const {
+        return m_depthPrepass;
+    }
+
 protected:
     void mousePressEvent(QMouseEvent *event) override;
     void mouseReleaseEvent(QMouseEvent *event) override;
     void mouseMoveEvent(QMouseEvent *event) override;
     void wheelEvent(QWheelEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
 
 private:
     QVulkanInstance m_instance;
     Renderer *m_renderer = nullptr;
     Trackball m_trackball;
     float m_zoom = 0;
+    uint32_t m_transferQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bool m_descriptorIndexingEnabled = false;
+    QString m_textureAtlasDirectory;
+    bool m_memoryBudgetEnabled = false;
+    bool m_drawIndirectCountEnabled = false;
+    QByteArrayList m_deviceExtensions;
+    QString m_memoryReportPath;
+    int m_depthBits = 0;
+    bool m_continuousRendering = false;
+    bool m_depthPrepass = false;
 
 private:
     void pickPhysicalDevice();
+    void requestTransferQueue();
+    void requestDescriptorIndexing();
+    void requestMemoryBudget();
+    void requestDrawIndirectCount();
     QPointF pixelPosToViewPos(const QPointF& p);
 };
 